@@ -4,13 +4,18 @@ IF "%PROCESSOR_ARCHITECTURE%" == "AMD64" (
   out\ReleaseIA32\primordialsoup.exe out\snapshots\HelloApp.vfuel
   out\ReleaseX64\primordialsoup.exe out\snapshots\HelloApp.vfuel
 
+  set PSOUP_TEST_SNAPSHOT=out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\DebugIA32\test_process.exe
+  set PSOUP_TEST_VM=out\DebugIA32\primordialsoup.exe
   out\DebugIA32\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\DebugX64\test_process.exe
+  set PSOUP_TEST_VM=out\DebugX64\primordialsoup.exe
   out\DebugX64\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\ReleaseIA32\test_process.exe
+  set PSOUP_TEST_VM=out\ReleaseIA32\primordialsoup.exe
   out\ReleaseIA32\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\ReleaseX64\test_process.exe
+  set PSOUP_TEST_VM=out\ReleaseX64\primordialsoup.exe
   out\ReleaseX64\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
 
   out\DebugIA32\primordialsoup.exe out\snapshots\TestRunner.vfuel
@@ -26,9 +31,12 @@ IF "%PROCESSOR_ARCHITECTURE%" == "ARM64" (
   out\DebugARM64\primordialsoup.exe out\snapshots\HelloApp.vfuel
   out\ReleaseARM64\primordialsoup.exe out\snapshots\HelloApp.vfuel
 
+  set PSOUP_TEST_SNAPSHOT=out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\DebugARM64\test_process.exe
+  set PSOUP_TEST_VM=out\DebugARM64\primordialsoup.exe
   out\DebugARM64\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
   set PSOUP_TEST_PROCESS=out\ReleaseARM64\test_process.exe
+  set PSOUP_TEST_VM=out\ReleaseARM64\primordialsoup.exe
   out\ReleaseARM64\primordialsoup.exe out\snapshots\IOTestRunner.vfuel
 
   out\DebugARM64\primordialsoup.exe out\snapshots\TestRunner.vfuel
@@ -7,10 +7,35 @@
 
 #define LOOKUP_CACHE true
 #define STATIC_PREDICTION_BYTECODES true
+#define QUICKENING true
+#if QUICKENING && !STATIC_PREDICTION_BYTECODES
+#error QUICKENING requires STATIC_PREDICTION_BYTECODES
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH true  // Requires labels-as-values.
+#else
+#define THREADED_DISPATCH false
+#endif
+// Translates methods to machine code on first use. Compiled code shares the
+// interpreter's frames and calls back into it for everything but the simplest
+// bytecodes, so the two can hand control to each other at any bytecode. Set by
+// the build for the JIT configurations.
+#if !defined(BASELINE_JIT)
+#define BASELINE_JIT false
+#endif
+#if BASELINE_JIT && !(defined(__x86_64__) && !defined(_WIN32))
+#error BASELINE_JIT is only implemented for x64 with the System V ABI
+#endif
+
+#define PARALLEL_SCAVENGE true
+#define PARALLEL_MARK true
+#define LAZY_SWEEP true
+#define INCREMENTAL_MARK true
+#define COMPACTION true
+#define PRETENURE true
 
 #define TEST_SLOW_PATH false
 
-#define TRACE_GC false
 #define TRACE_GROWTH false
 #define TRACE_SIGNALS false
 
@@ -4,27 +4,44 @@
 
 #include "vm/heap.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <bit>
+
 #include "vm/interpreter.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
 #include "vm/os.h"
+#include "vm/thread.h"
+#include "vm/thread_pool.h"
 
 namespace psoup {
 
 class Region {
  public:
-  static Region* Allocate(size_t size) {
-    VirtualMemory memory = VirtualMemory::Allocate(size,
-                                                   VirtualMemory::kReadWrite,
-                                                   "primordialsoup-heap");
+  static Region* Initialize(VirtualMemory memory) {
 #if defined(DEBUG)
-    memset(reinterpret_cast<void*>(memory.base()), kUnallocatedByte, size);
+    memset(reinterpret_cast<void*>(memory.base()), kUnallocatedByte,
+           memory.size());
 #endif
     Region* region = reinterpret_cast<Region*>(memory.base());
     region->memory_ = memory;
     region->object_end_ = region->object_start();
+    region->cards_ = nullptr;
     return region;
   }
 
+  // The region of an object allocated alone in its region.
+  static Region* FromLargeObject(HeapObject obj) {
+    return reinterpret_cast<Region*>(obj->Addr() -
+                                     AllocationSize(sizeof(Region)));
+  }
+
   void Free() { memory_.Free(); }
+  const VirtualMemory& memory() const { return memory_; }
 
   uword TryAllocate(size_t size) {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
@@ -49,47 +66,490 @@ class Region {
   Region* next() const { return next_; }
   void set_next(Region* next) { next_ = next; }
 
+  // For large-object regions: a byte per card of the object, set if the card
+  // may hold a reference into new-space.
+  uint8_t* cards() const { return cards_; }
+  void set_cards(uint8_t* cards) { cards_ = cards; }
+
  private:
   Region* next_;
   VirtualMemory memory_;
   uword object_end_;
+  uint8_t* cards_;
+};
+
+static constexpr intptr_t kCardSizeLog2 = 10;  // 1KB
+static constexpr size_t kCardSize = static_cast<size_t>(1) << kCardSizeLog2;
+
+static intptr_t CardCount(size_t heap_size) {
+  return (heap_size + kCardSize - 1) >> kCardSizeLog2;
+}
+
+// The part of the slots [from, to] of an object that lies in its given card.
+static void CardPointers(HeapObject obj, intptr_t card,
+                         Object** from, Object** to) {
+  uword card_start = obj->Addr() + (card << kCardSizeLog2);
+  Object* card_from = reinterpret_cast<Object*>(card_start);
+  Object* card_to = reinterpret_cast<Object*>(card_start + kCardSize) - 1;
+  if (card_from > *from) *from = card_from;
+  if (card_to < *to) *to = card_to;
+}
+
+// A fixed-size chunk of the marking work list. Blocks are carved out of
+// from-space, which is otherwise unused during a mark-sweep.
+struct MarkBlock {
+  static constexpr intptr_t kCapacity = 254;
+
+  bool IsEmpty() const { return size == 0; }
+  bool IsFull() const { return size == kCapacity; }
+  void Push(HeapObject obj) {
+    ASSERT(!IsFull());
+    entries[size++] = obj;
+  }
+  HeapObject Pop() {
+    ASSERT(!IsEmpty());
+    return entries[--size];
+  }
+
+  MarkBlock* next;
+  intptr_t size;
+  HeapObject entries[kCapacity];
+};
+
+// Marks on one thread of a mark-sweep. Each worker pushes and pops from its
+// own block and only touches the shared lists to exchange full blocks with the
+// other workers. If no block is left for a push, the object is left unmarked
+// and the marker later rescans the heap for marked objects that refer to
+// unmarked ones.
+class MarkerWorker {
+ public:
+  MarkerWorker(Heap* heap, Marker* marker);
+  ~MarkerWorker();
+
+  void MarkRoots();
+  void Run();
+  void MarkEphemeronList();
+  void Rescan();
+  void MergeLists();
+
+  bool HasWork() const { return (block_ != nullptr) && !block_->IsEmpty(); }
+
+ private:
+  static constexpr intptr_t kMinShareSize = 16;
+
+  void MarkObject(Object obj);
+  bool IsMarked(HeapObject obj) const;
+  bool TryMark(HeapObject obj);
+  void Drain();
+  void ShareWork();
+  void ProcessObject(HeapObject obj);
+  void RescanRange(uword start, uword end);
+  void RescanObject(HeapObject obj);
+
+  void AddToRememberedSet(HeapObject obj);
+  void AddToEphemeronList(Ephemeron survivor) {
+    survivor->set_next(ephemeron_list_);
+    ephemeron_list_ = survivor;
+  }
+  void AddToWeakList(WeakArray survivor) {
+    survivor->set_next(weak_list_);
+    weak_list_ = survivor;
+  }
+
+  Heap* const heap_;
+  Marker* const marker_;
+  MarkBlock* block_;
+  HeapObject* remembered_set_;
+  intptr_t remembered_set_size_;
+  intptr_t remembered_set_capacity_;
+  Ephemeron ephemeron_list_;
+  WeakArray weak_list_;
+  size_t marked_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MarkerWorker);
 };
 
-class MarkStack {
+// Coordinates the workers of a mark-sweep's marking, which may be only the
+// calling thread. Holds the blocks of marking work and detects termination
+// when every worker is idle and no full blocks remain.
+class Marker {
  public:
-  void Init(uword limit) {
-    top_ = &stack_[0];
-    end_ = reinterpret_cast<HeapObject*>(limit);
+  Marker(Heap* heap, intptr_t num_workers, uword blocks_start,
+         uword blocks_end, bool finishing);
+  ~Marker();
+
+  void Mark();
+
+  bool parallel() const { return num_workers_ > 1; }
+  // Whether this completes an incremental marking, which leaves the remembered
+  // set in place rather than rebuilding it.
+  bool finishing() const { return finishing_; }
+
+  MarkBlock* AllocateBlock();
+  void FreeBlock(MarkBlock* block);
+  void PushFullBlock(MarkBlock* block);
+  MarkBlock* PopFullBlock();
+  bool HasIdleWorkers() const {
+    return idle_workers_.load(std::memory_order_relaxed) != 0;
   }
+  void SetOverflowed() { overflowed_.store(true, std::memory_order_relaxed); }
+  void TaskDone();
 
-  bool IsEmpty() const { return top_ == &stack_[0]; }
-  void Push(HeapObject obj) {
-    if (top_ == end_) {
-      FATAL("Mark stack overflow");
-    } else {
-      *top_++ = obj;
-    }
+ private:
+  void RunPhase(bool roots);
+
+  Heap* const heap_;
+  const intptr_t num_workers_;
+  const bool finishing_;
+  MarkerWorker* workers_[Heap::kMaxGCWorkers];
+  std::atomic<bool> overflowed_;
+
+  // Protected by monitor_.
+  Monitor monitor_;
+  MarkBlock* empty_blocks_;
+  MarkBlock* full_blocks_;
+  intptr_t num_idle_;
+  intptr_t num_running_tasks_;
+  bool done_;
+  std::atomic<intptr_t> idle_workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(Marker);
+};
+
+// Copies and scans survivors on one thread of a parallel scavenge. Each worker
+// bump allocates out of its own buffers in to-space and old-space, and scans
+// the objects it copied in the order they were copied, as in Cheney's
+// algorithm. Only forwarding a from-space object needs to be synchronized with
+// the other workers. Unscanned parts of a buffer are shared with idle workers.
+class ScavengerWorker {
+ public:
+  ScavengerWorker(Heap* heap, ParallelScavenger* scavenger);
+  ~ScavengerWorker();
+
+  void ScavengeRoots();
+  void Run();
+  void ScavengeEphemeronList();
+  void MergeLists();
+  void Finish();
+
+  bool HasWork() const {
+    return (new_.scan < new_.top) || (old_.scan < old_.top);
+  }
+
+ private:
+  static constexpr size_t kBufferSize = 32 * KB;
+  static constexpr size_t kDirectAllocationSize = kBufferSize / 4;
+  static constexpr size_t kMinShareSize = 4 * KB;
+
+  struct Buffer {
+    uword scan;
+    uword top;
+    uword end;
+  };
+
+  void Drain();
+  void ShareWork();
+  void ScanRange(uword start, uword end);
+  bool ScavengePointers(Object* from, Object* to);
+  void ScavengeNewObject(HeapObject obj);
+  void ScavengeOldObject(HeapObject obj);
+  void ScavengeCards(HeapObject obj);
+  bool ScavengeClass(intptr_t cid);
+  HeapObject Forward(HeapObject from_target);
+
+  uword TryAllocateNew(size_t size, bool* direct);
+  uword AllocateOld(size_t size, bool* direct);
+  void UndoAllocation(uword addr, size_t size, bool tenured, bool direct);
+  void RetireNew();
+  void RetireOld();
+
+  void AddToRememberedSet(HeapObject obj);
+  void AddToEphemeronList(Ephemeron survivor) {
+    survivor->set_next(ephemeron_list_);
+    ephemeron_list_ = survivor;
+  }
+  void AddToWeakList(WeakArray survivor) {
+    survivor->set_next(weak_list_);
+    weak_list_ = survivor;
+  }
+
+  Heap* const heap_;
+  ParallelScavenger* const scavenger_;
+  Buffer new_;
+  Buffer old_;
+  HeapObject* remembered_set_;
+  intptr_t remembered_set_size_;
+  intptr_t remembered_set_capacity_;
+  Ephemeron ephemeron_list_;
+  WeakArray weak_list_;
+  ObjectStack tenured_marked_;
+  size_t marked_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScavengerWorker);
+};
+
+// Coordinates the workers of a parallel scavenge: hands out the remembered set
+// in chunks and to-space in buffers, holds the shared ranges of unscanned
+// objects, and detects termination when every worker is idle and no ranges
+// remain. The calling thread acts as the first worker and scavenges the roots.
+class ParallelScavenger {
+ public:
+  ParallelScavenger(Heap* heap, intptr_t num_workers);
+  ~ParallelScavenger();
+
+  void Scavenge();
+
+  bool ClaimRememberedSet(intptr_t* start, intptr_t* end);
+  uword TryAllocateToSpace(size_t min_size, size_t max_size, uword* end);
+  void PushWork(uword start, uword end);
+  bool PopWork(uword* start, uword* end);
+  bool HasIdleWorkers() const {
+    return idle_workers_.load(std::memory_order_relaxed) != 0;
   }
-  HeapObject Pop() { return *--top_; }
+  void TaskDone();
+
+  Mutex* old_space_mutex() { return &old_space_mutex_; }
 
  private:
-  HeapObject* top_;
-  HeapObject* end_;
-  HeapObject stack_[];
+  static constexpr intptr_t kRememberedSetChunk = 64;
+
+  struct Range {
+    uword start;
+    uword end;
+  };
+
+  void RunPhase(bool roots);
+
+  Heap* const heap_;
+  const intptr_t num_workers_;
+  ScavengerWorker* workers_[Heap::kMaxGCWorkers];
+
+  std::atomic<uword> top_;
+  const uword limit_;
+
+  std::atomic<intptr_t> remembered_set_cursor_;
+  const intptr_t remembered_set_size_;
+
+  Mutex old_space_mutex_;
+
+  // Protected by monitor_.
+  Monitor monitor_;
+  Range* ranges_;
+  intptr_t ranges_size_;
+  intptr_t ranges_capacity_;
+  intptr_t num_idle_;
+  intptr_t num_running_tasks_;
+  bool done_;
+  std::atomic<intptr_t> idle_workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelScavenger);
+};
+
+// Semispaces are mapped separately, so they are sized in multiples of the
+// largest allocation granularity of the supported platforms.
+static constexpr size_t kSemispaceGranularity = 64 * KB;
+static constexpr int64_t kMaxOptionValue = GB / KB;
+
+static const char* const kGCOptions[] = {
+  "scavenge-pause-goal-us",
+  "gc-time-goal-percent",
+  "new-space-min-kb",
+  "new-space-max-kb",
+  "old-growth-percent",
+  "heap-limit-mb",
+  "heap-soft-limit-mb",
+  "huge-pages",
+  "numa-local",
+  "verify-heap",
+  "scavenge-every",
+  "mark-sweep-every",
+  "trace-gc",
 };
 
-Heap::Heap()
+GCPolicy::GCPolicy()
+    : scavenge_pause_goal_(0),
+      gc_time_goal_percent_(5),
+      min_semispace_capacity_(sizeof(uword) * MB / 8),
+      max_semispace_capacity_(2 * sizeof(uword) * MB),
+      old_growth_percent_(50),
+      heap_limit_(0),
+      heap_soft_limit_(0),
+      huge_pages_(false),
+      numa_local_(false),
+      verify_heap_(false),
+      scavenge_every_(0),
+      mark_sweep_every_(0),
+      trace_gc_(false) {}
+
+bool GCPolicy::SetOption(const char* option) {
+  if (strncmp(option, "--", 2) != 0) {
+    return false;
+  }
+  const char* name = option + 2;
+  const char* equals = strchr(name, '=');
+  if (equals == nullptr) {
+    return false;
+  }
+  size_t name_length = equals - name;
+  char* end;
+  int64_t value = strtoll(equals + 1, &end, 10);
+  if ((end == equals + 1) || (*end != '\0') || (value < 0) ||
+      (value > kMaxOptionValue)) {
+    return false;
+  }
+  auto is = [&](const char* candidate) {
+    return (strlen(candidate) == name_length) &&
+           (strncmp(name, candidate, name_length) == 0);
+  };
+
+  if (is("scavenge-pause-goal-us")) {
+    scavenge_pause_goal_ = value * kNanosecondsPerMicrosecond;
+  } else if (is("gc-time-goal-percent")) {
+    if ((value < 1) || (value > 99)) {
+      return false;
+    }
+    gc_time_goal_percent_ = value;
+  } else if (is("new-space-min-kb")) {
+    size_t size = Utils::RoundUp(static_cast<size_t>(value) * KB,
+                                 kSemispaceGranularity);
+    min_semispace_capacity_ = size < kSemispaceGranularity
+        ? kSemispaceGranularity : size;
+    if (max_semispace_capacity_ < min_semispace_capacity_) {
+      max_semispace_capacity_ = min_semispace_capacity_;
+    }
+  } else if (is("new-space-max-kb")) {
+    size_t size = Utils::RoundUp(static_cast<size_t>(value) * KB,
+                                 kSemispaceGranularity);
+    max_semispace_capacity_ = size < kSemispaceGranularity
+        ? kSemispaceGranularity : size;
+    if (min_semispace_capacity_ > max_semispace_capacity_) {
+      min_semispace_capacity_ = max_semispace_capacity_;
+    }
+  } else if (is("old-growth-percent")) {
+    if ((value < 10) || (value > kMaxOldGrowthPercent)) {
+      return false;
+    }
+    old_growth_percent_ = value;
+  } else if (is("heap-limit-mb") || is("heap-soft-limit-mb")) {
+    if (static_cast<uint64_t>(value) > (SIZE_MAX / MB)) {
+      return false;
+    }
+    size_t size = static_cast<size_t>(value) * MB;
+    if (is("heap-limit-mb")) {
+      heap_limit_ = size;
+    } else {
+      heap_soft_limit_ = size;
+    }
+  } else if (is("huge-pages") || is("numa-local") || is("verify-heap") ||
+             is("trace-gc")) {
+    if (value > 1) {
+      return false;
+    }
+    if (is("huge-pages")) {
+      huge_pages_ = value != 0;
+    } else if (is("numa-local")) {
+      numa_local_ = value != 0;
+    } else if (is("verify-heap")) {
+      verify_heap_ = value != 0;
+    } else {
+      trace_gc_ = value != 0;
+    }
+  } else if (is("scavenge-every")) {
+    scavenge_every_ = value;
+  } else if (is("mark-sweep-every")) {
+    mark_sweep_every_ = value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void GCPolicy::SetFromEnvironment() {
+  for (const char* name : kGCOptions) {
+    // --new-space-max-kb is read from PSOUP_NEW_SPACE_MAX_KB.
+    char variable[64] = "PSOUP_";
+    size_t length = strlen(variable);
+    for (const char* c = name; *c != '\0'; c++) {
+      variable[length++] = (*c == '-') ? '_' : (*c - 'a' + 'A');
+    }
+    variable[length] = '\0';
+    const char* value = getenv(variable);
+    if (value == nullptr) {
+      continue;
+    }
+    char option[128];
+    snprintf(option, sizeof(option), "--%s=%s", name, value);
+    if (!SetOption(option)) {
+      OS::PrintErr("Ignoring invalid %s=%s\n", variable, value);
+    }
+  }
+}
+
+void GCPolicy::PrintOptions() {
+  OS::PrintErr(
+      "  --scavenge-pause-goal-us=N  Shrink new-space when scavenges average\n"
+      "                              longer than N us (default: no goal)\n"
+      "  --gc-time-goal-percent=N    Grow the heap when collection takes more\n"
+      "                              than N%% of run time (default: 5)\n"
+      "  --new-space-min-kb=N        Smallest semispace (default: %" Pd ")\n"
+      "  --new-space-max-kb=N        Largest semispace (default: %" Pd ")\n"
+      "  --old-growth-percent=N      Old-space growth allowed between\n"
+      "                              mark-sweeps (default: 50)\n"
+      "  --heap-limit-mb=N           Signal out-of-memory in an isolate whose\n"
+      "                              heap passes N MB (default: no limit)\n"
+      "  --heap-soft-limit-mb=N      Collect more often past N MB (default:\n"
+      "                              3/4 of the heap limit)\n"
+      "  --huge-pages=0|1            Advise huge pages for the heap\n"
+      "  --numa-local=0|1            Prefer the creating thread's NUMA node\n"
+      "  --verify-heap=0|1           Check the heap around each collection\n"
+      "  --scavenge-every=N          Scavenge on every Nth allocation\n"
+      "  --mark-sweep-every=N        Mark-sweep at every Nth safepoint\n"
+      "  --trace-gc=0|1              Report each collection\n",
+      GCPolicy().min_semispace_capacity() / KB,
+      GCPolicy().max_semispace_capacity() / KB);
+}
+
+Heap::Heap(const GCPolicy& policy)
     : top_(0),
       end_(0),
+      limit_(0),
       survivor_end_(0),
       to_(),
       from_(),
-      next_semispace_capacity_(kInitialSemispaceCapacity),
+      next_semispace_capacity_(policy.min_semispace_capacity()),
+      new_space_discarded_(false),
+      gc_workers_(1),
+      policy_(policy),
+      scavenge_pause_average_(0),
+      scavenge_interval_average_(0),
+      last_scavenge_end_(0),
+      mark_sweep_time_(0),
+      last_mark_sweep_end_(0),
+      old_growth_percent_(policy.old_growth_percent()),
+      limit_state_(kWithinLimit),
+      allocations_until_scavenge_(0),
+      safepoints_until_mark_sweep_(0),
       regions_(nullptr),
+      large_regions_(nullptr),
+      sweep_regions_(nullptr),
+      release_regions_(nullptr),
       freelist_(),
+      old_top_(0),
+      old_end_(0),
+      reservation_(),
+      reservation_top_(0),
+      reserved_free_(nullptr),
+      reserved_free_size_(0),
       old_size_(0),
       old_capacity_(0),
       old_limit_(0),
+      old_start_marking_(0),
+      old_start_idle_marking_(0),
+      incremental_marking_(false),
+      mark_stack_(),
+      mark_deferred_(),
+      marked_size_(0),
+      old_size_at_last_step_(0),
       remembered_set_(nullptr),
       remembered_set_size_(0),
       remembered_set_capacity_(0),
@@ -97,13 +557,46 @@ Heap::Heap()
       class_table_size_(0),
       class_table_capacity_(0),
       class_table_free_(0),
+      pretenure_(nullptr),
+      pretenure_arrays_(),
+      allocated_(nullptr),
+      survived_(nullptr),
+      arrays_allocated_(),
+      arrays_survived_(),
+      scavenge_count_(0),
       interpreter_(nullptr),
       handles_(),
       handles_size_(0),
       ephemeron_list_(nullptr),
       weak_list_(nullptr) {
-  to_.Allocate(kInitialSemispaceCapacity);
-  from_.Allocate(kInitialSemispaceCapacity);
+  to_.Allocate(policy.min_semispace_capacity());
+  AdviseHeapMemory(&to_.memory_);
+  from_.Allocate(policy.min_semispace_capacity());
+  AdviseHeapMemory(&from_.memory_);
+
+  size_t reservation_size = kReservationSize;
+  if (policy.heap_limit() != 0) {
+    // Past a quarter over the limit, the isolate is killed.
+    reservation_size = Utils::RoundUp(
+        policy.heap_limit() + policy.heap_limit() / 4,
+        VirtualMemory::kHugePageSize);
+  }
+  if (reservation_size != 0) {
+    reservation_ = VirtualMemory::Reserve(reservation_size,
+                                          "primordialsoup-heap");
+  }
+  if (reservation_.size() != 0) {
+    AdviseHeapMemory(&reservation_);
+    reservation_top_ = reservation_.base();
+    reserved_free_ = new uword[reservation_.size() / kRegionSize];
+  }
+
+  if (PARALLEL_SCAVENGE || PARALLEL_MARK) {
+    gc_workers_ = OS::NumberOfAvailableProcessors();
+    if (gc_workers_ > kMaxGCWorkers) {
+      gc_workers_ = kMaxGCWorkers;
+    }
+  }
 
   remembered_set_capacity_ = 1024;
   remembered_set_ = new HeapObject[remembered_set_capacity_];
@@ -111,6 +604,10 @@ Heap::Heap()
   // Class table.
   class_table_capacity_ = 1024;
   class_table_ = new Object[class_table_capacity_];
+  pretenure_ = new uint8_t[class_table_capacity_];
+  memset(pretenure_, 0, class_table_capacity_);
+  allocated_ = new size_t[class_table_capacity_];
+  survived_ = new size_t[class_table_capacity_];
 #if defined(DEBUG)
   for (intptr_t i = 0; i < kFirstRegularObjectCid; i++) {
     class_table_[i] = static_cast<Object>(kUninitializedWord);
@@ -122,17 +619,37 @@ Heap::Heap()
   class_table_size_ = kFirstRegularObjectCid;
 }
 
-Heap::~Heap() {
-  to_.Free();
-  from_.Free();
-  Region* region = regions_;
+// Those in the reservation are not freed: it is released whole.
+static void FreeRegions(Region* region, const VirtualMemory& reservation) {
   while (region != nullptr) {
     Region* next = region->next();
-    region->Free();
+    if ((region->memory().base() < reservation.base()) ||
+        (region->memory().base() >= reservation.limit())) {
+      region->Free();
+    }
     region = next;
   }
+}
+
+Heap::~Heap() {
+  if (incremental_marking_) {
+    HeapObject::incremental_marking_ = false;
+  }
+  to_.Free();
+  from_.Free();
+  FreeRegions(regions_, reservation_);
+  FreeRegions(large_regions_, reservation_);
+  FreeRegions(sweep_regions_, reservation_);
+  FreeRegions(release_regions_, reservation_);
+  if (reservation_.size() != 0) {
+    reservation_.Free();
+  }
+  delete[] reserved_free_;
   delete[] remembered_set_;
   delete[] class_table_;
+  delete[] pretenure_;
+  delete[] allocated_;
+  delete[] survived_;
 }
 
 Message Heap::AllocateMessage() {
@@ -155,6 +672,13 @@ Message Heap::AllocateMessage() {
 }
 
 uword Heap::AllocateNormal(size_t size) {
+  if (allocations_until_scavenge_ != 0) {
+    if (--allocations_until_scavenge_ == 0) {
+      allocations_until_scavenge_ = policy_.scavenge_every();
+      Scavenge(kStress);
+    }
+  }
+
   if (size >= kLargeAllocationSize) {
     return AllocateOldLarge(size, kControlGrowth);
   }
@@ -187,12 +711,106 @@ uword Heap::AllocateCopy(size_t size) {
 }
 
 uword Heap::AllocateTenure(size_t size) {
-  uword result = AllocateOldSmall(size, kForceGrowth);
+  uword result = AllocateOldBuffered(size);
   PushTenureStack(result);
   return result;
 }
 
+// Makes an unused part of to-space or of an allocation buffer walkable.
+static void FillGap(uword addr, size_t size) {
+  HeapObject object = HeapObject::Initialize(addr, kFreeListElementCid, size);
+  FreeListElement element = static_cast<FreeListElement>(object);
+  if (element->heap_size() == 0) {
+    ASSERT(size > kObjectAlignment);
+    element->set_overflow_size(size);
+  }
+  ASSERT(element->HeapSize() == size);
+}
+
+uword Heap::AllocatePretenured(size_t size) {
+  // Charged against new-space, so that collections happen when they would
+  // have had the object been allocated there and tenured.
+  if (top_ + size > end_) {
+    Scavenge(kNewSpace);
+    if (old_size_ > old_limit_) {
+      MarkSweep(kTenure);
+    }
+  }
+  if (top_ + size <= end_) {
+    end_ -= size;
+    SetAllocationLimit();
+  }
+  return AllocateOldBuffered(size);
+}
+
+// Bump allocates from a buffer taken whole from the free list, rather than
+// searching the free list for each object. Falls back to the free list when
+// only holes too small for a buffer are left.
+uword Heap::AllocateOldBuffered(size_t size) {
+  uword result = old_top_;
+  if (result + size > old_end_) {
+    if ((size > kMaxOldBufferSize / 8) || !RefillOldBuffer(size)) {
+      return AllocateOldSmall(size, kForceGrowth);
+    }
+    result = old_top_;
+  }
+  old_top_ = result + size;
+  if (old_top_ < old_end_) {
+    // Not on the free list until the buffer is abandoned.
+    FillGap(old_top_, old_end_ - old_top_);
+  }
+#if defined(DEBUG)
+  memset(reinterpret_cast<void*>(result), kUninitializedByte, size);
+#endif
+  return result;
+}
+
+bool Heap::RefillOldBuffer(size_t size) {
+  size_t remaining = old_end_ - old_top_;
+  if (remaining > 0) {
+    freelist_.EnqueueRange(old_top_, remaining);
+    old_size_ -= remaining;
+  }
+  old_top_ = old_end_ = 0;
+
+  FreeListElement buffer =
+      freelist_.TryAllocateBuffer(size, kMaxOldBufferSize);
+  while ((buffer == nullptr) && SweepNextRegion()) {
+    buffer = freelist_.TryAllocateBuffer(size, kMaxOldBufferSize);
+  }
+  ReleaseRegions();
+  if (buffer == nullptr) {
+    return false;
+  }
+  // Counted whole until it is abandoned.
+  old_top_ = buffer->Addr();
+  old_end_ = old_top_ + buffer->HeapSize();
+  old_size_ += old_end_ - old_top_;
+  return true;
+}
+
 uword Heap::AllocateOldSmall(size_t size, GrowthPolicy growth) {
+  ASSERT(size < kLargeAllocationSize);
+  if (sweep_regions_ != nullptr) {
+    uword addr = freelist_.TryAllocate(size);
+    while ((addr == 0) && SweepNextRegion()) {
+      addr = freelist_.TryAllocate(size);
+    }
+    ReleaseRegions();
+    if (addr != 0) {
+      old_size_ += size;
+#if defined(DEBUG)
+      memset(reinterpret_cast<void*>(addr), kUninitializedByte, size);
+#endif
+      return addr;
+    }
+  }
+  return AllocateOldSwept(size, growth);
+}
+
+// Does not sweep, so it is safe for the parallel scavenger's workers to call
+// while holding the old-space lock.
+uword Heap::AllocateOldSwept(size_t size, GrowthPolicy growth) {
   ASSERT(size < kLargeAllocationSize);
   uword addr = freelist_.TryAllocate(size);
   if (addr == 0) {
@@ -214,10 +832,16 @@ uword Heap::AllocateOldSmall(size_t size, GrowthPolicy growth) {
 
 uword Heap::AllocateOldLarge(size_t size, GrowthPolicy growth) {
   ASSERT(size >= kLargeAllocationSize);
-  Region* region = AllocateRegion(size + AllocationSize(sizeof(Region)),
-                                  growth);
+  intptr_t num_cards = CardCount(size);
+  Region* region = AllocateRegion(AllocationSize(sizeof(Region)) + size +
+                                  num_cards, growth);
   uword addr = region->TryAllocate(size);
   ASSERT(addr != 0);
+  ASSERT(Region::FromLargeObject(HeapObject::FromAddr(addr)) == region);
+  // The cards follow the object.
+  uint8_t* cards = reinterpret_cast<uint8_t*>(region->object_end());
+  memset(cards, 0, num_cards);
+  region->set_cards(cards);
   old_size_ += size;
 #if defined(DEBUG)
   memset(reinterpret_cast<void*>(addr), kUninitializedByte, size);
@@ -240,6 +864,7 @@ uword Heap::AllocateSnapshot(size_t size) {
     Region* region = AllocateRegion(kRegionSize, kForceGrowth);
     top_ = region->object_start();
     end_ = region->limit();
+    SetAllocationLimit();
     region->set_object_end(end_);
     remaining = end_ - top_;
     old_size_ += remaining;
@@ -256,14 +881,101 @@ uword Heap::AllocateSnapshot(size_t size) {
 Region* Heap::AllocateRegion(size_t region_size, GrowthPolicy growth) {
   if ((growth == kControlGrowth) && ((old_size_ + region_size) > old_limit_)) {
     MarkSweep(kOldSpace);
+  } else if (incremental_marking_) {
+    // Keep marking ahead of old-space growth.
+    interpreter_->Interrupt(Interpreter::kInterruptIncrementalGC);
+  }
+  if (policy_.heap_limit() != 0) {
+    CheckHeapLimit(region_size);
+  }
+  Region* region = nullptr;
+  if (region_size == kRegionSize) {
+    region = TryAllocateReservedRegion();
+  }
+  if (region == nullptr) {
+    VirtualMemory memory = VirtualMemory::Allocate(region_size,
+                                                   VirtualMemory::kReadWrite,
+                                                   "primordialsoup-heap");
+    AdviseHeapMemory(&memory);
+    region = Region::Initialize(memory);
   }
-  Region* region = Region::Allocate(region_size);
   old_capacity_ += region->size();
-  region->set_next(regions_);
-  regions_ = region;
+  // Regions of any other size hold a large object.
+  Region** list = region_size == kRegionSize ? &regions_ : &large_regions_;
+  region->set_next(*list);
+  *list = region;
   return region;
 }
 
+template <typename Visitor>
+void Heap::VisitOldRegions(Visitor visit) {
+  for (Region* region = regions_; region != nullptr; region = region->next()) {
+    visit(region->object_start(), region->object_end());
+  }
+  for (Region* region = large_regions_;
+       region != nullptr;
+       region = region->next()) {
+    visit(region->object_start(), region->object_end());
+  }
+}
+
+// Allocation cannot fail, so passing the hard limit only interrupts the
+// isolate, which signals Newspeak at its next safepoint. Growing a quarter past
+// the limit after that kills the isolate.
+void Heap::CheckHeapLimit(size_t growth) {
+  size_t size = old_size_ + to_.size() + from_.size() + growth;
+  size_t limit = policy_.heap_limit();
+  if ((limit_state_ == kWithinLimit) && (size > limit)) {
+    limit_state_ = kOverLimit;
+    interpreter_->Interrupt(Interpreter::kInterruptOutOfMemory);
+  } else if ((limit_state_ == kOverLimit) && (size > (limit + limit / 4))) {
+    limit_state_ = kKillIsolate;
+    interpreter_->Interrupt(Interpreter::kInterruptOutOfMemory);
+  }
+}
+
+// Carving regions from one reservation keeps them contiguous, so that
+// neighbouring regions can share a huge page, and leaves the reservation's
+// hints in place for each of them.
+Region* Heap::TryAllocateReservedRegion() {
+  uword address;
+  if (reserved_free_size_ > 0) {
+    address = reserved_free_[--reserved_free_size_];
+  } else if (reservation_top_ + kRegionSize <= reservation_.limit()) {
+    address = reservation_top_;
+    reservation_top_ += kRegionSize;
+  } else {
+    return nullptr;  // Exhausted or never reserved.
+  }
+  return Region::Initialize(reservation_.Commit(address, kRegionSize));
+}
+
+bool Heap::IsReserved(Region* region) const {
+  uword address = region->memory().base();
+  return (address >= reservation_.base()) && (address < reservation_.limit());
+}
+
+void Heap::AdviseHeapMemory(VirtualMemory* memory) {
+  if (policy_.huge_pages() &&
+      (memory->size() >= VirtualMemory::kHugePageSize)) {
+    memory->AdviseHugePages();
+  }
+  if (policy_.numa_local()) {
+    memory->BindToCurrentNode();
+  }
+}
+
+void Heap::RememberCard(HeapObject obj, uword slot) {
+  ASSERT(obj->IsOldObject());
+  ASSERT(obj->has_card_table());
+  uint8_t* cards = Region::FromLargeObject(obj)->cards();
+  ASSERT(cards != nullptr);
+  cards[(slot - obj->Addr()) >> kCardSizeLog2] = 1;
+  if (!obj->is_remembered()) {
+    AddToRememberedSet(obj);
+  }
+}
+
 void Heap::GrowRememberedSet() {
   remembered_set_capacity_ += (remembered_set_capacity_ >> 1);
   if (TRACE_GROWTH) {
@@ -306,10 +1018,11 @@ void Heap::ShrinkRememberedSet() {
 
 NOINLINE
 void Heap::Scavenge(Reason reason) {
-#if TRACE_GC
+  if (policy_.verify_heap()) {
+    Verify("before scavenge");
+  }
   int64_t start = OS::CurrentMonotonicNanos();
   size_t new_before = top_ - to_.object_start();
-#endif
   size_t old_before = old_size_;
 
   if (reason == kRememberedSet) {
@@ -325,73 +1038,176 @@ void Heap::Scavenge(Reason reason) {
   interpreter_->GCPrologue();
 
   // Strong references.
-  ScavengeRoots();
-  uword scan = to_.object_start();
-  while (scan < top_ || end_ < to_.limit()) {
-    scan = ScavengeToSpace(scan);
-    ProcessTenureStack();
-    ScavengeEphemeronList();
+  if (ShouldScavengeInParallel(new_before)) {
+    ParallelScavenger scavenger(this, gc_workers_);
+    scavenger.Scavenge();
+  } else {
+    ScavengeRoots();
+    uword scan = to_.object_start();
+    while (scan < top_ || end_ < to_.limit()) {
+      scan = ScavengeToSpace(scan);
+      ProcessTenureStack();
+      ScavengeEphemeronList();
+    }
   }
 
   // Weak references.
   MournEphemeronList();
   MournWeakListScavenge();
   MournClassTableScavenge();
+  MournIdentityHashesScavenge();
+
+  if (PRETENURE) {
+    // Periodically forget which classes are pretenured, so that classes
+    // whose instances have started to die young are allocated in new-space
+    // again.
+    if ((++scavenge_count_ % kPretenureResetInterval) == 0) {
+      memset(pretenure_, 0, class_table_size_);
+      memset(pretenure_arrays_, 0, sizeof(pretenure_arrays_));
+    }
+    // Sample only when much of new-space survived: that is when pretenuring
+    // has the most to save, and the walk is cheap next to the copying.
+    size_t copied = (top_ - to_.object_start()) + (old_size_ - old_before);
+    if (copied >= (new_before / 4)) {
+      SamplePretenuring(survivor_end_, from_.object_start() + new_before);
+    }
+  }
 
 #if defined(DEBUG)
   from_.MarkUnallocated();
   from_.NoAccess();
+#else
+  if (policy_.verify_heap()) {
+    from_.MarkUnallocated();  // So that a stale reference is caught early.
+  }
 #endif
 
+  if (ShouldStartIncrementalMarking()) {
+    StartIncrementalMarking();
+  }
+
   interpreter_->GCEpilogue();
 
+  if (incremental_marking_ ||
+      (INCREMENTAL_MARK && (sweep_regions_ != nullptr) &&
+       (old_size_ >= old_start_marking_))) {
+    // Mark or sweep a step at the next safepoint.
+    interpreter_->Interrupt(Interpreter::kInterruptIncrementalGC);
+  }
+
   survivor_end_ = top_;
+  SetAllocationLimit();
+  new_space_discarded_ = false;
 
   size_t new_after = top_ - to_.object_start();
   size_t old_after = old_size_;
   size_t tenured = old_after - old_before;
   size_t survived = new_after + tenured;
 
-  if (survived > (to_.size() / 3)) {
-    next_semispace_capacity_ = to_.size() * 2;
-    if (next_semispace_capacity_ > kMaxSemispaceCapacity) {
-      next_semispace_capacity_ = kMaxSemispaceCapacity;
-    }
+  int64_t stop = OS::CurrentMonotonicNanos();
+  SetNextSemispaceCapacity(survived, start, stop);
+
+  if (policy_.trace_gc()) {
+    size_t freed = (new_before + old_before) - (new_after + old_after);
+    int64_t time = stop - start;
+    OS::PrintErr("Scavenge (%s, %" Pd "kB new, "
+                 "%" Pd "kB tenured, %" Pd "kB freed, %" Pd64 " us)\n",
+                 ReasonToCString(reason), new_after / KB, tenured / KB,
+                 freed / KB, time / kNanosecondsPerMicrosecond);
+  }
+  if (policy_.verify_heap()) {
+    Verify("after scavenge");
   }
+}
 
-#if TRACE_GC
-  size_t freed = (new_before + old_before) - (new_after + old_after);
-  int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Scavenge (%s, %" Pd "kB new, "
-               "%" Pd "kB tenured, %" Pd "kB freed, %" Pd64 " us)\n",
-               ReasonToCString(reason), new_after / KB, tenured / KB,
-               freed / KB, time / kNanosecondsPerMicrosecond);
-#endif
+// Shrinking or growing new-space takes effect as the spaces flip. Everything
+// allocated in from-space might survive, so to-space may not shrink below it.
+void Heap::SetNextSemispaceCapacity(size_t survived,
+                                    int64_t start,
+                                    int64_t stop) {
+  // Averaged so that one unusual scavenge does not resize new-space.
+  int64_t pause = stop - start;
+  int64_t interval = start - last_scavenge_end_;
+  scavenge_pause_average_ = (3 * scavenge_pause_average_ + pause) / 4;
+  scavenge_interval_average_ = (3 * scavenge_interval_average_ + interval) / 4;
+  last_scavenge_end_ = stop;
+
+  int64_t total = scavenge_pause_average_ + scavenge_interval_average_;
+  intptr_t percent = total == 0 ? 0 : (100 * scavenge_pause_average_) / total;
+  intptr_t goal = policy_.gc_time_goal_percent();
+
+  size_t capacity = to_.size();
+  if ((policy_.scavenge_pause_goal() != 0) &&
+      (scavenge_pause_average_ > policy_.scavenge_pause_goal())) {
+    // Pauses are proportional to survivors, which fewer allocations between
+    // scavenges leave fewer of.
+    capacity /= 2;
+  } else if ((survived > (capacity / 3)) || (percent > goal)) {
+    capacity *= 2;
+  } else if ((survived < (capacity / 16)) && (percent < (goal / 4))) {
+    // Cheap scavenges: give back the memory. Halving at most doubles their
+    // cost, which stays under the goal.
+    capacity /= 2;
+  }
+  if (capacity < policy_.min_semispace_capacity()) {
+    capacity = policy_.min_semispace_capacity();
+  }
+  if (capacity > policy_.max_semispace_capacity()) {
+    capacity = policy_.max_semispace_capacity();
+  }
+  // Keep new-space a small part of a limited heap.
+  size_t limit = policy_.heap_limit();
+  if ((limit != 0) && (capacity > (limit / 8))) {
+    capacity = Utils::RoundDown(limit / 8, kSemispaceGranularity);
+    if (capacity < policy_.min_semispace_capacity()) {
+      capacity = policy_.min_semispace_capacity();
+    }
+  }
+  next_semispace_capacity_ = capacity;
 }
 
 void Heap::FlipSpaces() {
+  size_t used = top_ - to_.base();
   Semispace temp = to_;
   to_ = from_;
   from_ = temp;
 
-  ASSERT(next_semispace_capacity_ <= kMaxSemispaceCapacity);
-  if (to_.size() < next_semispace_capacity_) {
-    if (TRACE_GROWTH && (from_.size() < next_semispace_capacity_)) {
-      OS::PrintErr("Growing new space to %" Pd "MB\n",
-                   next_semispace_capacity_ / MB);
+  size_t capacity = next_semispace_capacity_;
+  if (capacity < used) {
+    capacity = from_.size();
+  }
+  if (to_.size() != capacity) {
+    if (TRACE_GROWTH && (from_.size() != capacity)) {
+      OS::PrintErr("%s new space to %" Pd "kB\n",
+                   capacity > from_.size() ? "Growing" : "Shrinking",
+                   capacity / KB);
     }
     to_.Free();
-    to_.Allocate(next_semispace_capacity_);
+    to_.Allocate(capacity);
+    AdviseHeapMemory(&to_.memory_);
   }
 
-  ASSERT(to_.size() >= from_.size());
+  ASSERT(to_.size() >= used);
 
   top_ = to_.object_start();
   end_ = to_.limit();
   ASSERT((top_ & kObjectAlignmentMask) == kNewObjectAlignmentOffset);
 }
 
+static void InstallForwardingCorpse(HeapObject forwarder, Object forwardee) {
+  size_t heap_size = forwarder->HeapSize();
+
+  HeapObject::Initialize(forwarder->Addr(), kForwardingCorpseCid, heap_size);
+  ASSERT(forwarder->IsForwardingCorpse());
+  ForwardingCorpse corpse = static_cast<ForwardingCorpse>(forwarder);
+  if (forwarder->heap_size() == 0) {
+    corpse->set_overflow_size(heap_size);
+  }
+  ASSERT(forwarder->HeapSize() == heap_size);
+
+  corpse->set_target(forwardee);
+}
+
 static bool ForwardClass(Heap* heap, HeapObject object) {
   ASSERT(object->IsHeapObject());
   Behavior old_class = heap->ClassAt(object->cid());
@@ -428,7 +1244,11 @@ void Heap::ScavengeRoots() {
     ASSERT(obj->IsOldObject());
     ASSERT(obj->is_remembered());
     obj->set_is_remembered(false);
-    ScavengeOldObject(obj);
+    if (obj->has_card_table()) {
+      ScavengeCards(obj);
+    } else {
+      ScavengeOldObject(obj);
+    }
   }
 
   for (intptr_t i = 0; i < handles_size_; i++) {
@@ -489,6 +1309,10 @@ NOINLINE
 void Heap::ProcessTenureStack() {
   while (!IsTenureStackEmpty()) {
     HeapObject obj = HeapObject::FromAddr(PopTenureStack());
+    if (incremental_marking_) {
+      // An object the marker already scanned may refer to this one.
+      IncrementalMarkObject(obj);
+    }
     ScavengeOldObject(obj);
   }
 }
@@ -588,6 +1412,32 @@ void Heap::ScavengeOldObject(HeapObject obj) {
   }
 }
 
+// Only the dirty cards of a remembered large Array are visited. A card stays
+// dirty if it still refers to new-space after the scavenge.
+void Heap::ScavengeCards(HeapObject obj) {
+  ASSERT(obj->IsArray());
+  uint8_t* cards = Region::FromLargeObject(obj)->cards();
+  intptr_t num_cards = CardCount(obj->HeapSize());
+  bool has_new_target = ScavengeClass(kArrayCid);
+  Object* slots_from;
+  Object* slots_to;
+  obj->Pointers(&slots_from, &slots_to);
+  for (intptr_t i = 0; i < num_cards; i++) {
+    if (cards[i] == 0) {
+      continue;
+    }
+    Object* from = slots_from;
+    Object* to = slots_to;
+    CardPointers(obj, i, &from, &to);
+    bool card_has_new_target = ScavengePointers(from, to);
+    cards[i] = card_has_new_target ? 1 : 0;
+    has_new_target |= card_has_new_target;
+  }
+  if (has_new_target) {
+    AddToRememberedSet(obj);
+  }
+}
+
 bool Heap::ScavengeClass(intptr_t cid) {
   ASSERT(cid < class_table_size_);
   // This is very similar to ScavengePointer.
@@ -623,31 +1473,1207 @@ bool Heap::ScavengeClass(intptr_t cid) {
   return true;
 }
 
-NOINLINE
-void Heap::MarkSweep(Reason reason) {
-#if TRACE_GC
-  int64_t start = OS::CurrentMonotonicNanos();
-  size_t size_before = old_size_;
-#endif
-
-#if defined(DEBUG)
-  from_.ReadWrite();
-#endif
-
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Init(from_.limit());
+static bool IsScavengeSurvivor(Object obj) {
+  return obj->IsImmediateOrOldObject() ||
+         IsForwarded(HeapObject::Cast(obj));
+}
 
-  // Remembered set will be re-built during marking.
-  remembered_set_size_ = 0;
-  old_size_ = 0;
+bool Heap::ShouldScavengeInParallel(size_t new_size) const {
+  // Waking the workers costs more than it saves until new-space has grown.
+  return PARALLEL_SCAVENGE && (gc_workers_ > 1) &&
+         (new_size >= kParallelScavengeSize);
+}
 
-  interpreter_->GCPrologue();
+bool Heap::ShouldPretenure(size_t allocated, size_t survived) {
+  return (survived >= kPretenureMinSurvivorSize) &&
+         (survived >= allocated - (allocated / 10));
+}
 
-  // Strong references.
-  MarkRoots();
-  while (!mark_stack->IsEmpty()) {
-    ProcessMarkStack();
-    MarkEphemeronList();
+// Walks the objects allocated since the previous scavenge, which lie between
+// start and end in from-space. A class, or a size of Array, whose recent
+// instances nearly all survived their first scavenge will have them tenured
+// soon anyway, so its instances are allocated directly in old-space instead of
+// being copied.
+void Heap::SamplePretenuring(uword start, uword end) {
+  memset(allocated_, 0, class_table_size_ * sizeof(size_t));
+  memset(survived_, 0, class_table_size_ * sizeof(size_t));
+  memset(arrays_allocated_, 0, sizeof(arrays_allocated_));
+  memset(arrays_survived_, 0, sizeof(arrays_survived_));
+  uword scan = start;
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    bool forwarded = IsForwarded(obj);
+    if (forwarded) {
+      obj = ForwardingTarget(obj);
+    }
+    intptr_t cid = obj->cid();
+    size_t size = obj->HeapSize();
+    if (cid >= kFirstRegularObjectCid) {
+      allocated_[cid] += size;
+      if (forwarded) {
+        survived_[cid] += size;
+      }
+    } else if (cid == kArrayCid) {
+      intptr_t size_class = ArraySizeClass(size);
+      arrays_allocated_[size_class] += size;
+      if (forwarded) {
+        arrays_survived_[size_class] += size;
+      }
+    }
+    scan += size;
+  }
+  ASSERT(scan == end);
+
+  for (intptr_t cid = kFirstRegularObjectCid; cid < class_table_size_; cid++) {
+    if (ShouldPretenure(allocated_[cid], survived_[cid])) {
+      pretenure_[cid] = 1;
+      if (policy_.trace_gc()) {
+        OS::PrintErr("Pretenuring cid %" Pd " (%" Pd "kB of %" Pd "kB "
+                     "survived)\n", cid, survived_[cid] / KB,
+                     allocated_[cid] / KB);
+      }
+    }
+  }
+  for (intptr_t size_class = 0;
+       size_class < kArraySizeClasses;
+       size_class++) {
+    if (ShouldPretenure(arrays_allocated_[size_class],
+                        arrays_survived_[size_class])) {
+      pretenure_arrays_[size_class] = 1;
+      if (policy_.trace_gc()) {
+        OS::PrintErr("Pretenuring arrays of size class %" Pd " (%" Pd "kB of "
+                     "%" Pd "kB survived)\n", size_class,
+                     arrays_survived_[size_class] / KB,
+                     arrays_allocated_[size_class] / KB);
+      }
+    }
+  }
+}
+
+static std::atomic<uword>* HeaderWord(HeapObject obj) {
+  COMPILE_ASSERT(sizeof(std::atomic<uword>) == sizeof(uword));
+  return reinterpret_cast<std::atomic<uword>*>(obj->Addr());
+}
+
+class ScavengerTask : public ThreadPool::Task {
+ public:
+  ScavengerTask(ParallelScavenger* scavenger, ScavengerWorker* worker)
+      : scavenger_(scavenger), worker_(worker) {}
+
+  void Run() override {
+    worker_->Run();
+    scavenger_->TaskDone();
+  }
+
+ private:
+  ParallelScavenger* const scavenger_;
+  ScavengerWorker* const worker_;
+};
+
+ParallelScavenger::ParallelScavenger(Heap* heap, intptr_t num_workers)
+    : heap_(heap),
+      num_workers_(num_workers),
+      workers_(),
+      top_(heap->top_),
+      limit_(heap->end_),
+      remembered_set_cursor_(0),
+      remembered_set_size_(heap->remembered_set_size_),
+      old_space_mutex_(),
+      monitor_(),
+      ranges_(nullptr),
+      ranges_size_(0),
+      ranges_capacity_(64),
+      num_idle_(0),
+      num_running_tasks_(0),
+      done_(false),
+      idle_workers_(0) {
+  ASSERT(num_workers > 1);
+  ASSERT(num_workers <= Heap::kMaxGCWorkers);
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i] = new ScavengerWorker(heap, this);
+  }
+  ranges_ = new Range[ranges_capacity_];
+  // The remembered set is re-built after the workers have consumed it.
+  heap->remembered_set_size_ = 0;
+}
+
+ParallelScavenger::~ParallelScavenger() {
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    delete workers_[i];
+  }
+  delete[] ranges_;
+}
+
+void ParallelScavenger::Scavenge() {
+  bool roots = true;
+  do {
+    RunPhase(roots);
+    roots = false;
+    for (intptr_t i = 0; i < num_workers_; i++) {
+      workers_[i]->MergeLists();
+    }
+    // Resolving ephemerons may copy more objects, to be scanned in another
+    // phase.
+    workers_[0]->ScavengeEphemeronList();
+  } while (workers_[0]->HasWork() || (ranges_size_ != 0));
+
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i]->MergeLists();
+    workers_[i]->Finish();
+  }
+  ASSERT(ranges_size_ == 0);
+  heap_->top_ = top_.load(std::memory_order_relaxed);
+}
+
+void ParallelScavenger::RunPhase(bool roots) {
+  {
+    MonitorLocker ml(&monitor_);
+    num_idle_ = 0;
+    idle_workers_.store(0, std::memory_order_relaxed);
+    done_ = false;
+    num_running_tasks_ = num_workers_ - 1;
+  }
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    if (!Isolate::thread_pool()->Run(new ScavengerTask(this, workers_[i]))) {
+      FATAL("Failed to start scavenger task");
+    }
+  }
+
+  if (roots) {
+    workers_[0]->ScavengeRoots();
+  }
+  workers_[0]->Run();
+
+  MonitorLocker ml(&monitor_);
+  while (num_running_tasks_ > 0) {
+    ml.Wait();
+  }
+}
+
+void ParallelScavenger::TaskDone() {
+  MonitorLocker ml(&monitor_);
+  num_running_tasks_--;
+  ml.NotifyAll();
+}
+
+bool ParallelScavenger::ClaimRememberedSet(intptr_t* start, intptr_t* end) {
+  intptr_t cursor = remembered_set_cursor_.fetch_add(
+      kRememberedSetChunk, std::memory_order_relaxed);
+  if (cursor >= remembered_set_size_) {
+    return false;
+  }
+  *start = cursor;
+  *end = cursor + kRememberedSetChunk;
+  if (*end > remembered_set_size_) {
+    *end = remembered_set_size_;
+  }
+  return true;
+}
+
+uword ParallelScavenger::TryAllocateToSpace(size_t min_size,
+                                            size_t max_size,
+                                            uword* end) {
+  uword top = top_.load(std::memory_order_relaxed);
+  for (;;) {
+    size_t remaining = limit_ - top;
+    if (remaining < min_size) {
+      return 0;
+    }
+    size_t size = remaining < max_size ? remaining : max_size;
+    if (top_.compare_exchange_weak(top, top + size,
+                                   std::memory_order_relaxed)) {
+      *end = top + size;
+      return top;
+    }
+  }
+}
+
+void ParallelScavenger::PushWork(uword start, uword end) {
+  ASSERT(start < end);
+  MonitorLocker ml(&monitor_);
+  if (ranges_size_ == ranges_capacity_) {
+    ranges_capacity_ += (ranges_capacity_ >> 1);
+    Range* old_ranges = ranges_;
+    ranges_ = new Range[ranges_capacity_];
+    for (intptr_t i = 0; i < ranges_size_; i++) {
+      ranges_[i] = old_ranges[i];
+    }
+    delete[] old_ranges;
+  }
+  ranges_[ranges_size_].start = start;
+  ranges_[ranges_size_].end = end;
+  ranges_size_++;
+  if (num_idle_ > 0) {
+    ml.Notify();
+  }
+}
+
+bool ParallelScavenger::PopWork(uword* start, uword* end) {
+  MonitorLocker ml(&monitor_);
+  if (ranges_size_ == 0) {
+    num_idle_++;
+    idle_workers_.store(num_idle_, std::memory_order_relaxed);
+    while ((ranges_size_ == 0) && !done_) {
+      if (num_idle_ == num_workers_) {
+        done_ = true;
+        ml.NotifyAll();
+        break;
+      }
+      ml.Wait();
+    }
+    if (done_) {
+      return false;
+    }
+    num_idle_--;
+    idle_workers_.store(num_idle_, std::memory_order_relaxed);
+  }
+  ranges_size_--;
+  *start = ranges_[ranges_size_].start;
+  *end = ranges_[ranges_size_].end;
+  return true;
+}
+
+ScavengerWorker::ScavengerWorker(Heap* heap, ParallelScavenger* scavenger)
+    : heap_(heap),
+      scavenger_(scavenger),
+      new_(),
+      old_(),
+      remembered_set_(nullptr),
+      remembered_set_size_(0),
+      remembered_set_capacity_(64),
+      ephemeron_list_(nullptr),
+      weak_list_(nullptr),
+      tenured_marked_(),
+      marked_size_(0) {
+  remembered_set_ = new HeapObject[remembered_set_capacity_];
+}
+
+ScavengerWorker::~ScavengerWorker() {
+  ASSERT(!HasWork());
+  ASSERT(remembered_set_size_ == 0);
+  delete[] remembered_set_;
+}
+
+void ScavengerWorker::ScavengeRoots() {
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    ScavengePointers(heap_->handles_[i], heap_->handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  heap_->interpreter_->RootPointers(&from, &to);
+  ScavengePointers(from, to);
+  heap_->interpreter_->StackPointers(&from, &to);
+  ScavengePointers(from, to);
+}
+
+void ScavengerWorker::Run() {
+  for (;;) {
+    intptr_t start, end;
+    while (scavenger_->ClaimRememberedSet(&start, &end)) {
+      for (intptr_t i = start; i < end; i++) {
+        HeapObject obj = heap_->remembered_set_[i];
+        ASSERT(obj->IsOldObject());
+        ASSERT(obj->is_remembered());
+        obj->set_is_remembered(false);
+        if (obj->has_card_table()) {
+          ScavengeCards(obj);
+        } else {
+          ScavengeOldObject(obj);
+        }
+      }
+      Drain();
+    }
+    Drain();
+
+    uword scan;
+    uword limit;
+    if (!scavenger_->PopWork(&scan, &limit)) {
+      return;
+    }
+    ScanRange(scan, limit);
+  }
+}
+
+void ScavengerWorker::Drain() {
+  for (;;) {
+    if (new_.scan < new_.top) {
+      HeapObject obj = HeapObject::FromAddr(new_.scan);
+      new_.scan += obj->HeapSize();
+      ScavengeNewObject(obj);
+    } else if (old_.scan < old_.top) {
+      HeapObject obj = HeapObject::FromAddr(old_.scan);
+      old_.scan += obj->HeapSize();
+      ScavengeOldObject(obj);
+    } else {
+      return;
+    }
+    if (scavenger_->HasIdleWorkers()) [[unlikely]] {
+      ShareWork();
+    }
+  }
+}
+
+void ScavengerWorker::ShareWork() {
+  if ((new_.top - new_.scan) >= kMinShareSize) {
+    scavenger_->PushWork(new_.scan, new_.top);
+    new_.scan = new_.top;
+  }
+  if ((old_.top - old_.scan) >= kMinShareSize) {
+    scavenger_->PushWork(old_.scan, old_.top);
+    old_.scan = old_.top;
+  }
+}
+
+void ScavengerWorker::ScanRange(uword start, uword end) {
+  uword scan = start;
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    scan += obj->HeapSize();
+    if (obj->IsNewObject()) {
+      ScavengeNewObject(obj);
+    } else {
+      ScavengeOldObject(obj);
+    }
+    Drain();
+  }
+}
+
+bool ScavengerWorker::ScavengePointers(Object* from, Object* to) {
+  bool has_new_target = false;
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    HeapObject from_target = HeapObject::Cast(*ptr);
+    if (from_target->IsImmediateOrOldObject()) continue;
+
+    HeapObject to_target = Forward(from_target);
+    *ptr = to_target;
+    has_new_target |= to_target->IsNewObject();
+  }
+  return has_new_target;
+}
+
+void ScavengerWorker::ScavengeNewObject(HeapObject obj) {
+  DEBUG_ASSERT(heap_->InToSpace(obj));
+  intptr_t cid = obj->cid();
+  if (cid == kWeakArrayCid) [[unlikely]] {
+    AddToWeakList(WeakArray::Cast(obj));
+  } else if (cid == kEphemeronCid) [[unlikely]] {
+    AddToEphemeronList(Ephemeron::Cast(obj));
+  } else {
+    ScavengeClass(cid);
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    ScavengePointers(from, to);
+  }
+}
+
+void ScavengerWorker::ScavengeOldObject(HeapObject obj) {
+  intptr_t cid = obj->cid();
+  if (cid == kWeakArrayCid) [[unlikely]] {
+    AddToWeakList(WeakArray::Cast(obj));
+  } else if (cid == kEphemeronCid) [[unlikely]] {
+    AddToEphemeronList(Ephemeron::Cast(obj));
+  } else {
+    bool has_new_target = ScavengeClass(cid);
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    has_new_target |= ScavengePointers(from, to);
+    if (has_new_target) {
+      AddToRememberedSet(obj);
+    }
+  }
+}
+
+void ScavengerWorker::ScavengeCards(HeapObject obj) {
+  ASSERT(obj->IsArray());
+  uint8_t* cards = Region::FromLargeObject(obj)->cards();
+  intptr_t num_cards = CardCount(obj->HeapSize());
+  bool has_new_target = ScavengeClass(kArrayCid);
+  Object* slots_from;
+  Object* slots_to;
+  obj->Pointers(&slots_from, &slots_to);
+  for (intptr_t i = 0; i < num_cards; i++) {
+    if (cards[i] == 0) {
+      continue;
+    }
+    Object* from = slots_from;
+    Object* to = slots_to;
+    CardPointers(obj, i, &from, &to);
+    bool card_has_new_target = ScavengePointers(from, to);
+    cards[i] = card_has_new_target ? 1 : 0;
+    has_new_target |= card_has_new_target;
+  }
+  if (has_new_target) {
+    AddToRememberedSet(obj);
+  }
+}
+
+bool ScavengerWorker::ScavengeClass(intptr_t cid) {
+  ASSERT(cid < heap_->class_table_size_);
+  HeapObject old_target = HeapObject::Cast(heap_->class_table_[cid]);
+  if (old_target->IsImmediateOrOldObject()) {
+    return false;
+  }
+  // The class table itself is updated by MournClassTableScavenge.
+  return Forward(old_target)->IsNewObject();
+}
+
+HeapObject ScavengerWorker::Forward(HeapObject from_target) {
+  DEBUG_ASSERT(heap_->InFromSpace(from_target));
+
+  std::atomic<uword>* header_word = HeaderWord(from_target);
+  uword header = header_word->load(std::memory_order_acquire);
+  if ((header & (1 << kMarkBit)) != 0) {
+    // Already copied by some worker.
+    return static_cast<HeapObject>(header);
+  }
+
+  size_t size = from_target->HeapSize(header);
+  bool tenured = from_target->Addr() < heap_->survivor_end_;
+  bool direct = false;
+  uword to_target_addr = 0;
+  if (!tenured) {
+    to_target_addr = TryAllocateNew(size, &direct);
+  }
+  if (to_target_addr == 0) {
+    // To-space may be exhausted by gaps at the ends of the workers' buffers.
+    tenured = true;
+    to_target_addr = AllocateOld(size, &direct);
+  }
+
+  // During incremental marking, tenured objects are marked and left for the
+  // marker to scan, since an object it already scanned may refer to them.
+  bool mark = tenured && heap_->incremental_marking_;
+
+  // The header is taken from our read, since another worker may be installing
+  // a forwarding pointer over it while we copy.
+  uword* dst = reinterpret_cast<uword*>(to_target_addr);
+  const uword* src = reinterpret_cast<const uword*>(from_target->Addr());
+  dst[0] = mark ? (header | (1 << kMarkBit)) : header;
+  dst[1] = src[1];
+  if (size > kObjectAlignment) {
+    objcpy(&dst[2], &src[2], size - kObjectAlignment);
+  }
+  HeapObject to_target = HeapObject::FromAddr(to_target_addr);
+
+  if (!header_word->compare_exchange_strong(header,
+                                            static_cast<uword>(to_target),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+    // Lost the race to another worker; use its copy.
+    UndoAllocation(to_target_addr, size, tenured, direct);
+    ASSERT((header & (1 << kMarkBit)) != 0);
+    return static_cast<HeapObject>(header);
+  }
+
+  if (direct) {
+    // Not part of a buffer this worker will scan.
+    scavenger_->PushWork(to_target_addr, to_target_addr + size);
+  }
+  if (mark) {
+    tenured_marked_.Push(to_target);
+    marked_size_ += size;
+  }
+  return to_target;
+}
+
+uword ScavengerWorker::TryAllocateNew(size_t size, bool* direct) {
+  if (size <= (new_.end - new_.top)) [[likely]] {
+    uword result = new_.top;
+    new_.top += size;
+    *direct = false;
+    return result;
+  }
+
+  uword end;
+  if (size > kDirectAllocationSize) {
+    *direct = true;
+    return scavenger_->TryAllocateToSpace(size, size, &end);
+  }
+
+  RetireNew();
+  uword start = scavenger_->TryAllocateToSpace(size, kBufferSize, &end);
+  if (start == 0) {
+    return 0;
+  }
+  new_.scan = start;
+  new_.top = start + size;
+  new_.end = end;
+  *direct = false;
+  return start;
+}
+
+uword ScavengerWorker::AllocateOld(size_t size, bool* direct) {
+  if (size <= (old_.end - old_.top)) [[likely]] {
+    uword result = old_.top;
+    old_.top += size;
+    *direct = false;
+    return result;
+  }
+
+  if (size > kDirectAllocationSize) {
+    *direct = true;
+    MutexLocker ml(scavenger_->old_space_mutex());
+    return heap_->AllocateOldSwept(size, Heap::kForceGrowth);
+  }
+
+  RetireOld();
+  uword start;
+  uword end;
+  {
+    MutexLocker ml(scavenger_->old_space_mutex());
+    start = heap_->freelist_.TryAllocate(kBufferSize);
+    if (start != 0) {
+      end = start + kBufferSize;
+    } else {
+      Region* region = heap_->AllocateRegion(Heap::kRegionSize,
+                                             Heap::kForceGrowth);
+      start = region->object_start();
+      end = region->limit();
+      region->set_object_end(end);
+    }
+    heap_->old_size_ += end - start;
+  }
+  old_.scan = start;
+  old_.top = start + size;
+  old_.end = end;
+  *direct = false;
+  return start;
+}
+
+void ScavengerWorker::UndoAllocation(uword addr,
+                                     size_t size,
+                                     bool tenured,
+                                     bool direct) {
+  if (!direct) {
+    Buffer* buffer = tenured ? &old_ : &new_;
+    ASSERT(buffer->top == addr + size);
+    buffer->top = addr;
+  } else if (!tenured) {
+    FillGap(addr, size);
+  } else {
+    MutexLocker ml(scavenger_->old_space_mutex());
+    heap_->freelist_.EnqueueRange(addr, size);
+    heap_->old_size_ -= size;
+  }
+}
+
+void ScavengerWorker::RetireNew() {
+  if (new_.scan < new_.top) {
+    scavenger_->PushWork(new_.scan, new_.top);
+  }
+  if (new_.top < new_.end) {
+    FillGap(new_.top, new_.end - new_.top);
+  }
+  new_.scan = new_.top = new_.end = 0;
+}
+
+void ScavengerWorker::RetireOld() {
+  if (old_.scan < old_.top) {
+    scavenger_->PushWork(old_.scan, old_.top);
+  }
+  if (old_.top < old_.end) {
+    size_t remaining = old_.end - old_.top;
+    MutexLocker ml(scavenger_->old_space_mutex());
+    heap_->freelist_.EnqueueRange(old_.top, remaining);
+    heap_->old_size_ -= remaining;
+  }
+  old_.scan = old_.top = old_.end = 0;
+}
+
+void ScavengerWorker::AddToRememberedSet(HeapObject obj) {
+  if (remembered_set_size_ == remembered_set_capacity_) {
+    remembered_set_capacity_ += (remembered_set_capacity_ >> 1);
+    HeapObject* old_remembered_set = remembered_set_;
+    remembered_set_ = new HeapObject[remembered_set_capacity_];
+    for (intptr_t i = 0; i < remembered_set_size_; i++) {
+      remembered_set_[i] = old_remembered_set[i];
+    }
+    delete[] old_remembered_set;
+  }
+  remembered_set_[remembered_set_size_++] = obj;
+}
+
+void ScavengerWorker::ScavengeEphemeronList() {
+  // Like Heap::ScavengeEphemeronList, but copying with this worker. Only run
+  // between phases, when this is the only worker.
+  Ephemeron survivor = heap_->ephemeron_list_;
+  heap_->ephemeron_list_ = nullptr;
+
+  while (survivor != nullptr) {
+    ASSERT(survivor->IsEphemeron());
+    Ephemeron next = survivor->next();
+    survivor->set_next(nullptr);
+
+    if (IsScavengeSurvivor(survivor->key())) {
+      Object* from = survivor->key_ptr();
+      Object* to = survivor->finalizer_ptr();
+      bool has_new_target = ScavengePointers(from, to);
+      if (has_new_target && survivor->IsOldObject()) {
+        AddToRememberedSet(survivor);
+      }
+    } else {
+      // Fate of key is not yet known, return the ephemeron to list.
+      heap_->AddToEphemeronList(survivor);
+    }
+
+    survivor = next;
+  }
+}
+
+void ScavengerWorker::MergeLists() {
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    heap_->AddToRememberedSet(remembered_set_[i]);
+  }
+  remembered_set_size_ = 0;
+
+  while (!tenured_marked_.IsEmpty()) {
+    heap_->mark_stack_.Push(tenured_marked_.Pop());
+  }
+  heap_->marked_size_ += marked_size_;
+  marked_size_ = 0;
+
+  while (ephemeron_list_ != nullptr) {
+    Ephemeron next = ephemeron_list_->next();
+    heap_->AddToEphemeronList(ephemeron_list_);
+    ephemeron_list_ = next;
+  }
+  while (weak_list_ != nullptr) {
+    WeakArray next = weak_list_->next();
+    heap_->AddToWeakList(weak_list_);
+    weak_list_ = next;
+  }
+}
+
+void ScavengerWorker::Finish() {
+  ASSERT(!HasWork());
+  RetireNew();
+  RetireOld();
+}
+
+static bool IsMarkSweepSurvivor(Object obj) {
+  return obj->IsImmediateObject() || HeapObject::Cast(obj)->is_marked();
+}
+
+bool Heap::ShouldMarkInParallel(size_t old_size) const {
+  return PARALLEL_MARK && (gc_workers_ > 1) &&
+         (old_size >= kMinParallelMarkSize);
+}
+
+class MarkerTask : public ThreadPool::Task {
+ public:
+  MarkerTask(Marker* marker, MarkerWorker* worker)
+      : marker_(marker), worker_(worker) {}
+
+  void Run() override {
+    worker_->Run();
+    marker_->TaskDone();
+  }
+
+ private:
+  Marker* const marker_;
+  MarkerWorker* const worker_;
+};
+
+Marker::Marker(Heap* heap,
+               intptr_t num_workers,
+               uword blocks_start,
+               uword blocks_end,
+               bool finishing)
+    : heap_(heap),
+      num_workers_(num_workers),
+      finishing_(finishing),
+      workers_(),
+      overflowed_(false),
+      monitor_(),
+      empty_blocks_(nullptr),
+      full_blocks_(nullptr),
+      num_idle_(0),
+      num_running_tasks_(0),
+      done_(false),
+      idle_workers_(0) {
+  ASSERT(num_workers >= 1);
+  ASSERT(num_workers <= Heap::kMaxGCWorkers);
+  uword addr = Utils::RoundUp(blocks_start, alignof(MarkBlock));
+  while (addr + sizeof(MarkBlock) <= blocks_end) {
+    MarkBlock* block = reinterpret_cast<MarkBlock*>(addr);
+    block->size = 0;
+    block->next = empty_blocks_;
+    empty_blocks_ = block;
+    addr += sizeof(MarkBlock);
+  }
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    workers_[i] = new MarkerWorker(heap, this);
+  }
+}
+
+Marker::~Marker() {
+  for (intptr_t i = 0; i < num_workers_; i++) {
+    delete workers_[i];
+  }
+}
+
+void Marker::Mark() {
+  bool roots = true;
+  do {
+    RunPhase(roots);
+    roots = false;
+    for (intptr_t i = 0; i < num_workers_; i++) {
+      workers_[i]->MergeLists();
+    }
+    // Ephemerons are resolved on one thread, between phases, so every key
+    // that will be marked in this phase has been.
+    workers_[0]->MarkEphemeronList();
+    if (overflowed_.load(std::memory_order_relaxed)) {
+      overflowed_.store(false, std::memory_order_relaxed);
+      if (heap_->policy().trace_gc()) {
+        OS::PrintErr("Mark-sweep rescanning after work list overflow\n");
+      }
+      workers_[0]->Rescan();
+    }
+  } while (workers_[0]->HasWork() || (full_blocks_ != nullptr) ||
+           overflowed_.load(std::memory_order_relaxed));
+
+  workers_[0]->MergeLists();
+}
+
+void Marker::RunPhase(bool roots) {
+  {
+    MonitorLocker ml(&monitor_);
+    num_idle_ = 0;
+    idle_workers_.store(0, std::memory_order_relaxed);
+    done_ = false;
+    num_running_tasks_ = num_workers_ - 1;
+  }
+  for (intptr_t i = 1; i < num_workers_; i++) {
+    if (!Isolate::thread_pool()->Run(new MarkerTask(this, workers_[i]))) {
+      FATAL("Failed to start marker task");
+    }
+  }
+
+  if (roots) {
+    workers_[0]->MarkRoots();
+  }
+  workers_[0]->Run();
+
+  MonitorLocker ml(&monitor_);
+  while (num_running_tasks_ > 0) {
+    ml.Wait();
+  }
+}
+
+void Marker::TaskDone() {
+  MonitorLocker ml(&monitor_);
+  num_running_tasks_--;
+  ml.NotifyAll();
+}
+
+MarkBlock* Marker::AllocateBlock() {
+  MonitorLocker ml(&monitor_);
+  MarkBlock* block = empty_blocks_;
+  if (block != nullptr) {
+    empty_blocks_ = block->next;
+    ASSERT(block->IsEmpty());
+  }
+  return block;
+}
+
+void Marker::FreeBlock(MarkBlock* block) {
+  ASSERT(block->IsEmpty());
+  MonitorLocker ml(&monitor_);
+  block->next = empty_blocks_;
+  empty_blocks_ = block;
+}
+
+void Marker::PushFullBlock(MarkBlock* block) {
+  ASSERT(!block->IsEmpty());
+  MonitorLocker ml(&monitor_);
+  block->next = full_blocks_;
+  full_blocks_ = block;
+  if (num_idle_ > 0) {
+    ml.Notify();
+  }
+}
+
+MarkBlock* Marker::PopFullBlock() {
+  MonitorLocker ml(&monitor_);
+  if (full_blocks_ == nullptr) {
+    num_idle_++;
+    idle_workers_.store(num_idle_, std::memory_order_relaxed);
+    while ((full_blocks_ == nullptr) && !done_) {
+      if (num_idle_ == num_workers_) {
+        done_ = true;
+        ml.NotifyAll();
+        break;
+      }
+      ml.Wait();
+    }
+    if (done_) {
+      return nullptr;
+    }
+    num_idle_--;
+    idle_workers_.store(num_idle_, std::memory_order_relaxed);
+  }
+  MarkBlock* block = full_blocks_;
+  full_blocks_ = block->next;
+  return block;
+}
+
+MarkerWorker::MarkerWorker(Heap* heap, Marker* marker)
+    : heap_(heap),
+      marker_(marker),
+      block_(nullptr),
+      remembered_set_(nullptr),
+      remembered_set_size_(0),
+      remembered_set_capacity_(64),
+      ephemeron_list_(nullptr),
+      weak_list_(nullptr),
+      marked_size_(0) {
+  remembered_set_ = new HeapObject[remembered_set_capacity_];
+}
+
+MarkerWorker::~MarkerWorker() {
+  ASSERT(!HasWork());
+  ASSERT(remembered_set_size_ == 0);
+  delete[] remembered_set_;
+}
+
+void MarkerWorker::MarkRoots() {
+  for (intptr_t i = 0; i < heap_->handles_size_; i++) {
+    MarkObject(*heap_->handles_[i]);
+  }
+
+  Object* from;
+  Object* to;
+  heap_->interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    MarkObject(*ptr);
+  }
+  heap_->interpreter_->StackPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    MarkObject(*ptr);
+  }
+
+  if (marker_->finishing()) {
+    // Objects the incremental marker scanned are not visited again, so their
+    // new-space targets and classes are found through the remembered set.
+    for (intptr_t i = 0; i < heap_->remembered_set_size_; i++) {
+      HeapObject obj = heap_->remembered_set_[i];
+      intptr_t cid = obj->cid();
+      if (!obj->is_marked() || (cid == kWeakArrayCid) ||
+          (cid == kEphemeronCid)) {
+        continue;
+      }
+      MarkObject(heap_->ClassAt(cid));
+      obj->Pointers(&from, &to);
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        MarkObject(*ptr);
+      }
+    }
+  }
+}
+
+static constexpr uword kMarked = static_cast<uword>(1) << kMarkBit;
+static constexpr uword kRemembered = static_cast<uword>(1) << kRememberedBit;
+
+bool MarkerWorker::IsMarked(HeapObject obj) const {
+  if (!marker_->parallel()) {
+    return obj->is_marked();
+  }
+  return (HeaderWord(obj)->load(std::memory_order_relaxed) & kMarked) != 0;
+}
+
+bool MarkerWorker::TryMark(HeapObject obj) {
+  if (!marker_->parallel()) {
+    obj->set_is_marked(true);
+    if (!marker_->finishing()) {
+      obj->set_is_remembered(false);
+    }
+    if (obj->IsOldObject()) {
+      marked_size_ += obj->HeapSize();
+    }
+    return true;
+  }
+  std::atomic<uword>* header_word = HeaderWord(obj);
+  uword header = header_word->load(std::memory_order_relaxed);
+  uword new_header;
+  do {
+    if ((header & kMarked) != 0) {
+      return false;  // Another worker got here first.
+    }
+    new_header = header | kMarked;
+    if (!marker_->finishing()) {
+      new_header &= ~kRemembered;
+    }
+  } while (!header_word->compare_exchange_weak(header, new_header,
+                                               std::memory_order_relaxed));
+  if (obj->IsOldObject()) {
+    marked_size_ += obj->HeapSize(header);
+  }
+  return true;
+}
+
+void MarkerWorker::MarkObject(Object obj) {
+  if (obj->IsImmediateObject()) return;
+
+  HeapObject heap_obj = HeapObject::Cast(obj);
+  if (IsMarked(heap_obj)) return;
+
+  if ((block_ == nullptr) || block_->IsFull()) [[unlikely]] {
+    MarkBlock* block = marker_->AllocateBlock();
+    if (block == nullptr) {
+      // Leave the object unmarked for the rescan to find.
+      marker_->SetOverflowed();
+      return;
+    }
+    if (block_ != nullptr) {
+      marker_->PushFullBlock(block_);
+    }
+    block_ = block;
+  }
+
+  if (TryMark(heap_obj)) {
+    block_->Push(heap_obj);
+  }
+}
+
+void MarkerWorker::Run() {
+  for (;;) {
+    Drain();
+    MarkBlock* block = marker_->PopFullBlock();
+    if (block == nullptr) {
+      return;
+    }
+    if (block_ != nullptr) {
+      marker_->FreeBlock(block_);
+    }
+    block_ = block;
+  }
+}
+
+void MarkerWorker::Drain() {
+  while (HasWork()) {
+    ProcessObject(block_->Pop());
+    if (marker_->HasIdleWorkers()) [[unlikely]] {
+      ShareWork();
+    }
+  }
+}
+
+void MarkerWorker::ShareWork() {
+  if (block_->size < kMinShareSize) {
+    return;
+  }
+  MarkBlock* shared = marker_->AllocateBlock();
+  if (shared == nullptr) {
+    return;
+  }
+  intptr_t half = block_->size / 2;
+  for (intptr_t i = 0; i < half; i++) {
+    shared->Push(block_->Pop());
+  }
+  marker_->PushFullBlock(shared);
+}
+
+void MarkerWorker::ProcessObject(HeapObject obj) {
+  // Read the header once: other workers may still be trying to mark obj.
+  uword header = HeaderWord(obj)->load(std::memory_order_relaxed);
+  ASSERT((header & kMarked) != 0);
+  ASSERT(marker_->finishing() || ((header & kRemembered) == 0));
+
+  intptr_t cid = (header >> kClassIdFieldOffset) &
+      ((static_cast<uword>(1) << kClassIdFieldSize) - 1);
+  ASSERT(cid != kIllegalCid);
+  ASSERT(cid != kForwardingCorpseCid);
+  ASSERT(cid != kFreeListElementCid);
+
+  if (cid == kWeakArrayCid) [[unlikely]] {
+    AddToWeakList(WeakArray::Cast(obj));
+  } else if (cid == kEphemeronCid) [[unlikely]] {
+    AddToEphemeronList(Ephemeron::Cast(obj));
+  } else {
+    Behavior cls = heap_->ClassAt(cid);
+    MarkObject(cls);
+    bool has_new_target = cls->IsNewObject();
+    Object* from;
+    Object* to;
+    obj->Pointers(header, &from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      Object target = *ptr;
+      has_new_target |= target->IsNewObject();
+      MarkObject(target);
+    }
+    if (has_new_target && obj->IsOldObject() &&
+        ((header & kRemembered) == 0)) {
+      AddToRememberedSet(obj);
+    }
+  }
+}
+
+void MarkerWorker::MarkEphemeronList() {
+  // Only run between phases, when this is the only worker.
+  Ephemeron survivor = heap_->ephemeron_list_;
+  heap_->ephemeron_list_ = nullptr;
+
+  while (survivor != nullptr) {
+    ASSERT(survivor->IsEphemeron());
+    Ephemeron next = survivor->next();
+    survivor->set_next(nullptr);
+
+    if (IsMarkSweepSurvivor(survivor->key())) {
+      bool has_new_target = false;
+      Object* from = survivor->key_ptr();
+      Object* to = survivor->finalizer_ptr();
+      for (Object* ptr = from; ptr <= to; ptr++) {
+        Object target = *ptr;
+        has_new_target |= target->IsNewObject();
+        MarkObject(target);
+      }
+      if (has_new_target && survivor->IsOldObject() &&
+          !survivor->is_remembered()) {
+        AddToRememberedSet(survivor);
+      }
+    } else {
+      // Fate of the key is not yet known; add the ephemeron back to the list.
+      heap_->AddToEphemeronList(survivor);
+    }
+
+    survivor = next;
+  }
+}
+
+void MarkerWorker::Rescan() {
+  // Every marked object has been processed, so any reachable object left
+  // unmarked by an overflow is referenced from a root or a marked object.
+  // Only run between phases, when this is the only worker.
+  MarkRoots();
+  RescanRange(heap_->to_.object_start(), heap_->top_);
+  heap_->VisitOldRegions([&](uword start, uword end) {
+    RescanRange(start, end);
+  });
+}
+
+void MarkerWorker::RescanRange(uword start, uword end) {
+  uword scan = start;
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    if (obj->is_marked()) {
+      RescanObject(obj);
+    }
+    scan += obj->HeapSize();
+  }
+}
+
+void MarkerWorker::RescanObject(HeapObject obj) {
+  // Like ProcessObject, but without the side effects that already happened
+  // when the object was first processed.
+  intptr_t cid = obj->cid();
+  if (cid < kFirstLegalCid) {
+    // A forwarding corpse of a class can be left marked by become.
+    return;
+  }
+  if (cid == kWeakArrayCid) {
+    return;
+  }
+  if (cid == kEphemeronCid) {
+    // Ephemerons with unmarked keys are still on the ephemeron list.
+    Ephemeron ephemeron = Ephemeron::Cast(obj);
+    if (IsMarkSweepSurvivor(ephemeron->key())) {
+      for (Object* ptr = ephemeron->key_ptr();
+           ptr <= ephemeron->finalizer_ptr();
+           ptr++) {
+        MarkObject(*ptr);
+      }
+    }
+    return;
+  }
+  MarkObject(heap_->ClassAt(cid));
+  Object* from;
+  Object* to;
+  obj->Pointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    MarkObject(*ptr);
+  }
+}
+
+void MarkerWorker::AddToRememberedSet(HeapObject obj) {
+  if (remembered_set_size_ == remembered_set_capacity_) {
+    remembered_set_capacity_ += (remembered_set_capacity_ >> 1);
+    HeapObject* old_remembered_set = remembered_set_;
+    remembered_set_ = new HeapObject[remembered_set_capacity_];
+    for (intptr_t i = 0; i < remembered_set_size_; i++) {
+      remembered_set_[i] = old_remembered_set[i];
+    }
+    delete[] old_remembered_set;
+  }
+  remembered_set_[remembered_set_size_++] = obj;
+}
+
+void MarkerWorker::MergeLists() {
+  heap_->old_size_ += marked_size_;
+  marked_size_ = 0;
+
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    heap_->AddToRememberedSet(remembered_set_[i]);
+  }
+  remembered_set_size_ = 0;
+
+  while (ephemeron_list_ != nullptr) {
+    Ephemeron next = ephemeron_list_->next();
+    heap_->AddToEphemeronList(ephemeron_list_);
+    ephemeron_list_ = next;
+  }
+  while (weak_list_ != nullptr) {
+    WeakArray next = weak_list_->next();
+    heap_->AddToWeakList(weak_list_);
+    weak_list_ = next;
+  }
+}
+
+NOINLINE
+void Heap::MarkSweep(Reason reason) {
+  if (policy_.verify_heap()) {
+    Verify("before mark-sweep");
+  }
+  int64_t start = OS::CurrentMonotonicNanos();
+  // Marking needs every mark bit clear.
+  FinishSweeping();
+  size_t size_before = old_size_;
+
+  // The rest of the allocation buffer is unmarked, so it will be swept.
+  old_top_ = old_end_ = 0;
+
+  // Completing an incremental marking only has to visit what its write barrier
+  // does not cover: the roots, new-space and the remembered set.
+  bool finishing = incremental_marking_;
+  if (finishing) {
+    StopIncrementalMarking();
+  }
+
+#if defined(DEBUG)
+  from_.ReadWrite();
+#endif
+
+  // Unless finishing, remembered set will be re-built during marking.
+  // Old-space size will be re-counted from the marked objects.
+  if (!finishing) {
+    remembered_set_size_ = 0;
+  }
+  old_size_ = finishing ? marked_size_ : 0;
+
+  interpreter_->GCPrologue();
+
+  // Strong references.
+  {
+    intptr_t num_workers =
+        (!finishing && ShouldMarkInParallel(size_before)) ? gc_workers_ : 1;
+    Marker marker(this, num_workers, from_.base(), from_.limit(), finishing);
+    marker.Mark();
+  }
+  if (finishing) {
+    FilterRememberedSet();
   }
 
 #if defined(DEBUG)
@@ -660,87 +2686,39 @@ void Heap::MarkSweep(Reason reason) {
   MournEphemeronList();
   MournWeakListMarkSweep();
   MournClassTableMarkSweep();
+  MournIdentityHashesMarkSweep();
+
+  if (ShouldCompact()) {
+    EvacuateSparseRegions();
+  }
 
+  // Methods and classes may have moved or died.
+  interpreter_->FlushInlineCaches();
+#if BASELINE_JIT
+  interpreter_->FlushCompiledCode();
+#endif
   interpreter_->GCEpilogue();
 
   Sweep();
 
   ShrinkRememberedSet();
 
-  SetOldAllocationLimit();
-
-#if TRACE_GC
-  size_t size_after = old_size_;
   int64_t stop = OS::CurrentMonotonicNanos();
-  int64_t time = stop - start;
-  OS::PrintErr("Mark-sweep "
-               "(%s, %" Pd "kB old, %" Pd "kB freed, %" Pd64 " us)\n",
-               ReasonToCString(reason), size_after / KB,
-               (size_before - size_after) / KB,
-               time / kNanosecondsPerMicrosecond);
-#endif
-}
-
-void Heap::MarkRoots() {
-  for (intptr_t i = 0; i < handles_size_; i++) {
-    MarkObject(*handles_[i]);
-  }
+  mark_sweep_time_ += stop - start;
+  SetOldGrowth(stop);
+  SetOldAllocationLimit();
 
-  Object* from;
-  Object* to;
-  interpreter_->RootPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    MarkObject(*ptr);
-  }
-  interpreter_->StackPointers(&from, &to);
-  for (Object* ptr = from; ptr <= to; ptr++) {
-    MarkObject(*ptr);
+  if (policy_.trace_gc()) {
+    size_t size_after = old_size_;
+    int64_t time = stop - start;
+    OS::PrintErr("Mark-sweep "
+                 "(%s, %" Pd "kB old, %" Pd "kB freed, %" Pd64 " us)\n",
+                 ReasonToCString(reason), size_after / KB,
+                 (size_before - size_after) / KB,
+                 time / kNanosecondsPerMicrosecond);
   }
-}
-
-void Heap::MarkObject(Object obj) {
-  if (obj->IsImmediateObject()) return;
-
-  HeapObject heap_obj = HeapObject::Cast(obj);
-  if (heap_obj->is_marked()) return;
-
-  heap_obj->set_is_marked(true);
-  heap_obj->set_is_remembered(false);
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  mark_stack->Push(heap_obj);
-}
-
-void Heap::ProcessMarkStack() {
-  MarkStack* mark_stack = reinterpret_cast<MarkStack*>(from_.base());
-  while (!mark_stack->IsEmpty()) {
-    HeapObject obj = mark_stack->Pop();
-    ASSERT(obj->is_marked());
-    ASSERT(!obj->is_remembered());
-
-    intptr_t cid = obj->cid();
-    ASSERT(cid != kIllegalCid);
-    ASSERT(cid != kForwardingCorpseCid);
-    ASSERT(cid != kFreeListElementCid);
-
-    if (cid == kWeakArrayCid) [[unlikely]] {
-      AddToWeakList(WeakArray::Cast(obj));
-    } else if (cid == kEphemeronCid) [[unlikely]] {
-      AddToEphemeronList(Ephemeron::Cast(obj));
-    } else {
-      MarkObject(ClassAt(cid));
-      bool has_new_target = ClassAt(cid)->IsNewObject();
-      Object* from;
-      Object* to;
-      obj->Pointers(&from, &to);
-      for (Object* ptr = from; ptr <= to; ptr++) {
-        Object target = *ptr;
-        has_new_target |= target->IsNewObject();
-        MarkObject(target);
-      }
-      if (has_new_target && obj->IsOldObject()) {
-        AddToRememberedSet(obj);
-      }
-    }
+  if (policy_.verify_heap()) {
+    Verify("after mark-sweep");
   }
 }
 
@@ -776,67 +2754,567 @@ void Heap::Sweep() {
     }
   }
 
-  Region* prev = nullptr;
-  Region* region = regions_;
-  while (region != nullptr) {
-    bool in_use = SweepRegion(region);
-    if (in_use) {
-      prev = region;
-      region = region->next();
-    } else {
-      Region* next = region->next();
-      if (prev == nullptr) {
-        regions_ = next;
-      } else {
-        prev->set_next(next);
-      }
-      old_capacity_ -= region->size();
-      region->Free();
-      region = next;
+  // Large objects are settled now: each is alone in its region, so this needs
+  // no walk, and a dead one's memory is not held until the next mark-sweep.
+  Region* region = large_regions_;
+  large_regions_ = nullptr;
+  while (region != nullptr) {
+    Region* next = region->next();
+    HeapObject object = HeapObject::FromAddr(region->object_start());
+    if (object->is_marked()) {
+      object->set_is_marked(false);
+      region->set_next(large_regions_);
+      large_regions_ = region;
+    } else {
+      ReleaseRegion(region);
+    }
+    region = next;
+  }
+
+  // Most regions are left for AllocateOldSmall to sweep as it needs free
+  // memory. One holding a single object, such as an abandoned allocation
+  // buffer, is settled now because that needs no walk.
+  ASSERT(sweep_regions_ == nullptr);
+  region = regions_;
+  regions_ = nullptr;
+  while (region != nullptr) {
+    Region* next = region->next();
+    HeapObject first = HeapObject::FromAddr(region->object_start());
+    if ((region->object_start() + first->HeapSize()) != region->object_end()) {
+      region->set_next(sweep_regions_);
+      sweep_regions_ = region;
+    } else if (first->is_marked()) {
+      first->set_is_marked(false);
+      region->set_next(regions_);
+      regions_ = region;
+    } else {
+      ReleaseRegion(region);
+    }
+    region = next;
+  }
+
+  if (!LAZY_SWEEP) {
+    FinishSweeping();
+  }
+  ReleaseRegions();
+}
+
+bool Heap::SweepNextRegion() {
+  Region* region = sweep_regions_;
+  if (region == nullptr) {
+    return false;
+  }
+  sweep_regions_ = region->next();
+  if (SweepRegion(region)) {
+    region->set_next(regions_);
+    regions_ = region;
+  } else {
+    ReleaseRegion(region);
+  }
+  return true;
+}
+
+void Heap::FinishSweeping() {
+  while (SweepNextRegion()) {
+  }
+  ReleaseRegions();
+}
+
+bool Heap::SweepRegion(Region* region) {
+  uword scan = region->object_start();
+  uword end = region->object_end();
+  while (scan < end) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    if (obj->is_marked()) {
+      obj->set_is_marked(false);
+      scan += obj->HeapSize();
+    } else {
+      uword free_scan = scan + obj->HeapSize();
+      while (free_scan < end) {
+        HeapObject next = HeapObject::FromAddr(free_scan);
+        if (next->is_marked()) break;
+        free_scan += next->HeapSize();
+      }
+
+      if ((scan == region->object_start()) && (free_scan == end)) {
+        // Note that Region::Of relies on us releasing large regions instead of
+        // adding them to the freelist.
+        return false;  // Not in use.
+      }
+
+      if (policy_.verify_heap()) {
+        memset(reinterpret_cast<void*>(scan), kUnallocatedByte,
+               free_scan - scan);
+      }
+      freelist_.EnqueueRange(scan, free_scan - scan);
+      DiscardFreeRange(region, scan, free_scan - scan);
+      scan = free_scan;
+    }
+  }
+  return true;  // In use.
+}
+
+// Free ranges are given back in chunks this large and aligned, which is a
+// multiple of the page size everywhere we run.
+static constexpr size_t kDiscardGranularity = 64 * KB;
+
+void Heap::DiscardFreeRange(Region* region, uword address, size_t size) {
+  if (policy_.huge_pages()) {
+    return;  // Would split the huge pages.
+  }
+  // The free-list element's header is kept, so that the range can still be
+  // walked and allocated from. The rest reads back as garbage or zeros.
+  uword start = Utils::RoundUp(address + sizeof(FreeListElement::Layout),
+                               kDiscardGranularity);
+  uword end = Utils::RoundDown(address + size, kDiscardGranularity);
+  if (start < end) {
+    region->memory().Discard(start, end - start);
+  }
+}
+
+void Heap::ReleaseRegion(Region* region) {
+  old_capacity_ -= region->size();
+  region->set_next(release_regions_);
+  release_regions_ = region;
+}
+
+class ReleaseRegionsTask : public ThreadPool::Task {
+ public:
+  explicit ReleaseRegionsTask(Region* regions) : regions_(regions) {}
+
+  void Run() override { FreeRegions(regions_, VirtualMemory()); }
+
+ private:
+  Region* const regions_;
+};
+
+void Heap::ReleaseRegions() {
+  Region* regions = nullptr;
+  while (release_regions_ != nullptr) {
+    Region* region = release_regions_;
+    release_regions_ = region->next();
+    if (IsReserved(region)) {
+      // Decommitting is cheap next to unmapping, and keeps the free list of
+      // the reservation on this thread.
+      VirtualMemory memory = region->memory();  // Lives in the region.
+      reservation_.Decommit(memory);
+      reserved_free_[reserved_free_size_++] = memory.base();
+    } else {
+      region->set_next(regions);
+      regions = region;
+    }
+  }
+  if (regions == nullptr) {
+    return;
+  }
+
+  // Unmapping is left to the thread pool, off the allocating thread.
+  ReleaseRegionsTask* task = new ReleaseRegionsTask(regions);
+  if (!Isolate::thread_pool()->Run(task)) {
+    delete task;
+    FreeRegions(regions, VirtualMemory());
+  }
+}
+
+bool Heap::ShouldCompact() const {
+  // The free-list has not been able to reuse the holes left by dead objects,
+  // so old-space holds more free memory than the growth policy allows for.
+  return COMPACTION && (old_capacity_ >= 4 * kRegionSize) &&
+         ((old_capacity_ - old_size_) > (old_capacity_ / 2));
+}
+
+static size_t LiveSize(Region* region) {
+  size_t size = 0;
+  uword scan = region->object_start();
+  while (scan < region->object_end()) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    if (obj->is_marked() && (obj->cid() >= kFirstLegalCid)) {
+      size += obj->HeapSize();
+    }
+    scan += obj->HeapSize();
+  }
+  return size;
+}
+
+// Copies the live objects of regions that are less than half full into fresh
+// regions, leaving forwarding corpses behind. Called after marking and before
+// sweeping, with the interpreter's frames in the GC state.
+void Heap::EvacuateSparseRegions() {
+  int64_t start = OS::CurrentMonotonicNanos();
+  Region* sparse = nullptr;
+  intptr_t num_sparse = 0;
+  size_t sparse_live = 0;
+  Region* region = regions_;
+  regions_ = nullptr;
+  while (region != nullptr) {
+    Region* next = region->next();
+    size_t capacity = region->limit() - region->object_start();
+    size_t live = LiveSize(region);
+    if (live < (capacity / 2)) {
+      region->set_next(sparse);
+      sparse = region;
+      num_sparse++;
+      sparse_live += live;
+    } else {
+      region->set_next(regions_);
+      regions_ = region;
+    }
+    region = next;
+  }
+
+  // Evacuating a single region would only move its holes.
+  if (num_sparse < 2) {
+    while (sparse != nullptr) {
+      Region* next = sparse->next();
+      sparse->set_next(regions_);
+      regions_ = sparse;
+      sparse = next;
+    }
+    return;
+  }
+
+  // The remainder of a destination region is left to the sweeper.
+  auto fill_tail = [&](Region* dest) {
+    size_t remaining = dest->limit() - dest->object_end();
+    if (remaining > 0) {
+      freelist_.EnqueueRange(dest->object_end(), remaining);
+      dest->set_object_end(dest->limit());
+    }
+  };
+  Region* to = nullptr;
+  for (region = sparse; region != nullptr; region = region->next()) {
+    uword scan = region->object_start();
+    while (scan < region->object_end()) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      size_t size = obj->HeapSize();
+      if (obj->is_marked() && (obj->cid() >= kFirstLegalCid)) {
+        uword addr = (to == nullptr) ? 0 : to->TryAllocate(size);
+        if (addr == 0) {
+          if (to != nullptr) {
+            fill_tail(to);
+          }
+          to = AllocateRegion(kRegionSize, kForceGrowth);
+          addr = to->TryAllocate(size);
+          ASSERT(addr != 0);
+        }
+        objcpy(reinterpret_cast<void*>(addr), reinterpret_cast<void*>(scan),
+               size);
+        InstallForwardingCorpse(obj, HeapObject::FromAddr(addr));
+      }
+      scan += size;
+    }
+  }
+  if (to != nullptr) {
+    fill_tail(to);
+  }
+
+  ForwardLiveObjects();
+
+  while (sparse != nullptr) {
+    Region* next = sparse->next();
+    ReleaseRegion(sparse);
+    sparse = next;
+  }
+
+  if (policy_.trace_gc()) {
+    int64_t stop = OS::CurrentMonotonicNanos();
+    OS::PrintErr("Evacuate (%" Pd " regions, %" Pd "kB live, %" Pd64 " us)\n",
+                 num_sparse, sparse_live / KB,
+                 (stop - start) / kNanosecondsPerMicrosecond);
+  }
+}
+
+// Like ForwardHeap, but only visits the marked objects: the unmarked ones
+// have not been swept yet and may refer to anything.
+void Heap::ForwardLiveObjects() {
+  for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
+    ForwardPointer(&class_table_[cid]);
+  }
+  ForwardRoots();
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    HeapObject obj = remembered_set_[i];
+    if (obj->IsForwardingCorpse()) {
+      remembered_set_[i] =
+          HeapObject::Cast(static_cast<ForwardingCorpse>(obj)->target());
+    }
+  }
+  ForwardIdentityHashes();
+
+  auto forward_region = [&](uword start, uword end) {
+    for (uword scan = start; scan < end; ) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      if (obj->is_marked() && (obj->cid() >= kFirstLegalCid)) {
+        Object* from;
+        Object* to;
+        obj->Pointers(&from, &to);
+        for (Object* ptr = from; ptr <= to; ptr++) {
+          ForwardPointer(ptr);
+        }
+      }
+      scan += obj->HeapSize();
+    }
+  };
+  forward_region(to_.object_start(), top_);
+  VisitOldRegions(forward_region);
+}
+
+// Marking costs in proportion to what survives it, so when it takes too much
+// of the run time, letting old-space grow further between mark-sweeps spreads
+// that cost over more allocation.
+void Heap::SetOldGrowth(int64_t stop) {
+  int64_t interval = stop - last_mark_sweep_end_;
+  intptr_t percent = interval == 0 ? 0 : (100 * mark_sweep_time_) / interval;
+  intptr_t goal = policy_.gc_time_goal_percent();
+  intptr_t growth = old_growth_percent_;
+  if (percent > goal) {
+    growth *= 2;
+    if (growth > GCPolicy::kMaxOldGrowthPercent) {
+      growth = GCPolicy::kMaxOldGrowthPercent;
+    }
+  } else if (percent < (goal / 4)) {
+    growth /= 2;
+    if (growth < policy_.old_growth_percent()) {
+      growth = policy_.old_growth_percent();
+    }
+  }
+  if (TRACE_GROWTH && (growth != old_growth_percent_)) {
+    OS::PrintErr("Old-space growth %" Pd "%% (%" Pd "%% of time marking)\n",
+                 growth, percent);
+  }
+  old_growth_percent_ = growth;
+  mark_sweep_time_ = 0;
+  last_mark_sweep_end_ = stop;
+}
+
+void Heap::SetOldAllocationLimit() {
+  old_limit_ = old_size_ + (old_size_ / 100) * old_growth_percent_;
+  size_t new_size = to_.size() + from_.size();
+  size_t soft_limit = policy_.heap_soft_limit();
+  if (soft_limit != 0) {
+    // Past the soft limit, mark-sweep every few regions.
+    size_t budget = soft_limit > new_size ? soft_limit - new_size : 0;
+    if (old_limit_ > budget) {
+      old_limit_ = budget;
+    }
+    if ((limit_state_ == kOverLimit) && (old_size_ + new_size <= soft_limit)) {
+      limit_state_ = kWithinLimit;
+    }
+  }
+  if (old_limit_ < old_size_ + 2 * kRegionSize) {
+    old_limit_ = old_size_ + 2 * kRegionSize;
+  }
+  old_start_marking_ = old_size_ + (old_limit_ - old_size_) / 2;
+  old_start_idle_marking_ = old_size_ + (old_limit_ - old_size_) / 4;
+  if (TRACE_GROWTH) {
+    OS::PrintErr("Old %" Pd "kB size, %" Pd "kB capacity, %" Pd "kB limit\n",
+                 old_size_ / KB, old_capacity_ / KB, old_limit_ / KB);
+  }
+}
+
+bool Heap::ShouldStartIncrementalMarking() const {
+  // Every mark bit must be clear, so sweeping must be done.
+  return INCREMENTAL_MARK && !incremental_marking_ &&
+         (sweep_regions_ == nullptr) && (old_size_ >= old_start_marking_);
+}
+
+// Called at the end of a scavenge, when new-space holds only survivors.
+void Heap::StartIncrementalMarking() {
+  int64_t start = OS::CurrentMonotonicNanos();
+  ASSERT(!incremental_marking_);
+  incremental_marking_ = true;
+  HeapObject::incremental_marking_ = true;
+  marked_size_ = 0;
+  old_size_at_last_step_ = old_size_;
+
+  // The roots and new-space are visited again when marking finishes, but
+  // seeding from them now leaves less for that pause.
+  for (intptr_t i = 0; i < handles_size_; i++) {
+    IncrementalMarkPointers(handles_[i], handles_[i]);
+  }
+  Object* from;
+  Object* to;
+  interpreter_->RootPointers(&from, &to);
+  IncrementalMarkPointers(from, to);
+  interpreter_->StackPointers(&from, &to);
+  IncrementalMarkPointers(from, to);
+
+  uword scan = to_.object_start();
+  while (scan < top_) {
+    HeapObject obj = HeapObject::FromAddr(scan);
+    intptr_t cid = obj->cid();
+    if ((cid >= kFirstLegalCid) && (cid != kWeakArrayCid) &&
+        (cid != kEphemeronCid)) {
+      HeapObject cls = ClassAt(cid);
+      if (cls->IsOldObject() && !cls->is_marked()) {
+        IncrementalMarkObject(cls);
+      }
+      obj->Pointers(&from, &to);
+      IncrementalMarkPointers(from, to);
+    }
+    scan += obj->HeapSize();
+  }
+
+  if (policy_.trace_gc()) {
+    int64_t stop = OS::CurrentMonotonicNanos();
+    OS::PrintErr("Incremental mark start (%" Pd "kB old, %" Pd64 " us)\n",
+                 old_size_ / KB, (stop - start) / kNanosecondsPerMicrosecond);
+  }
+}
+
+void Heap::StopIncrementalMarking() {
+  ASSERT(incremental_marking_);
+  incremental_marking_ = false;
+  HeapObject::incremental_marking_ = false;
+
+  IncrementalMark(SIZE_MAX);
+
+  // Resolved with those the final marking finds.
+  while (!mark_deferred_.IsEmpty()) {
+    HeapObject obj = mark_deferred_.Pop();
+    if (obj->IsWeakArray()) {
+      AddToWeakList(WeakArray::Cast(obj));
+    } else {
+      AddToEphemeronList(Ephemeron::Cast(obj));
+    }
+  }
+  mark_stack_.Release();
+  mark_deferred_.Release();
+}
+
+void Heap::IncrementalInterrupt() {
+  int64_t start = OS::CurrentMonotonicNanos();
+  if (incremental_marking_) {
+    // Scan more when old-space is growing quickly, so that marking finishes
+    // before the limit forces a full pause.
+    size_t budget = kIncrementalMarkStepSize;
+    if (old_size_ > old_size_at_last_step_) {
+      budget += 2 * (old_size_ - old_size_at_last_step_);
+    }
+    old_size_at_last_step_ = old_size_;
+    bool done = IncrementalMark(budget);
+    int64_t stop = OS::CurrentMonotonicNanos();
+    mark_sweep_time_ += stop - start;
+    if (policy_.trace_gc()) {
+      OS::PrintErr("Incremental mark step (%" Pd "kB marked, %" Pd64 " us)\n",
+                   marked_size_ / KB,
+                   (stop - start) / kNanosecondsPerMicrosecond);
+    }
+    if (done) {
+      MarkSweep(kIncremental);
     }
+  } else if (sweep_regions_ != nullptr) {
+    size_t swept = 0;
+    while ((swept < kIncrementalSweepStepSize) && (sweep_regions_ != nullptr)) {
+      swept += sweep_regions_->size();
+      SweepNextRegion();
+    }
+    ReleaseRegions();
+    mark_sweep_time_ += OS::CurrentMonotonicNanos() - start;
   }
 }
 
-bool Heap::SweepRegion(Region* region) {
-  uword scan = region->object_start();
-  uword end = region->object_end();
-  while (scan < end) {
-    HeapObject obj = HeapObject::FromAddr(scan);
-    if (obj->is_marked()) {
-      obj->set_is_marked(false);
-      size_t size = obj->HeapSize();
-      old_size_ += size;
-      scan += size;
+// Stays pending, so that the interpreter stops at every safepoint.
+void Heap::StressInterrupt() {
+  if (--safepoints_until_mark_sweep_ == 0) {
+    safepoints_until_mark_sweep_ = policy_.mark_sweep_every();
+    MarkSweep(kStress);
+  }
+  interpreter_->Interrupt(Interpreter::kInterruptGCStress);
+}
+
+// An isolate that has not scavenged for this long is taken to be idle.
+static constexpr int64_t kIdleTime = 100 * kNanosecondsPerMillisecond;
+
+void Heap::ReleaseIdleMemory() {
+  if (new_space_discarded_ ||
+      ((OS::CurrentMonotonicNanos() - last_scavenge_end_) < kIdleTime)) {
+    return;
+  }
+  new_space_discarded_ = true;
+
+  // Once old-space has grown a quarter of the way to its limit, mark-sweep
+  // while nothing waits on it, so that the garbage left by a burst of work is
+  // not kept until the limit is reached. Then sweep what the mutator has not
+  // needed, so that empty regions are released and free ranges given back.
+  if (incremental_marking_ || (old_size_ >= old_start_idle_marking_)) {
+    MarkSweep(kIdle);
+  }
+  FinishSweeping();
+
+  // From-space is not used until the next scavenge, nor to-space past the
+  // allocation top until it is allocated into.
+  from_.memory_.Discard(from_.base(), from_.size());
+  uword start = Utils::RoundUp(top_, kDiscardGranularity);
+  if (start < to_.limit()) {
+    to_.memory_.Discard(start, to_.limit() - start);
+  }
+}
+
+bool Heap::IncrementalMark(size_t budget) {
+  size_t scanned = 0;
+  while (!mark_stack_.IsEmpty() && (scanned < budget)) {
+    HeapObject obj = mark_stack_.Pop();
+    ASSERT(obj->IsOldObject());
+    ASSERT(obj->is_marked());
+    intptr_t cid = obj->cid();
+    if ((cid == kWeakArrayCid) || (cid == kEphemeronCid)) {
+      // Their references are not strong. Resolved when marking finishes.
+      mark_deferred_.Push(obj);
     } else {
-      uword free_scan = scan + obj->HeapSize();
-      while (free_scan < end) {
-        HeapObject next = HeapObject::FromAddr(free_scan);
-        if (next->is_marked()) break;
-        free_scan += next->HeapSize();
+      HeapObject cls = ClassAt(cid);
+      if (cls->IsOldObject() && !cls->is_marked()) {
+        IncrementalMarkObject(cls);
       }
+      Object* from;
+      Object* to;
+      obj->Pointers(&from, &to);
+      IncrementalMarkPointers(from, to);
+    }
+    scanned += obj->HeapSize();
+  }
+  return mark_stack_.IsEmpty();
+}
 
-      if ((scan == region->object_start()) && (free_scan == end)) {
-        // Note that Region::Of relies on us releasing large regions instead of
-        // adding them to the freelist.
-        return false;  // Not in use.
-      }
+void Heap::IncrementalMarkObject(HeapObject obj) {
+  ASSERT(obj->IsOldObject());
+  ASSERT(!obj->is_marked());
+  obj->set_is_marked(true);
+  marked_size_ += obj->HeapSize();
+  mark_stack_.Push(obj);
+}
 
-      freelist_.EnqueueRange(scan, free_scan - scan);
-      scan = free_scan;
+void Heap::IncrementalMarkPointers(Object* from, Object* to) {
+  // New-space is not marked until the final pause, since the scavenger uses
+  // the mark bit of new objects for forwarding.
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    Object target = *ptr;
+    if (target->IsOldObject() && !HeapObject::Cast(target)->is_marked()) {
+      IncrementalMarkObject(HeapObject::Cast(target));
     }
   }
-  return true;  // In use.
 }
 
-void Heap::SetOldAllocationLimit() {
-  old_limit_ = old_size_ + old_size_ / 2;
-  if (old_limit_ < old_size_ + 2 * kRegionSize) {
-    old_limit_ = old_size_ + 2 * kRegionSize;
+void Heap::FilterRememberedSet() {
+  // Drop the objects that died since they were remembered.
+  intptr_t size = 0;
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    HeapObject obj = remembered_set_[i];
+    if (obj->is_marked()) {
+      remembered_set_[size++] = obj;
+    }
   }
-  if (TRACE_GROWTH) {
-    OS::PrintErr("Old %" Pd "kB size, %" Pd "kB capacity, %" Pd "kB limit\n",
-                 old_size_ / KB, old_capacity_ / KB, old_limit_ / KB);
+  remembered_set_size_ = size;
+}
+
+void ObjectStack::Grow() {
+  intptr_t new_capacity = capacity_ == 0 ? 1024 : capacity_ + (capacity_ >> 1);
+  HeapObject* new_objects = new HeapObject[new_capacity];
+  for (intptr_t i = 0; i < size_; i++) {
+    new_objects[i] = objects_[i];
   }
+  delete[] objects_;
+  objects_ = new_objects;
+  capacity_ = new_capacity;
 }
 
 void Heap::AddToEphemeronList(Ephemeron survivor) {
@@ -845,11 +3323,6 @@ void Heap::AddToEphemeronList(Ephemeron survivor) {
   ephemeron_list_ = survivor;
 }
 
-static bool IsScavengeSurvivor(Object obj) {
-  return obj->IsImmediateOrOldObject() ||
-         IsForwarded(HeapObject::Cast(obj));
-}
-
 void Heap::ScavengeEphemeronList() {
   Ephemeron survivor = ephemeron_list_;
   ephemeron_list_ = nullptr;
@@ -876,40 +3349,6 @@ void Heap::ScavengeEphemeronList() {
   }
 }
 
-static bool IsMarkSweepSurvivor(Object obj) {
-  return obj->IsImmediateObject() || HeapObject::Cast(obj)->is_marked();
-}
-
-void Heap::MarkEphemeronList() {
-  Ephemeron survivor = ephemeron_list_;
-  ephemeron_list_ = nullptr;
-
-  while (survivor != nullptr) {
-    ASSERT(survivor->IsEphemeron());
-    Ephemeron next = survivor->next();
-    survivor->set_next(nullptr);
-
-    if (IsMarkSweepSurvivor(survivor->key())) {
-      bool has_new_target = false;
-      Object* from = survivor->key_ptr();
-      Object* to = survivor->finalizer_ptr();
-      for (Object* ptr = from; ptr <= to; ptr++) {
-        Object target = *ptr;
-        has_new_target |= target->IsNewObject();
-        MarkObject(target);
-      }
-      if (has_new_target && survivor->IsOldObject()) {
-        AddToRememberedSet(survivor);
-      }
-    } else {
-      // Fate of the key is not yet known; add the ephemeron back to the list.
-      AddToEphemeronList(survivor);
-    }
-
-    survivor = next;
-  }
-}
-
 void Heap::MournEphemeronList() {
   Object nil = interpreter_->nil_obj();
   Ephemeron survivor = ephemeron_list_;
@@ -974,7 +3413,8 @@ void Heap::MournWeakListMarkSweep() {
       MournWeakPointerMarkSweep(ptr);
       has_new_target |= (*ptr)->IsNewObject();
     }
-    if (has_new_target && survivor->IsOldObject()) {
+    if (has_new_target && survivor->IsOldObject() &&
+        !survivor->is_remembered()) {
       AddToRememberedSet(survivor);
     }
 
@@ -1069,11 +3509,134 @@ void Heap::MournClassTableForwarded() {
   }
 }
 
+intptr_t IdentityHashTable::Lookup(HeapObject obj) const {
+  if (capacity_ == 0) {
+    return 0;
+  }
+  intptr_t mask = capacity_ - 1;
+  for (intptr_t i = IndexOf(obj); ; i = (i + 1) & mask) {
+    if (entries_[i].key == obj) {
+      return entries_[i].hash;
+    }
+    if (entries_[i].key == nullptr) {
+      return 0;
+    }
+  }
+}
+
+void IdentityHashTable::Insert(HeapObject obj, intptr_t hash) {
+  ASSERT(obj != nullptr);
+  if (2 * (size_ + 1) > capacity_) {
+    Grow();
+  }
+  intptr_t mask = capacity_ - 1;
+  for (intptr_t i = IndexOf(obj); ; i = (i + 1) & mask) {
+    if (entries_[i].key == obj) {
+      entries_[i].hash = hash;
+      return;
+    }
+    if (entries_[i].key == nullptr) {
+      entries_[i].key = obj;
+      entries_[i].hash = hash;
+      size_++;
+      return;
+    }
+  }
+}
+
+void IdentityHashTable::Remove(HeapObject obj) {
+  if (capacity_ == 0) {
+    return;
+  }
+  intptr_t mask = capacity_ - 1;
+  intptr_t i = IndexOf(obj);
+  while (entries_[i].key != obj) {
+    if (entries_[i].key == nullptr) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  size_--;
+
+  // Shift back later entries of the probe sequence into the hole, so lookups
+  // need no tombstones.
+  intptr_t hole = i;
+  for (intptr_t j = (i + 1) & mask; entries_[j].key != nullptr;
+       j = (j + 1) & mask) {
+    intptr_t home = IndexOf(entries_[j].key);
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      entries_[hole] = entries_[j];
+      hole = j;
+    }
+  }
+  entries_[hole].key = nullptr;
+  entries_[hole].hash = 0;
+}
+
+void IdentityHashTable::Grow() {
+  Entry* old_entries = entries_;
+  intptr_t old_capacity = capacity_;
+  capacity_ = capacity_ == 0 ? kInitialCapacity : capacity_ * 2;
+  entries_ = new Entry[capacity_]();
+  size_ = 0;
+  for (intptr_t i = 0; i < old_capacity; i++) {
+    if (old_entries[i].key != nullptr) {
+      Insert(old_entries[i].key, old_entries[i].hash);
+    }
+  }
+  delete[] old_entries;
+}
+
+void Heap::MournIdentityHashesScavenge() {
+  new_identity_hashes_.Rekey([&](HeapObject old_key, intptr_t hash) {
+    DEBUG_ASSERT(InFromSpace(old_key));
+    if (!IsForwarded(old_key)) {
+      return HeapObject(nullptr);
+    }
+    HeapObject new_key = ForwardingTarget(old_key);
+    if (new_key->IsOldObject()) {
+      old_identity_hashes_.Insert(new_key, hash);  // Tenured.
+      return HeapObject(nullptr);
+    }
+    return new_key;
+  });
+}
+
+void Heap::MournIdentityHashesMarkSweep() {
+  auto mourn = [&](HeapObject key, intptr_t hash) {
+    return IsMarkSweepSurvivor(key) ? key : HeapObject(nullptr);
+  };
+  new_identity_hashes_.Rekey(mourn);
+  old_identity_hashes_.Rekey(mourn);
+}
+
+// After evacuation, which only moves old objects.
+void Heap::ForwardIdentityHashes() {
+  old_identity_hashes_.Rekey([&](HeapObject key, intptr_t hash) {
+    if (key->IsForwardingCorpse()) {
+      return HeapObject::Cast(static_cast<ForwardingCorpse>(key)->target());
+    }
+    return key;
+  });
+}
+
 bool Heap::BecomeForward(Array old, Array neu) {
   if (old->Size() != neu->Size()) {
     return false;
   }
 
+  // Uses the mark bits and walks the heap.
+  if (incremental_marking_) {
+    Object old_handle = old;
+    Object neu_handle = neu;
+    HandleScope h1(this, &old_handle);
+    HandleScope h2(this, &neu_handle);
+    MarkSweep(kIncremental);  // May move old objects.
+    old = Array::Cast(old_handle);
+    neu = Array::Cast(neu_handle);
+  }
+  FinishSweeping();
+
   intptr_t length = old->Size();
   bool invalid = false;
   for (intptr_t i = 0; i < length; i++) {
@@ -1122,26 +3685,34 @@ bool Heap::BecomeForward(Array old, Array neu) {
     ASSERT(!forwarder->IsForwardingCorpse());  // No splits.
     ASSERT(!forwardee->IsForwardingCorpse());  // No chains.
 
-    forwardee->set_header_hash(forwarder->header_hash());
-
-    size_t heap_size = forwarder->HeapSize();
-
-    HeapObject::Initialize(forwarder->Addr(), kForwardingCorpseCid, heap_size);
-    ASSERT(forwarder->IsForwardingCorpse());
-    ForwardingCorpse corpse = static_cast<ForwardingCorpse>(forwarder);
-    if (forwarder->heap_size() == 0) {
-      corpse->set_overflow_size(heap_size);
+    // The forwardee takes over the forwarder's identity.
+    intptr_t hash = IdentityHash(forwarder);
+    ClearIdentityHash(forwarder);
+    if (hash != 0) {
+      SetIdentityHash(forwardee, hash);
+    } else {
+      ClearIdentityHash(forwardee);
     }
-    ASSERT(forwarder->HeapSize() == heap_size);
 
-    corpse->set_target(forwardee);
+    InstallForwardingCorpse(forwarder, forwardee);
   }
 
   ForwardClassIds();
+  // A forwarded class is marked while its cid is swapped, and is not found to
+  // be unmarked if another forwarded class took its place in the table. Left
+  // marked, a corpse in new-space would read as forwarded to a scavenge.
+  for (intptr_t i = 0; i < length; i++) {
+    HeapObject::Cast(old->element(i))->set_is_marked(false);
+  }
   ForwardRoots();
   ForwardHeap();  // With forwarded class ids.
   MournClassTableForwarded();
 
+  // Methods and classes may have changed.
+  interpreter_->FlushInlineCaches();
+#if BASELINE_JIT
+  interpreter_->FlushCompiledCode();
+#endif
   interpreter_->GCEpilogue();
 
 #if defined(DEBUG)
@@ -1170,9 +3741,7 @@ bool Heap::BecomeForward(Array old, Array neu) {
     }
   };
   check_region(to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    check_region(region->object_start(), region->object_end());
-  }
+  VisitOldRegions(check_region);
 #endif  // defined(DEBUG)
 
   return true;
@@ -1212,9 +3781,8 @@ void Heap::ForwardHeap() {
   }
 
   remembered_set_size_ = 0;
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    uword scan = region->object_start();
-    while (scan < region->object_end()) {
+  VisitOldRegions([&](uword start, uword end) {
+    for (uword scan = start; scan < end; ) {
       HeapObject obj = HeapObject::FromAddr(scan);
       if (obj->cid() >= kFirstLegalCid) {
         obj->set_is_remembered(false);
@@ -1226,12 +3794,17 @@ void Heap::ForwardHeap() {
           has_new_target |= ForwardPointer(ptr);
         }
         if (has_new_target) {
+          if (obj->has_card_table()) {
+            // The next scavenge cleans the cards that do not need scanning.
+            memset(Region::FromLargeObject(obj)->cards(), 1,
+                   CardCount(obj->HeapSize()));
+          }
           AddToRememberedSet(obj);
         }
       }
       scan += obj->HeapSize();
     }
-  }
+  });
 }
 
 void Heap::ForwardClassIds() {
@@ -1261,11 +3834,11 @@ void Heap::ForwardClassIds() {
       // Arrange for instances with new_cid to be migrated to old_cid.
       intptr_t new_cid = new_class->id()->value();
       class_table_[new_cid] = old_class;
+      old_class->set_is_marked(true);  // Unmarked below.
     }
 
     new_class->set_id(SmallInteger::New(old_cid));
     class_table_[old_cid] = new_class;
-    old_class->set_is_marked(true);
   }
 
   for (intptr_t cid = kFirstLegalCid; cid < class_table_size_; cid++) {
@@ -1305,6 +3878,14 @@ intptr_t Heap::AllocateClassId() {
       }
 #endif
       delete[] old_class_table;
+      uint8_t* old_pretenure = pretenure_;
+      pretenure_ = new uint8_t[class_table_capacity_];
+      memcpy(pretenure_, old_pretenure, class_table_size_);
+      delete[] old_pretenure;
+      delete[] allocated_;
+      allocated_ = new size_t[class_table_capacity_];
+      delete[] survived_;
+      survived_ = new size_t[class_table_capacity_];
       cid = class_table_size_;
       class_table_size_++;
     }
@@ -1315,6 +3896,7 @@ intptr_t Heap::AllocateClassId() {
 #if defined(DEBUG)
   class_table_[cid] = static_cast<Object>(kUninitializedWord);
 #endif
+  pretenure_[cid] = 0;
   return cid;
 }
 
@@ -1342,8 +3924,18 @@ void Heap::InitializeAfterSnapshot() {
   }
   top_ = to_.object_start();
   end_ = to_.limit();
+  SetAllocationLimit();
+  survivor_end_ = top_;
 
+  last_scavenge_end_ = last_mark_sweep_end_ = OS::CurrentMonotonicNanos();
   SetOldAllocationLimit();
+
+  // Stress testing starts once the heap is walkable.
+  allocations_until_scavenge_ = policy_.scavenge_every();
+  safepoints_until_mark_sweep_ = policy_.mark_sweep_every();
+  if (safepoints_until_mark_sweep_ != 0) {
+    interpreter_->Interrupt(Interpreter::kInterruptGCStress);
+  }
 }
 
 static void Truncate(Array array, intptr_t new_size) {
@@ -1416,12 +4008,13 @@ Array Heap::InstancesOf(Behavior cls) {
   ASSERT(cls->id()->IsSmallInteger());
   intptr_t cid = cls->id()->value();
 
+  // Heap walks cannot skip the dead objects of unswept regions.
+  FinishSweeping();
   intptr_t count = CountInstancesOf(0, cid,
                                     to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    count = CountInstancesOf(count, cid,
-                             region->object_start(), region->object_end());
-  }
+  VisitOldRegions([&](uword start, uword end) {
+    count = CountInstancesOf(count, cid, start, end);
+  });
 
   if (cid == kArrayCid) {
     count++;
@@ -1431,12 +4024,12 @@ Array Heap::InstancesOf(Behavior cls) {
   }
   Array result = AllocateArray(count);  // SAFEPOINT
 
+  FinishSweeping();
   intptr_t cursor = CollectInstancesOf(0, result, cid,
                                        to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    cursor = CollectInstancesOf(cursor, result, cid,
-                                region->object_start(), region->object_end());
-  }
+  VisitOldRegions([&](uword start, uword end) {
+    cursor = CollectInstancesOf(cursor, result, cid, start, end);
+  });
 
   // There may be fewer instances than we initially counted if allocating the
   // result array triggered a GC.
@@ -1493,12 +4086,14 @@ static intptr_t CollectReferencesTo(intptr_t cursor,
 
 Array Heap::ReferencesTo(Object target) {
   // TODO(rmacnak): Consider reifying activations in case they refer to target.
+
+  // Heap walks cannot skip the dead objects of unswept regions.
+  FinishSweeping();
   intptr_t count = CountReferencesTo(0, target,
                                      to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    count = CountReferencesTo(count, target,
-                              region->object_start(), region->object_end());
-  }
+  VisitOldRegions([&](uword start, uword end) {
+    count = CountReferencesTo(count, target, start, end);
+  });
 
   if (TEST_SLOW_PATH) {
     count++;  // Ensure truncation is needed.
@@ -1509,12 +4104,12 @@ Array Heap::ReferencesTo(Object target) {
     result = AllocateArray(count);  // SAFEPOINT
   }
 
+  FinishSweeping();
   intptr_t cursor = CollectReferencesTo(0, result, target,
                                         to_.object_start(), top_);
-  for (Region* region = regions_; region != nullptr; region = region->next()) {
-    cursor = CollectReferencesTo(cursor, result, target,
-                                 region->object_start(), region->object_end());
-  }
+  VisitOldRegions([&](uword start, uword end) {
+    cursor = CollectReferencesTo(cursor, result, target, start, end);
+  });
 
   // There may be fewer instances than we initially counted if allocating the
   // result array triggered a GC.
@@ -1522,34 +4117,230 @@ Array Heap::ReferencesTo(Object target) {
   return result;
 }
 
+// An old-space region as seen by Heap::Verify.
+struct VerifiedRegion {
+  uword start;
+  uword end;
+  bool unswept;  // Only its marked objects are live.
+};
+
+static int CompareVerifiedRegions(const void* a, const void* b) {
+  uword start_a = static_cast<const VerifiedRegion*>(a)->start;
+  uword start_b = static_cast<const VerifiedRegion*>(b)->start;
+  return (start_a < start_b) ? -1 : ((start_a > start_b) ? 1 : 0);
+}
+
+void Heap::Verify(const char* when) {
+  intptr_t num_regions = 0;
+  auto count = [&](Region* list) {
+    for (Region* region = list; region != nullptr; region = region->next()) {
+      num_regions++;
+    }
+  };
+  count(regions_);
+  count(large_regions_);
+  count(sweep_regions_);
+  VerifiedRegion* regions = new VerifiedRegion[num_regions + 1];
+  intptr_t cursor = 0;
+  auto add = [&](Region* list, bool unswept) {
+    for (Region* region = list; region != nullptr; region = region->next()) {
+      regions[cursor].start = region->object_start();
+      regions[cursor].end = region->object_end();
+      regions[cursor].unswept = unswept;
+      cursor++;
+    }
+  };
+  add(regions_, false);
+  add(large_regions_, false);
+  add(sweep_regions_, true);
+  qsort(regions, num_regions, sizeof(VerifiedRegion), CompareVerifiedRegions);
+
+  auto find_region = [&](uword addr) -> VerifiedRegion* {
+    intptr_t lo = 0;
+    intptr_t hi = num_regions;
+    while (lo < hi) {
+      intptr_t mid = lo + (hi - lo) / 2;
+      if (regions[mid].start <= addr) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if ((lo == 0) || (addr >= regions[lo - 1].end)) {
+      return nullptr;
+    }
+    return &regions[lo - 1];
+  };
+
+  auto fail = [&](uword holder, const char* problem, uword value) {
+    FATAL("Heap verification %s: %s: %" Px " in %" Px, when, problem, value,
+          holder);
+  };
+
+  auto verify_reference = [&](uword holder, Object value) {
+    if (!value->IsHeapObject()) {
+      return;
+    }
+    HeapObject target = HeapObject::Cast(value);
+    uword addr = target->Addr();
+    if (target->IsNewObject()) {
+      if ((addr < to_.object_start()) || (addr >= top_)) {
+        fail(holder, "reference outside new-space", addr);
+      }
+    } else {
+      VerifiedRegion* region = find_region(addr);
+      if (region == nullptr) {
+        fail(holder, "reference outside old-space", addr);
+      }
+      if (region->unswept && !target->is_marked()) {
+        fail(holder, "reference to an unmarked object", addr);
+      }
+    }
+    intptr_t cid = target->cid();
+    if ((cid < kFirstLegalCid) || (cid >= class_table_size_)) {
+      fail(holder, "reference to a free or forwarded object", addr);
+    }
+  };
+
+  auto verify_object = [&](HeapObject obj, uword end) {
+    uword addr = obj->Addr();
+    size_t size = obj->HeapSize();
+    if ((size == 0) || !Utils::IsAligned(size, kObjectAlignment) ||
+        (addr + size > end)) {
+      fail(addr, "bad size", size);
+    }
+    intptr_t cid = obj->cid();
+    if ((cid == kIllegalCid) || (cid >= class_table_size_)) {
+      fail(addr, "bad class id", cid);
+    }
+    if (obj->IsNewObject() && obj->is_marked()) {
+      fail(addr, "marked object in new-space", cid);  // Reads as forwarded.
+    }
+    if (cid < kFirstLegalCid) {
+      return;  // A gap or a corpse, which nothing may refer to.
+    }
+    if (!class_table_[cid]->IsHeapObject()) {
+      fail(addr, "unregistered class id", cid);
+    }
+    Object* from;
+    Object* to;
+    obj->Pointers(&from, &to);
+    for (Object* ptr = from; ptr <= to; ptr++) {
+      Object value = *ptr;
+      verify_reference(addr, value);
+      if (obj->IsOldObject() && value->IsNewObject()) {
+        if (!obj->is_remembered()) {
+          fail(addr, "unremembered reference into new-space",
+               static_cast<uword>(value));
+        }
+        if (obj->has_card_table()) {
+          uint8_t* cards = Region::FromLargeObject(obj)->cards();
+          if (cards[(reinterpret_cast<uword>(ptr) - addr) >>
+                    kCardSizeLog2] == 0) {
+            fail(addr, "clean card with a reference into new-space",
+                 static_cast<uword>(value));
+          }
+        }
+      }
+    }
+  };
+
+  auto verify_range = [&](uword start, uword end, bool unswept) {
+    uword scan = start;
+    while (scan < end) {
+      HeapObject obj = HeapObject::FromAddr(scan);
+      if (!unswept || obj->is_marked()) {
+        verify_object(obj, end);
+      }
+      scan += obj->HeapSize();
+    }
+  };
+
+  verify_range(to_.object_start(), top_, false);
+  for (intptr_t i = 0; i < num_regions; i++) {
+    verify_range(regions[i].start, regions[i].end, regions[i].unswept);
+  }
+
+  for (intptr_t i = 0; i < remembered_set_size_; i++) {
+    HeapObject obj = remembered_set_[i];
+    if (!obj->IsOldObject() || !obj->is_remembered()) {
+      fail(0, "bad remembered set entry", obj->Addr());
+    }
+  }
+  for (intptr_t i = kFirstLegalCid; i < class_table_size_; i++) {
+    if (class_table_[i] != static_cast<Object>(kUninitializedWord)) {
+      verify_reference(0, class_table_[i]);  // A class or a free entry.
+    }
+  }
+  for (intptr_t i = 0; i < handles_size_; i++) {
+    verify_reference(0, *handles_[i]);
+  }
+  // Every slot on the stack is an object only while the frames hold BCIs.
+  interpreter_->GCPrologue();
+  Object* from;
+  Object* to;
+  interpreter_->RootPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    verify_reference(0, *ptr);
+  }
+  interpreter_->StackPointers(&from, &to);
+  for (Object* ptr = from; ptr <= to; ptr++) {
+    verify_reference(0, *ptr);
+  }
+  interpreter_->GCEpilogue();
+
+  delete[] regions;
+}
+
 uword FreeList::TryAllocate(size_t size) {
   intptr_t index = IndexForSize(size);
-  while (index < kSizeClasses) {
-    if (free_lists_[index] != nullptr) {
-      FreeListElement element = Dequeue(index);
+  if (index < kSizeClasses) {
+    // The smallest non-empty exact class that fits.
+    uint64_t fits = non_empty_ & (~static_cast<uint64_t>(0) << index) &
+                    ~(static_cast<uint64_t>(1) << kSizeClasses);
+    if (fits != 0) {
+      FreeListElement element = Dequeue(std::countr_zero(fits));
       SplitAndRequeue(element, size);
-      return element.Addr();
+      return element->Addr();
     }
-    index++;
   }
 
+  FreeListElement element = DequeueLarge(size);
+  if (element == nullptr) {
+    return 0;
+  }
+  SplitAndRequeue(element, size);
+  return element->Addr();
+}
+
+FreeListElement FreeList::TryAllocateBuffer(size_t min_size, size_t max_size) {
+  FreeListElement element = DequeueLarge(min_size);
+  if ((element != nullptr) && (element->HeapSize() > max_size)) {
+    SplitAndRequeue(element, max_size);
+    FillGap(element->Addr(), max_size);
+  }
+  return element;
+}
+
+FreeListElement FreeList::DequeueLarge(size_t size) {
   FreeListElement prev = nullptr;
   FreeListElement element = free_lists_[kSizeClasses];
   while (element != nullptr) {
     if (element->HeapSize() >= size) {
       if (prev == nullptr) {
         free_lists_[kSizeClasses] = element->next();
+        if (element->next() == nullptr) {
+          non_empty_ &= ~(static_cast<uint64_t>(1) << kSizeClasses);
+        }
       } else {
         prev->set_next(element->next());
       }
-      SplitAndRequeue(element, size);
-      return element->Addr();
+      return element;
     }
     prev = element;
     element = element->next();
   }
-
-  return 0;
+  return nullptr;
 }
 
 void FreeList::SplitAndRequeue(FreeListElement element, size_t size) {
@@ -1570,6 +4361,9 @@ FreeListElement FreeList::Dequeue(intptr_t index) {
   }
   ASSERT((element->next() == nullptr) || element->next()->IsFreeListElement());
   free_lists_[index] = element->next();
+  if (element->next() == nullptr) {
+    non_empty_ &= ~(static_cast<uint64_t>(1) << index);
+  }
   return element;
 }
 
@@ -1591,6 +4385,7 @@ void FreeList::EnqueueRange(uword addr, size_t size) {
   intptr_t index = IndexForSize(size);
   element->set_next(free_lists_[index]);
   free_lists_[index] = element;
+  non_empty_ |= static_cast<uint64_t>(1) << index;
 }
 
 }  // namespace psoup
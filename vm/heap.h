@@ -16,7 +16,11 @@
 namespace psoup {
 
 class Interpreter;
+class Marker;
+class MarkerWorker;
+class ParallelScavenger;
 class Region;
+class ScavengerWorker;
 
 // Note these values are never valid Object.
 #if defined(ARCH_IS_32_BIT)
@@ -40,6 +44,7 @@ static bool HasAlignmentGap(intptr_t num_slots) {
 class Semispace {
  private:
   friend class Heap;
+  friend class MarkerWorker;
 
   void Allocate(size_t size) {
     memory_ = VirtualMemory::Allocate(size, VirtualMemory::kReadWrite,
@@ -75,10 +80,13 @@ class Semispace {
 class FreeList {
  private:
   friend class Heap;
+  friend class ScavengerWorker;
 
   FreeList() { Reset(); }
 
   uword TryAllocate(size_t size);
+  // Takes a whole element of at least the given size, for bump allocation.
+  FreeListElement TryAllocateBuffer(size_t min_size, size_t max_size);
 
   intptr_t IndexForSize(size_t size) {
     intptr_t index = size >> kObjectAlignmentLog2;
@@ -91,14 +99,175 @@ class FreeList {
   void SplitAndRequeue(FreeListElement element, size_t size);
   FreeListElement Dequeue(intptr_t index);
   void EnqueueRange(uword address, size_t size);
+  FreeListElement DequeueLarge(size_t size);
   void Reset() {
     for (intptr_t i = 0; i <= kSizeClasses; i++) {
       free_lists_[i] = nullptr;
     }
+    non_empty_ = 0;
   }
 
-  static constexpr intptr_t kSizeClasses = 7;
+  // One exact class for each size up to 63 allocation units, and the rest on
+  // a single list searched first-fit.
+  static constexpr intptr_t kSizeClasses = 63;
   FreeListElement free_lists_[kSizeClasses + 1];
+  uint64_t non_empty_;  // Bit by index.
+};
+
+// A growable stack of objects, for work lists kept between collections.
+class ObjectStack {
+ public:
+  ObjectStack() : objects_(nullptr), size_(0), capacity_(0) {}
+  ~ObjectStack() { delete[] objects_; }
+
+  bool IsEmpty() const { return size_ == 0; }
+  void Push(HeapObject obj) {
+    if (size_ == capacity_) [[unlikely]] {
+      Grow();
+    }
+    objects_[size_++] = obj;
+  }
+  HeapObject Pop() {
+    ASSERT(!IsEmpty());
+    return objects_[--size_];
+  }
+  void Release() {
+    delete[] objects_;
+    objects_ = nullptr;
+    size_ = capacity_ = 0;
+  }
+
+ private:
+  void Grow();
+
+  HeapObject* objects_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(ObjectStack);
+};
+
+// How the collector trades pause times and memory for throughput. Each
+// isolate's heap has its own copy, which the isolates it spawns inherit.
+class GCPolicy {
+ public:
+  static constexpr intptr_t kMaxOldGrowthPercent = 400;
+
+  GCPolicy();
+
+  // Parses an option of the form "--name=value". Returns false if either the
+  // name or the value is not valid.
+  bool SetOption(const char* option);
+  // Applies PSOUP_NAME=value from the environment for each option --name.
+  void SetFromEnvironment();
+  static void PrintOptions();
+
+  // Average scavenge pause above which new-space shrinks. Zero for no goal.
+  int64_t scavenge_pause_goal() const { return scavenge_pause_goal_; }
+  // Share of run time spent collecting above which new-space or the old-space
+  // limit grows.
+  intptr_t gc_time_goal_percent() const { return gc_time_goal_percent_; }
+  size_t min_semispace_capacity() const { return min_semispace_capacity_; }
+  size_t max_semispace_capacity() const { return max_semispace_capacity_; }
+  // How far beyond its live size old-space may grow before the next
+  // mark-sweep, when marking is cheap.
+  intptr_t old_growth_percent() const { return old_growth_percent_; }
+  // Heap size past which an out-of-memory signal is sent. Zero for no limit.
+  size_t heap_limit() const { return heap_limit_; }
+  // Heap size past which old-space is collected more eagerly. Defaults to
+  // three quarters of the hard limit.
+  size_t heap_soft_limit() const {
+    if (heap_soft_limit_ == 0) {
+      return heap_limit_ - heap_limit_ / 4;
+    }
+    if ((heap_limit_ != 0) && (heap_soft_limit_ > heap_limit_)) {
+      return heap_limit_;
+    }
+    return heap_soft_limit_;
+  }
+  // Whether heap memory is given huge pages, and prefers the NUMA node of the
+  // thread that creates the heap.
+  bool huge_pages() const { return huge_pages_; }
+  bool numa_local() const { return numa_local_; }
+  // For testing the collector in release builds: check the heap before and
+  // after each collection, scavenge on every Nth allocation and mark-sweep at
+  // every Nth safepoint (zero for never), and report each collection.
+  bool verify_heap() const { return verify_heap_; }
+  intptr_t scavenge_every() const { return scavenge_every_; }
+  intptr_t mark_sweep_every() const { return mark_sweep_every_; }
+  bool trace_gc() const { return trace_gc_; }
+
+ private:
+  int64_t scavenge_pause_goal_;  // Nanoseconds.
+  intptr_t gc_time_goal_percent_;
+  size_t min_semispace_capacity_;
+  size_t max_semispace_capacity_;
+  intptr_t old_growth_percent_;
+  size_t heap_limit_;
+  size_t heap_soft_limit_;
+  bool huge_pages_;
+  bool numa_local_;
+  bool verify_heap_;
+  intptr_t scavenge_every_;
+  intptr_t mark_sweep_every_;
+  bool trace_gc_;
+};
+
+// Identity hashes, keyed by address. Few objects ever have their identity hash
+// taken, so keeping it out of the object header saves a word in every object.
+// The collector re-keys the table when it moves or frees objects.
+class IdentityHashTable {
+ public:
+  IdentityHashTable() : entries_(nullptr), size_(0), capacity_(0) {}
+  ~IdentityHashTable() { delete[] entries_; }
+
+  intptr_t Lookup(HeapObject obj) const;  // 0 if absent.
+  void Insert(HeapObject obj, intptr_t hash);
+  void Remove(HeapObject obj);
+
+  // Replaces each key with the result of the function, which is nullptr if
+  // the entry should be dropped.
+  template <typename Function>
+  void Rekey(Function rekey) {
+    if (size_ == 0) {
+      return;
+    }
+    Entry* old_entries = entries_;
+    intptr_t old_capacity = capacity_;
+    while ((capacity_ > kInitialCapacity) && (4 * size_ <= capacity_)) {
+      capacity_ >>= 1;
+    }
+    entries_ = new Entry[capacity_]();
+    size_ = 0;
+    for (intptr_t i = 0; i < old_capacity; i++) {
+      if (old_entries[i].key != nullptr) {
+        HeapObject key = rekey(old_entries[i].key, old_entries[i].hash);
+        if (key != nullptr) {
+          Insert(key, old_entries[i].hash);
+        }
+      }
+    }
+    delete[] old_entries;
+  }
+
+ private:
+  struct Entry {
+    HeapObject key;
+    intptr_t hash;
+  };
+
+  intptr_t IndexOf(HeapObject obj) const {
+    return (obj->Addr() >> kObjectAlignmentLog2) & (capacity_ - 1);
+  }
+  void Grow();
+
+  static constexpr intptr_t kInitialCapacity = 64;
+
+  Entry* entries_;
+  intptr_t size_;
+  intptr_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(IdentityHashTable);
 };
 
 // C. J. Cheney. "A nonrecursive list compacting algorithm." Communications of
@@ -106,13 +275,36 @@ class FreeList {
 //
 // Barry Hayes. "Ephemerons: a New Finalization Mechanism." Object-Oriented
 // Languages, Programming, Systems, and Applications. 1997.
+//
+// Edsger W. Dijkstra, Leslie Lamport, A. J. Martin, C. S. Scholten and
+// E. F. M. Steffens. "On-the-fly Garbage Collection: An Exercise in
+// Cooperation." Communications of the ACM. 1978.
+//
+// Urs Hölzle. "A Fast Write Barrier for Generational Garbage Collectors."
+// OOPSLA Workshop on Garbage Collection in Object-Oriented Systems. 1993.
+//
+// Stephen M. Blackburn, Sharad Singhai, Matthew Hertz, Kathryn S. McKinley and
+// J. Eliot B. Moss. "Pretenuring for Java." Object-Oriented Programming,
+// Systems, Languages, and Applications. 2001.
 class Heap {
  private:
   static constexpr size_t kLargeAllocationSize = 32 * KB;
   static constexpr intptr_t kRememberedSetOverflowSize = 8 * KB;
-  static constexpr size_t kInitialSemispaceCapacity = sizeof(uword) * MB / 8;
-  static constexpr size_t kMaxSemispaceCapacity = 2 * sizeof(uword) * MB;
+  static constexpr size_t kParallelScavengeSize = sizeof(uword) * MB / 8;
   static constexpr size_t kRegionSize = 256 * KB;
+#if defined(ARCH_IS_64_BIT)
+  static constexpr size_t kReservationSize = 1 * GB;
+#else
+  static constexpr size_t kReservationSize = 0;  // Address space is scarce.
+#endif
+  static constexpr intptr_t kMaxGCWorkers = 4;
+  static constexpr size_t kMinParallelMarkSize = 4 * MB;
+  static constexpr size_t kIncrementalMarkStepSize = 256 * KB;
+  static constexpr size_t kIncrementalSweepStepSize = 1 * MB;
+  static constexpr intptr_t kPretenureResetInterval = 32;
+  static constexpr size_t kPretenureMinSurvivorSize = 64 * KB;
+  static constexpr intptr_t kArraySizeClasses = kBitsPerWord;
+  static constexpr size_t kMaxOldBufferSize = 64 * KB;
 
  public:
   enum Allocator { kNormal, kSnapshot };
@@ -126,7 +318,10 @@ class Heap {
     kClassTable,
     kRememberedSet,
     kPrimitive,
-    kSnapshotTest
+    kSnapshotTest,
+    kIncremental,
+    kIdle,
+    kStress
   };
 
   static const char* ReasonToCString(Reason reason) {
@@ -138,14 +333,18 @@ class Heap {
       case kRememberedSet: return "remembered-set";
       case kPrimitive: return "primitive";
       case kSnapshotTest: return "snapshot-test";
+      case kIncremental: return "incremental";
+      case kIdle: return "idle";
+      case kStress: return "stress";
     }
     UNREACHABLE();
     return nullptr;
   }
 
-  Heap();
+  explicit Heap(const GCPolicy& policy);
   ~Heap();
 
+  void RememberCard(HeapObject object, uword slot);
   void AddToRememberedSet(HeapObject object) {
     ASSERT(object->IsOldObject());
     ASSERT(!object->is_remembered());
@@ -161,12 +360,26 @@ class Heap {
     ASSERT(cid == kEphemeronCid || cid >= kFirstRegularObjectCid);
     size_t heap_size = AllocationSize(sizeof(HeapObject::Layout) +
                                       num_slots * sizeof(Object));
-    uword addr = Allocate(heap_size, allocator);
+    if (cid == kEphemeronCid) {
+      // The GC's list link follows the key, value and finalizer.
+      ASSERT(num_slots == 3);
+      heap_size = AllocationSize(sizeof(Ephemeron::Layout));
+    }
+    uword addr;
+    if (PRETENURE && (allocator == kNormal) && pretenure_[cid]) [[unlikely]] {
+      addr = AllocatePretenured(heap_size);
+    } else {
+      addr = Allocate(heap_size, allocator);
+    }
     HeapObject obj = HeapObject::Initialize(addr, cid, heap_size);
     RegularObject result = RegularObject::Cast(obj);
     ASSERT(result->IsRegularObject() || result->IsEphemeron());
     ASSERT(result->HeapSize() == heap_size);
 
+    if (cid == kEphemeronCid) {
+      Ephemeron::Cast(result)->set_next(nullptr);
+      num_slots++;
+    }
     if (HasAlignmentGap(num_slots)) {
       // The gap will be visited by the GC. Make it a valid oop.
       result->set_slot(num_slots, SmallInteger::New(0), kNoBarrier);
@@ -195,6 +408,7 @@ class Heap {
     HeapObject obj = HeapObject::Initialize(addr, kStringCid, heap_size);
     String result = String::Cast(obj);
     result->set_size(SmallInteger::New(num_bytes));
+    result->set_hash(0);
     ASSERT(result->IsString());
     ASSERT(result->HeapSize() == heap_size);
     return result;
@@ -203,10 +417,20 @@ class Heap {
   Array AllocateArray(intptr_t num_slots, Allocator allocator = kNormal) {
     size_t heap_size = AllocationSize(sizeof(Array::Layout) +
                                       num_slots * sizeof(Object));
-    uword addr = Allocate(heap_size, allocator);
+    uword addr;
+    if (PRETENURE && (allocator == kNormal) &&
+        pretenure_arrays_[ArraySizeClass(heap_size)]) [[unlikely]] {
+      addr = AllocatePretenured(heap_size);
+    } else {
+      addr = Allocate(heap_size, allocator);
+    }
     HeapObject obj = HeapObject::Initialize(addr, kArrayCid, heap_size);
     Array result = Array::Cast(obj);
     result->set_size(SmallInteger::New(num_slots));
+    if (heap_size >= kLargeAllocationSize) {
+      // Alone in a region with a card table.
+      result->set_has_card_table(true);
+    }
     ASSERT(result->IsArray());
     ASSERT(result->HeapSize() == heap_size);
     return result;
@@ -289,12 +513,36 @@ class Heap {
 
   void CollectAll(Reason reason) { MarkSweep(reason); }
   void RememberedSetInterrupt() { Scavenge(Heap::kRememberedSet); }
+  void IncrementalInterrupt();
+  void StressInterrupt();
+  // Called as the isolate finishes a message, which may leave it waiting.
+  void ReleaseIdleMemory();
+
+  void MarkForIncrementalMarking(HeapObject obj) {
+    ASSERT(incremental_marking_);
+    ASSERT(obj->IsOldObject());
+    ASSERT(!obj->is_marked());
+    IncrementalMarkObject(obj);
+  }
 
   Array InstancesOf(Behavior cls);
   Array ReferencesTo(Object target);
 
   bool BecomeForward(Array old, Array neu);
 
+  intptr_t IdentityHash(HeapObject obj) const {
+    return obj->IsNewObject() ? new_identity_hashes_.Lookup(obj)
+                              : old_identity_hashes_.Lookup(obj);
+  }
+  void SetIdentityHash(HeapObject obj, intptr_t hash) {
+    ASSERT(hash != 0);
+    if (obj->IsNewObject()) {
+      new_identity_hashes_.Insert(obj, hash);
+    } else {
+      old_identity_hashes_.Insert(obj, hash);
+    }
+  }
+
   intptr_t AllocateClassId();
   void RegisterClass(intptr_t cid, Behavior cls) {
     ASSERT((class_table_[cid] == static_cast<Object>(kUninitializedWord)) ||
@@ -317,6 +565,11 @@ class Heap {
   void InitializeAfterSnapshot();
 
   Interpreter* interpreter() const { return interpreter_; }
+  const GCPolicy& policy() const { return policy_; }
+
+  // Whether the heap kept growing past its hard limit after Newspeak was
+  // signalled, so signalling it did not help.
+  bool should_kill_isolate() const { return limit_state_ == kKillIsolate; }
 
   intptr_t handles() const { return handles_size_; }
   void set_handles(intptr_t value) { handles_size_ = value; }
@@ -336,21 +589,50 @@ class Heap {
   void ProcessTenureStack();
   bool ScavengePointers(Object* from, Object* to);
   void ScavengeOldObject(HeapObject obj);
+  void ScavengeCards(HeapObject obj);
   bool ScavengeClass(intptr_t cid);
+  bool ShouldScavengeInParallel(size_t new_size) const;
+  void SamplePretenuring(uword start, uword end);
+  static bool ShouldPretenure(size_t allocated, size_t survived);
+  // Arrays share a class but not a lifetime, so they are pretenured by size
+  // instead: by the highest bit of their heap size.
+  static intptr_t ArraySizeClass(size_t heap_size) {
+    return Utils::HighestBit(heap_size);
+  }
+  void SetAllocationLimit() {
+    limit_ = policy_.scavenge_every() != 0 ? 0 : end_;
+  }
 
   // Mark-sweep.
   void MarkSweep(Reason reason);
-  void MarkRoots();
-  void MarkObject(Object obj);
-  void ProcessMarkStack();
+  bool ShouldMarkInParallel(size_t old_size) const;
   void Sweep();
   bool SweepRegion(Region* region);
+  void DiscardFreeRange(Region* region, uword address, size_t size);
+  bool ShouldCompact() const;
+  void EvacuateSparseRegions();
+  void ForwardLiveObjects();
+  bool SweepNextRegion();
+  void FinishSweeping();
+  void ReleaseRegion(Region* region);
+  void ReleaseRegions();
+  void SetNextSemispaceCapacity(size_t survived, int64_t start, int64_t stop);
+  void SetOldGrowth(int64_t stop);
+  void CheckHeapLimit(size_t growth);
   void SetOldAllocationLimit();
 
+  // Incremental marking.
+  bool ShouldStartIncrementalMarking() const;
+  void StartIncrementalMarking();
+  void StopIncrementalMarking();
+  bool IncrementalMark(size_t budget);
+  void IncrementalMarkObject(HeapObject obj);
+  void IncrementalMarkPointers(Object* from, Object* to);
+  void FilterRememberedSet();
+
   // Ephemerons.
   void AddToEphemeronList(Ephemeron ephemeron_corpse);
   void ScavengeEphemeronList();
-  void MarkEphemeronList();
   void MournEphemeronList();
 
   // WeakArrays.
@@ -365,6 +647,22 @@ class Heap {
   void MournClassTableMarkSweep();
   void MournClassTableForwarded();
 
+  // Weak identity hash tables.
+  void ClearIdentityHash(HeapObject obj) {
+    if (obj->IsNewObject()) {
+      new_identity_hashes_.Remove(obj);
+    } else {
+      old_identity_hashes_.Remove(obj);
+    }
+  }
+  void MournIdentityHashesScavenge();
+  void MournIdentityHashesMarkSweep();
+  void ForwardIdentityHashes();
+
+  // Dies describing the first broken object, reference or remembered-set
+  // entry it finds.
+  void Verify(const char* when);
+
   // Become.
   void ForwardClassIds();
   void ForwardRoots();
@@ -374,7 +672,7 @@ class Heap {
     ASSERT(Utils::IsAligned(size, kObjectAlignment));
     if (size < kLargeAllocationSize) [[likely]] {
       uword result = top_;
-      if (result + size <= end_) [[likely]] {
+      if (result + size <= limit_) [[likely]] {
         top_ = result + size;
 #if defined(DEBUG)
         memset(reinterpret_cast<void*>(result), kUninitializedByte, size);
@@ -390,10 +688,20 @@ class Heap {
   uword AllocateSnapshot(size_t size);
   uword AllocateCopy(size_t size);
   uword AllocateTenure(size_t size);
+  uword AllocatePretenured(size_t size);
+  uword AllocateOldBuffered(size_t size);
+  bool RefillOldBuffer(size_t size);
   uword AllocateOldSmall(size_t size, GrowthPolicy growth);
+  uword AllocateOldSwept(size_t size, GrowthPolicy growth);
   uword AllocateOldLarge(size_t size, GrowthPolicy growth);
 
   Region* AllocateRegion(size_t region_size, GrowthPolicy growth);
+  // Calls visit(start, end) with the objects of each old-space region.
+  template <typename Visitor>
+  void VisitOldRegions(Visitor visit);
+  Region* TryAllocateReservedRegion();
+  bool IsReserved(Region* region) const;
+  void AdviseHeapMemory(VirtualMemory* memory);
 
 #if defined(DEBUG)
   bool InFromSpace(HeapObject obj) {
@@ -407,17 +715,51 @@ class Heap {
   // New space.
   uword top_;
   uword end_;
+  uword limit_;  // For the inline allocation path: end_, or 0 when stressed.
   uword survivor_end_;
   Semispace to_;
   Semispace from_;
   size_t next_semispace_capacity_;
+  bool new_space_discarded_;  // Since the last scavenge.
+  intptr_t gc_workers_;
+
+  // Sizing policy.
+  const GCPolicy policy_;
+  int64_t scavenge_pause_average_;
+  int64_t scavenge_interval_average_;
+  int64_t last_scavenge_end_;
+  int64_t mark_sweep_time_;  // Pauses and steps since the last mark-sweep.
+  int64_t last_mark_sweep_end_;
+  intptr_t old_growth_percent_;
+  enum LimitState { kWithinLimit, kOverLimit, kKillIsolate };
+  LimitState limit_state_;
+  intptr_t allocations_until_scavenge_;  // For --scavenge-every.
+  intptr_t safepoints_until_mark_sweep_;  // For --mark-sweep-every.
 
   // Old space.
   Region* regions_;
+  Region* large_regions_;  // Each holding a single large object.
+  Region* sweep_regions_;  // Marked but not yet swept.
+  Region* release_regions_;  // Empty, waiting to be unmapped.
   FreeList freelist_;
+  uword old_top_;  // Allocation buffer, for tenuring and pretenuring.
+  uword old_end_;
+  VirtualMemory reservation_;  // Regions are carved from here while it lasts.
+  uword reservation_top_;
+  uword* reserved_free_;  // Decommitted regions in the reservation.
+  intptr_t reserved_free_size_;
   size_t old_size_;
   size_t old_capacity_;
   size_t old_limit_;
+  size_t old_start_marking_;
+  size_t old_start_idle_marking_;
+
+  // Incremental marking.
+  bool incremental_marking_;
+  ObjectStack mark_stack_;
+  ObjectStack mark_deferred_;  // Weak arrays and ephemerons.
+  size_t marked_size_;
+  size_t old_size_at_last_step_;
 
   // Remembered set.
   HeapObject* remembered_set_;
@@ -429,6 +771,17 @@ class Heap {
   intptr_t class_table_size_;
   intptr_t class_table_capacity_;
   intptr_t class_table_free_;
+  uint8_t* pretenure_;  // By cid: allocate instances in old-space.
+  uint8_t pretenure_arrays_[kArraySizeClasses];  // By ArraySizeClass.
+  size_t* allocated_;  // By cid, while sampling.
+  size_t* survived_;
+  size_t arrays_allocated_[kArraySizeClasses];  // By ArraySizeClass.
+  size_t arrays_survived_[kArraySizeClasses];
+  intptr_t scavenge_count_;
+
+  // Identity hashes.
+  IdentityHashTable new_identity_hashes_;
+  IdentityHashTable old_identity_hashes_;
 
   // Roots.
   Interpreter* interpreter_;
@@ -440,6 +793,11 @@ class Heap {
   Ephemeron ephemeron_list_;
   WeakArray weak_list_;
 
+  friend class Marker;
+  friend class MarkerWorker;
+  friend class ParallelScavenger;
+  friend class ScavengerWorker;
+
   DISALLOW_COPY_AND_ASSIGN(Heap);
 };
 
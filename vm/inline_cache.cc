@@ -0,0 +1,82 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/inline_cache.h"
+
+namespace psoup {
+
+void InlineCache::Insert(const uint8_t* ip,
+                         Method caller,
+                         Behavior receiver_class,
+                         Object absent_receiver,
+                         Method target) {
+  // Scavenges would leave the table with stale references.
+  if (!caller->IsOldObject() || !caller->bytecode()->IsOldObject() ||
+      !receiver_class->IsOldObject() || !target->IsOldObject() ||
+      !absent_receiver->IsImmediateOrOldObject()) {
+    return;
+  }
+  intptr_t cid = receiver_class->id()->value();
+
+  Entry* set = &entries_[Hash(ip, caller)];
+  Entry* entry = nullptr;
+  for (intptr_t i = 0; i < kWays; i++) {
+    if (set[i].ip == ip && set[i].caller == caller) {
+      entry = &set[i];
+      break;
+    }
+  }
+  if (entry == nullptr) {
+    // Conflict with other send sites: evict one, unless both are polymorphic.
+    for (intptr_t i = 0; i < kWays; i++) {
+      if (set[i].ip == nullptr) {
+        entry = &set[i];
+        break;
+      }
+    }
+    if (entry == nullptr) {
+      for (intptr_t i = 0; i < kWays; i++) {
+        if (set[i].count <= 1) {
+          entry = &set[i];
+          break;
+        }
+      }
+      if (entry == nullptr) {
+        return;
+      }
+    }
+    entry->ip = ip;
+    entry->caller = caller;
+    entry->count = 0;
+    for (intptr_t i = 0; i < kPolymorphism; i++) {
+      entry->cids[i] = kIllegalCid;
+    }
+  } else if (entry->count == kMegamorphic) {
+    return;
+  }
+
+  intptr_t count = entry->count;
+  if (count == kPolymorphism) {
+    // Megamorphic: leave the site to the LookupCache.
+    entry->count = kMegamorphic;
+    return;
+  }
+  entry->cids[count] = cid;
+  entry->absent_receivers[count] = absent_receiver;
+  entry->targets[count] = target;
+  entry->count = count + 1;
+}
+
+void InlineCache::Clear() {
+  for (intptr_t i = 0; i < kSets * kWays; i++) {
+    entries_[i].ip = nullptr;
+    entries_[i].caller = nullptr;
+    entries_[i].count = 0;
+    for (intptr_t j = 0; j < kPolymorphism; j++) {
+      entries_[i].cids[j] = kIllegalCid;
+    }
+  }
+}
+
+}  // namespace psoup
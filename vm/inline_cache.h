@@ -0,0 +1,97 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_INLINE_CACHE_H_
+#define VM_INLINE_CACHE_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+
+namespace psoup {
+
+// Polymorphic inline caches for send sites. Methods have no slot the VM can
+// hang per-site state off of, so the caches live in a side table keyed by the
+// send's IP and the sending method. The method is part of the key because
+// identical bytecode arrays are shared between methods with different
+// literals, and because the outcome of a Newspeak send depends on the sender.
+//
+// An entry only ever sees one send site, so unlike the LookupCache it does not
+// need to compare selectors or lookup rules. Once a site has seen more than
+// kPolymorphism receiver classes it is megamorphic: sends of other classes
+// fall back to the LookupCache, and its entry is marked so that they do not
+// try to insert them again.
+//
+// The table is two-way set associative, and a site taking a way only evicts a
+// site that has seen one class or is megamorphic, so the state of polymorphic
+// sites, which is the most costly to rebuild, survives collisions. Entries
+// only refer to old-space objects, and only to the class ids of old-space
+// classes, which scavenges neither move nor free, so the table survives
+// scavenges and is only flushed by mark-sweep and become.
+class InlineCache {
+ public:
+  InlineCache() {
+    Clear();
+  }
+
+  INLINE
+  bool Lookup(const uint8_t* ip,
+              Method caller,
+              intptr_t cid,
+              Object* absent_receiver,
+              Method* target) {
+    Entry* entry = &entries_[Hash(ip, caller)];
+    if (entry->ip != ip || entry->caller != caller) {
+      entry++;
+      if (entry->ip != ip || entry->caller != caller) {
+        return false;
+      }
+    }
+    for (intptr_t i = 0; i < kPolymorphism; i++) {
+      if (entry->cids[i] == cid) {
+        *absent_receiver = entry->absent_receivers[i];
+        *target = entry->targets[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Insert(const uint8_t* ip,
+              Method caller,
+              Behavior receiver_class,
+              Object absent_receiver,
+              Method target);
+
+  void Clear();
+
+ private:
+  static constexpr intptr_t kPolymorphism = 4;
+  static constexpr intptr_t kMegamorphic = -1;  // An entry's count.
+
+  struct Entry {
+    const uint8_t* ip;
+    Method caller;
+    intptr_t count;  // Classes seen, or kMegamorphic.
+    intptr_t cids[kPolymorphism];  // kIllegalCid past count.
+    Object absent_receivers[kPolymorphism];
+    Method targets[kPolymorphism];
+  };
+
+  static constexpr intptr_t kWays = 2;
+  static constexpr intptr_t kSets = 1024;
+  static constexpr intptr_t kSetMask = kSets - 1;
+
+  // The first way of the site's set.
+  static intptr_t Hash(const uint8_t* ip, Method caller) {
+    return ((reinterpret_cast<uword>(ip)
+        ^ (static_cast<uword>(caller) >> kObjectAlignmentLog2)) & kSetMask)
+        * kWays;
+  }
+
+  Entry entries_[kSets * kWays];
+};
+
+}  // namespace psoup
+
+#endif  // VM_INLINE_CACHE_H_
@@ -7,8 +7,10 @@
 #include "vm/heap.h"
 #include "vm/isolate.h"
 #include "vm/math.h"
+#include "vm/message_loop.h"
 #include "vm/os.h"
 #include "vm/primitives.h"
+#include "vm/profiler.h"
 
 #define H heap_
 #define nil nil_
@@ -39,19 +41,45 @@ namespace psoup {
 // receiver is the receiver of the closure's home activation (i.e., the binding
 // of `self`).
 //
+// The frame flags hold the number of arguments, whether the frame is a closure
+// activation, and whether the frame's method is an exception handler,
+// unwind-protect or simulation root marker, so non-local return and handler
+// search can find such frames without decoding the method header of every frame
+// they cross.
+//
 // With saved FPs and frame flags being SmallIntegers, the only GC-unsafe values
 // on the stack are the saved IPs. Before GC, we swap the saved IPs with BCIs,
 // and after GC we swap back. This allows the GC to simply visit the whole
 // stack, and also accounts for bytecode arrays moving during GC.
 
+enum FrameMarker {
+  kNoMarker = 0,
+  kHandlerMarker = 1,
+  kUnwindProtectMarker = 2,
+  kSimulationRootMarker = 3,
+};
+
+static FrameMarker MarkerOf(intptr_t prim) {
+  if (Primitives::IsExceptionHandler(prim)) return kHandlerMarker;
+  if (Primitives::IsUnwindProtect(prim)) return kUnwindProtectMarker;
+  if (Primitives::IsSimulationRoot(prim)) return kSimulationRootMarker;
+  return kNoMarker;
+}
+
 static intptr_t FlagsNumArgs(SmallInteger flags) {
-  return flags->value() >> 1;
+  return flags->value() >> 3;
 }
 static bool FlagsIsClosure(SmallInteger flags) {
   return (flags->value() & 1) != 0;
 }
-static SmallInteger MakeFlags(intptr_t num_args, bool is_closure) {
-  return SmallInteger::New((num_args << 1) | (is_closure ? 1 : 0));
+static FrameMarker FlagsMarker(SmallInteger flags) {
+  return static_cast<FrameMarker>((flags->value() >> 1) & 3);
+}
+static SmallInteger MakeFlags(intptr_t num_args,
+                              bool is_closure,
+                              FrameMarker marker) {
+  return SmallInteger::New((num_args << 3) | (marker << 1) |
+                           (is_closure ? 1 : 0));
 }
 
 static const uint8_t* FrameSavedIP(Object* fp) {
@@ -122,30 +150,39 @@ static Activation FrameBaseSender(Object* fp) {
   return Activation::Cast(fp[1]);
 }
 
-Interpreter::Interpreter(Heap* heap, Isolate* isolate)
+Interpreter::Interpreter(Heap* heap, Isolate* isolate, size_t max_stack_size)
     : ip_(nullptr),
       sp_(nullptr),
       fp_(nullptr),
       stack_base_(nullptr),
       stack_limit_(nullptr),
+      stack_slots_(kInitialStackSlots),
+      max_stack_slots_(max_stack_size / sizeof(Object)),
       nil_(nullptr),
       false_(nullptr),
       true_(nullptr),
+      profile_samples_(nullptr),
       object_store_(nullptr),
       heap_(heap),
       isolate_(isolate),
-      environment_(nullptr) {
+      environment_(nullptr)
+#if BASELINE_JIT
+      , jit_(this)
+#endif
+{
   heap->InitializeInterpreter(this);
 
-  stack_limit_ = reinterpret_cast<Object*>(malloc(kStackSize));
-  stack_base_ = stack_limit_ + kStackSlots;
+  if (max_stack_slots_ < stack_slots_) {
+    max_stack_slots_ = stack_slots_;
+  }
+  stack_limit_ = reinterpret_cast<Object*>(
+      malloc(stack_slots_ * sizeof(Object)));
+  stack_base_ = stack_limit_ + stack_slots_;
   sp_ = stack_base_;
-  checked_stack_limit_.store(
-      reinterpret_cast<uword>(stack_limit_) + sizeof(Activation::Layout),
-      std::memory_order_relaxed);
+  checked_stack_limit_.store(OverflowLimit(), std::memory_order_relaxed);
 
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
+  for (intptr_t i = 0; i < stack_slots_; i++) {
     stack_limit_[i] = static_cast<Object>(kUninitializedWord);
   }
 #endif
@@ -155,35 +192,6 @@ Interpreter::~Interpreter() {
   free(stack_limit_);
 }
 
-void Interpreter::PushIndirectLocal(intptr_t vector_offset, intptr_t offset) {
-  Object vector = FrameLocal(fp_, vector_offset);
-  ASSERT(vector->IsArray());
-  Object temp = Array::Cast(vector)->element(offset);
-  Push(temp);
-}
-
-void Interpreter::PopIntoIndirectLocal(intptr_t vector_offset,
-                                       intptr_t offset) {
-  Object top = Pop();
-  Object vector = FrameLocal(fp_, vector_offset);
-  ASSERT(vector->IsArray());
-  Array::Cast(vector)->set_element(offset, top);
-}
-
-void Interpreter::StoreIntoIndirectLocal(intptr_t vector_offset,
-                                         intptr_t offset) {
-  Object top = Stack(0);
-  Object vector = FrameLocal(fp_, vector_offset);
-  ASSERT(vector->IsArray());
-  Array::Cast(vector)->set_element(offset, top);
-}
-
-void Interpreter::PushLiteral(intptr_t offset) {
-  Array literals = FrameMethod(fp_)->literals();
-  ASSERT((offset >= 0) && (offset < literals->Size()));
-  Push(literals->element(offset));
-}
-
 void Interpreter::PushEnclosingObject(intptr_t depth) {
   ASSERT(depth > 0);  // Compiler should have used push receiver.
 
@@ -316,10 +324,16 @@ void Interpreter::OrdinarySend(intptr_t selector_index, intptr_t num_args) {
 void Interpreter::OrdinarySend(String selector, intptr_t num_args) {
 #if LOOKUP_CACHE
   Object receiver = Stack(num_args);
+  Object absent_receiver;
   Method target;
-  if (lookup_cache_.LookupOrdinary(receiver->ClassId(),
-                                   selector,
-                                   &target)) [[likely]] {
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target) ||
+      LookupCacheOrdinary(receiver->ClassId(),
+                          selector,
+                          &target)) [[likely]] {
     Activate(target, num_args);  // SAFEPOINT
     return;
   }
@@ -355,6 +369,33 @@ void Interpreter::OrdinarySendMiss(String selector, intptr_t num_args) {
           present_receiver);  // SAFEPOINT
 }
 
+#if LOOKUP_CACHE
+bool Interpreter::LookupCacheOrdinary(intptr_t cid,
+                                      String selector,
+                                      Method* target) {
+  if (lookup_cache_.LookupOrdinary(cid, selector, target)) {
+    inline_cache_.Insert(ip_, FrameMethod(fp_), H->ClassAt(cid), Object(),
+                         *target);
+    return true;
+  }
+  return false;
+}
+
+bool Interpreter::LookupCacheNS(intptr_t cid,
+                                String selector,
+                                intptr_t rule,
+                                Object* absent_receiver,
+                                Method* target) {
+  if (lookup_cache_.LookupNS(cid, selector, FrameMethod(fp_), rule,
+                             absent_receiver, target)) {
+    inline_cache_.Insert(ip_, FrameMethod(fp_), H->ClassAt(cid),
+                         *absent_receiver, *target);
+    return true;
+  }
+  return false;
+}
+#endif
+
 Behavior Interpreter::FindApplicationOf(AbstractMixin mixin, Behavior klass) {
   while (klass->mixin() != mixin) {
     klass = klass->superclass();
@@ -372,12 +413,16 @@ void Interpreter::SuperSend(intptr_t selector_index, intptr_t num_args) {
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
-  if (lookup_cache_.LookupNS(receiver->ClassId(),
-                             selector,
-                             FrameMethod(fp_),
-                             kSuper,
-                             &absent_receiver,
-                             &target)) [[likely]] {
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target) ||
+      LookupCacheNS(receiver->ClassId(),
+                    selector,
+                    kSuper,
+                    &absent_receiver,
+                    &target)) [[likely]] {
     ASSERT(absent_receiver == nullptr);
     absent_receiver = receiver;
     ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
@@ -409,12 +454,16 @@ void Interpreter::ImplicitReceiverSend(intptr_t selector_index,
   Object method_receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
-  if (lookup_cache_.LookupNS(method_receiver->ClassId(),
-                             selector,
-                             FrameMethod(fp_),
-                             kImplicitReceiver,
-                             &absent_receiver,
-                             &target)) [[likely]] {
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           method_receiver->ClassId(),
+                           &absent_receiver,
+                           &target) ||
+      LookupCacheNS(method_receiver->ClassId(),
+                    selector,
+                    kImplicitReceiver,
+                    &absent_receiver,
+                    &target)) [[likely]] {
     if (absent_receiver == nullptr) {
       absent_receiver = method_receiver;
     }
@@ -464,12 +513,16 @@ void Interpreter::OuterSend(intptr_t selector_index,
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
-  if (lookup_cache_.LookupNS(receiver->ClassId(),
-                             selector,
-                             FrameMethod(fp_),
-                             depth,
-                             &absent_receiver,
-                             &target)) [[likely]] {
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target) ||
+      LookupCacheNS(receiver->ClassId(),
+                    selector,
+                    depth,
+                    &absent_receiver,
+                    &target)) [[likely]] {
     ASSERT(absent_receiver != nullptr);
     ActivateAbsent(target, absent_receiver, num_args);  // SAFEPOINT
     return;
@@ -501,12 +554,16 @@ void Interpreter::SelfSend(intptr_t selector_index, intptr_t num_args) {
   Object receiver = FrameReceiver(fp_);
   Object absent_receiver;
   Method target;
-  if (lookup_cache_.LookupNS(receiver->ClassId(),
-                             selector,
-                             FrameMethod(fp_),
-                             kSelf,
-                             &absent_receiver,
-                             &target)) [[likely]] {
+  if (inline_cache_.Lookup(ip_,
+                           FrameMethod(fp_),
+                           receiver->ClassId(),
+                           &absent_receiver,
+                           &target) ||
+      LookupCacheNS(receiver->ClassId(),
+                    selector,
+                    kSelf,
+                    &absent_receiver,
+                    &target)) [[likely]] {
     ASSERT(absent_receiver == nullptr);
     ActivateAbsent(target, receiver, num_args);  // SAFEPOINT
     return;
@@ -666,6 +723,28 @@ void Interpreter::EventualSend(intptr_t selector_index, intptr_t num_args) {
               3);  // SAFEPOINT
 }
 
+// Interrupts whatever is running when the heap passes its hard limit. There is
+// no send site to return a result to, so the handler must unwind instead of
+// returning. If the heap keeps growing after that, or the snapshot predates the
+// selector, the isolate is killed instead.
+void Interpreter::SendOutOfMemory() {
+  if (environment_ == nullptr) {
+    // Still activating a dispatch: wait for the interpreter to run it.
+    Interrupt(kInterruptOutOfMemory);
+    return;
+  }
+  Object selector = object_store()->out_of_memory();
+  if (heap_->should_kill_isolate() || (selector == nil)) {
+    OS::PrintErr("Out of memory\n");
+    ExitOutOfMemory();
+  }
+  Object message_loop = object_store()->message_loop();
+  Push(message_loop);
+  SendPrivate(message_loop->Klass(H),
+              String::Cast(selector),
+              0);  // SAFEPOINT
+}
+
 void Interpreter::SendPrivate(Behavior cls,
                               String selector,
                               intptr_t num_args) {
@@ -705,6 +784,7 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
   ASSERT(num_args == method->NumArgs());
 
   intptr_t prim = method->Primitive();
+  FrameMarker marker = kNoMarker;
   if (prim != 0) {
     if ((prim & 512) != 0) {
       // Getter
@@ -733,6 +813,7 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
         ASSERT(StackDepth() >= 0);
         return;
       }
+      marker = MarkerOf(prim);
     }
   }
 
@@ -741,7 +822,7 @@ void Interpreter::Activate(Method method, intptr_t num_args) {
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(ip_)));
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(fp_)));
   fp_ = sp_;
-  Push(MakeFlags(num_args, false));
+  Push(MakeFlags(num_args, false, marker));
   Push(method);
   Push(Object(static_cast<uword>(0)));  // Activation.
   Push(receiver);
@@ -761,17 +842,18 @@ void Interpreter::ActivateClosure(intptr_t num_args) {
   ASSERT(closure->num_args() == SmallInteger::New(num_args));
 
   Activation home = closure->defining_activation();
+  Method method = home->method();
 
   // Create frame.
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(ip_)));
   Push(static_cast<SmallInteger>(reinterpret_cast<uword>(fp_)));
   fp_ = sp_;
-  Push(MakeFlags(num_args, true));
-  Push(home->method());
+  Push(MakeFlags(num_args, true, MarkerOf(method->Primitive())));
+  Push(method);
   Push(Object(static_cast<uword>(0)));  // Activation.
   Push(home->receiver());
 
-  ip_ = home->method()->IP(closure->initial_bci());
+  ip_ = method->IP(closure->initial_bci());
 
   intptr_t num_copied = closure->NumCopied();
   for (intptr_t i = 0; i < num_copied; i++) {
@@ -814,7 +896,8 @@ void Interpreter::CreateBaseFrame(Activation activation) {
   Push(activation->sender());           // Base sender.
   Push(Object(static_cast<uword>(0)));  // Saved FP.
   fp_ = sp_;
-  Push(MakeFlags(num_args, is_closure));
+  Push(MakeFlags(num_args, is_closure,
+                 MarkerOf(activation->method()->Primitive())));
   Push(activation->method());
   Push(activation);
   Push(activation->receiver());
@@ -822,9 +905,10 @@ void Interpreter::CreateBaseFrame(Activation activation) {
   intptr_t num_temps = activation->StackDepth();
   for (intptr_t i = num_args; i < num_temps; i++) {
     Push(activation->temp(i));
+    // Drop temps. We don't update the activation as we store into the frame,
+    // so the stale references in the activation may create leaks.
+    activation->set_temp(i, nil, kNoBarrier);
   }
-  // Drop temps. We don't update the activation as we store into the frame, so
-  // the stale references in the activation may create leaks.
   activation->set_stack_depth(SmallInteger::New(num_args));
 
   ip_ = activation->method()->IP(activation->bci());
@@ -839,8 +923,7 @@ void Interpreter::CreateBaseFrame(Activation activation) {
 
 void Interpreter::StackOverflowOrInterrupt() {
   // Atomically fetch and clear any interrupts.
-  uword overflow_limit =
-      reinterpret_cast<uword>(stack_limit_) + sizeof(Activation::Layout);
+  uword overflow_limit = OverflowLimit();
   uword overflow_or_interrupt =
       checked_stack_limit_.exchange(overflow_limit, std::memory_order_relaxed);
 
@@ -853,11 +936,29 @@ void Interpreter::StackOverflowOrInterrupt() {
     heap_->RememberedSetInterrupt();  // SAFEPOINT
   }
 
-  if (reinterpret_cast<uword>(sp_) < overflow_limit) {
-    // Stack overflow: reclaim stack space by moving all frames except the top
-    // frame to the heap.
+  if ((overflow_or_interrupt & kInterruptIncrementalGC) != 0) {
+    heap_->IncrementalInterrupt();  // SAFEPOINT
+  }
+
+  if ((overflow_or_interrupt & kInterruptGCStress) != 0) {
+    heap_->StressInterrupt();  // SAFEPOINT
+  }
+
+  if ((overflow_or_interrupt & kInterruptProfile) != 0) {
+    RecordProfileSample();
+  }
+
+  if ((reinterpret_cast<uword>(sp_) < overflow_limit) &&
+      !GrowStack(overflow_limit)) {
+    // Stack overflow at the largest stack: reclaim stack space by moving all
+    // frames except the top frame to the heap.
     CreateBaseFrame(FlushAllFrames());  // SAFEPOINT
   }
+
+  // Last, since the handler does not return here.
+  if ((overflow_or_interrupt & kInterruptOutOfMemory) != 0) {
+    SendOutOfMemory();  // SAFEPOINT
+  }
 }
 
 String Interpreter::SelectorAt(intptr_t index) {
@@ -869,19 +970,6 @@ String Interpreter::SelectorAt(intptr_t index) {
   return String::Cast(selector);
 }
 
-void Interpreter::LocalReturn(Object result) {
-  Object* saved_fp = FrameSavedFP(fp_);
-  if (saved_fp == nullptr) [[unlikely]] {
-    LocalBaseReturn(result);  // SAFEPOINT
-    return;
-  }
-
-  ip_ = FrameSavedIP(fp_);
-  sp_ = FrameSavedSP(fp_);
-  fp_ = saved_fp;
-  Push(result);
-}
-
 void Interpreter::LocalBaseReturn(Object result) {
   // Returning from the base frame.
   Activation top;
@@ -919,26 +1007,28 @@ void Interpreter::NonLocalReturn(Object result) {
     c = home->closure();
   }
 
-  for (Object* fp = FrameSavedFP(fp_); fp != nullptr; fp = FrameSavedFP(fp)) {
-    if (FrameActivation(fp) == home) {
-      if (FrameSavedFP(fp) == nullptr) {
-        break;  // Return crosses base frame.
+  // The home activation was paired with a frame when the closure was created.
+  // If that frame is still living, it is on the stack below the current frame
+  // and the activation remembers its FP, so a home whose FP falls outside that
+  // range is known to need the slow path without walking the stack. Otherwise
+  // walk to it, checking only the frame flags for unwind markers.
+  if (home->sender()->IsSmallInteger()) {
+    Object* home_fp = home->sender_fp();
+    if ((home_fp > fp_) && (home_fp < stack_base_)) {
+      Object* fp = FrameSavedFP(fp_);
+      while ((fp != nullptr) && (fp < home_fp) &&
+             (FlagsMarker(FrameFlags(fp)) < kUnwindProtectMarker)) {
+        fp = FrameSavedFP(fp);
+      }
+      if ((fp == home_fp) && (FrameActivation(fp) == home) &&
+          (FrameSavedFP(fp) != nullptr)) {  // Else crosses base frame.
+        // Note this implicitly zaps every activation on the dynamic chain.
+        ip_ = FrameSavedIP(fp);
+        sp_ = FrameSavedSP(fp);
+        fp_ = FrameSavedFP(fp);
+        Push(result);
+        return;
       }
-
-      // Note this implicitly zaps every activation on the dynamic chain.
-      ip_ = FrameSavedIP(fp);
-      sp_ = FrameSavedSP(fp);
-      fp_ = FrameSavedFP(fp);
-      Push(result);
-      return;
-    }
-
-    intptr_t prim = FrameMethod(fp)->Primitive();
-    if (Primitives::IsUnwindProtect(prim)) {
-      break;
-    }
-    if (Primitives::IsSimulationRoot(prim)) {
-      break;
     }
   }
 
@@ -1022,8 +1112,18 @@ void Interpreter::Exit() {
   longjmp(*environment_, 1);
 }
 
+void Interpreter::ExitOutOfMemory() {
+  isolate_->set_exited_out_of_memory();
+  isolate_->loop()->Exit(-1);
+  Exit();
+}
+
 void Interpreter::ActivateDispatch(Method method, intptr_t num_args) {
   ASSERT(method->Primitive() == 0);
+  if (fp_ == nullptr) {
+    // The saved IP of a base frame is its base sender.
+    ip_ = reinterpret_cast<const uint8_t*>(static_cast<uword>(nil));
+  }
   Activate(method, num_args);
 }
 
@@ -1039,6 +1139,12 @@ void Interpreter::ReturnFromDispatch() {
       CreateBaseFrame(sender);
       return;
     }
+
+    // Not nil: ip_ is not visited by the GC, and nil may move.
+    ip_ = nullptr;
+    sp_ = FrameSavedSP(fp_);
+    fp_ = saved_fp;
+    return;
   }
 
   ip_ = FrameSavedIP(fp_);
@@ -1046,343 +1152,813 @@ void Interpreter::ReturnFromDispatch() {
   fp_ = saved_fp;
 }
 
+void Interpreter::RecordProfileSample() {
+  Profiler* profiler = isolate_->profiler();
+  ASSERT(profiler != nullptr);
+
+  // Method and SmallInteger (BCI << 1 | is closure) for each frame, top
+  // first. Nothing here allocates, so these stay valid until recorded.
+  Object frames[2 * Profiler::kMaxDepth];
+  intptr_t depth = 0;
+  Object* fp = fp_;
+  const uint8_t* ip = ip_;
+  while ((fp != nullptr) && (depth < Profiler::kMaxDepth)) {
+    Method method = FrameMethod(fp);
+    intptr_t bci = method->BCI(ip)->value();
+    bool is_closure = FlagsIsClosure(FrameFlags(fp));
+    frames[2 * depth] = method;
+    frames[2 * depth + 1] = SmallInteger::New((bci << 1) | is_closure);
+    depth++;
+    if (FrameSavedFP(fp) == nullptr) {
+      // Continue through the activations below the base frame.
+      Object sender = FrameBaseSender(fp);
+      while (sender->IsActivation() && (depth < Profiler::kMaxDepth)) {
+        Activation activation = Activation::Cast(sender);
+        SmallInteger sender_bci = activation->bci();
+        if ((activation->method() == nil) || !sender_bci->IsSmallInteger()) {
+          break;
+        }
+        frames[2 * depth] = activation->method();
+        frames[2 * depth + 1] = SmallInteger::New(
+            (sender_bci->value() << 1) | (activation->closure() != nil));
+        depth++;
+        sender = activation->sender();
+      }
+      break;
+    }
+    ip = FrameSavedIP(fp);
+    fp = FrameSavedFP(fp);
+  }
+
+  profiler->Record(depth, frames);
+}
+
 void Interpreter::PrintStack() {
   Activation top = FlushAllFrames();  // SAFEPOINT
   top->PrintStack(H);
   CreateBaseFrame(top);
 }
 
+#if QUICKENING
+// A SmallInteger comparison that is followed by a conditional jump is rewritten
+// on first execution into a private bytecode that performs both. The private
+// bytecodes have the same length as the ones they replace, so BCIs are
+// unaffected and the original bytecode can be restored exactly.
+static constexpr uint8_t kFirstQuickened = 208;
+static constexpr uint8_t kLastQuickened = 212;
+static constexpr uint8_t kQuickenedOffset = kFirstQuickened - 185;
+
+static bool IsPopJump(uint8_t byte) {
+  return ((byte >= 32) && (byte <= 63)) || (byte == 242) || (byte == 243);
+}
+
+static void Quicken(Method method, const uint8_t* ip) {
+  ByteArray bytecode = method->bytecode();
+  if (bytecode->is_pristine()) {
+    return;
+  }
+  intptr_t index = (ip - 1) - bytecode->element_addr(0);
+  uint8_t byte = bytecode->element(index);
+  ASSERT((byte >= 185) && (byte <= 189));
+  bytecode->set_element(index, byte + kQuickenedOffset);
+  bytecode->set_is_quickened(true);
+}
+
+static const uint8_t* QuickPopJump(const uint8_t* ip, bool condition) {
+  uint8_t byte1 = *ip++;
+  if (byte1 <= 63) {
+    ASSERT(byte1 >= 32);
+    if (condition == (byte1 <= 47)) {
+      ip += (byte1 & 15);
+    }
+  } else {
+    ASSERT((byte1 == 242) || (byte1 == 243));
+    uint8_t byte2 = *ip++;
+    uint8_t byte3 = *ip++;
+    if (condition == (byte1 == 242)) {
+      ip += (byte3 << 8) | byte2;
+    }
+  }
+  return ip;
+}
+#endif  // QUICKENING
+
+void Interpreter::Dequicken(Method method) {
+#if QUICKENING
+  if (method->Klass(H) != object_store()->Method()) {
+    return;
+  }
+  ByteArray bytecode = method->bytecode();
+  if (!bytecode->IsByteArray()) {
+    return;
+  }
+  EnsureDequickened(bytecode);
+  bytecode->set_is_pristine(true);
+#endif
+}
+
+void Interpreter::DequickenBytecode(ByteArray bytecode) {
+#if QUICKENING
+  ASSERT(bytecode->is_quickened());
+  intptr_t length = bytecode->Size();
+  intptr_t index = 0;
+  while (index < length) {
+    uint8_t byte = bytecode->element(index);
+    if ((byte >= kFirstQuickened) && (byte <= kLastQuickened)) {
+      bytecode->set_element(index, byte - kQuickenedOffset);
+    }
+    index += BytecodeSize(byte);
+  }
+  bytecode->set_is_quickened(false);
+  // Newspeak has seen these bytes, so they must not change under it again.
+  bytecode->set_is_pristine(true);
+#else
+  UNREACHABLE();
+#endif
+}
+
+#if THREADED_DISPATCH
+#define REPEAT2(x) x, x
+#define REPEAT4(x) REPEAT2(x), REPEAT2(x)
+#define REPEAT8(x) REPEAT4(x), REPEAT4(x)
+#define REPEAT16(x) REPEAT8(x), REPEAT8(x)
+// Each handler ends by fetching the next bytecode and jumping directly to its
+// handler. Compared to returning to the top of a switch, this avoids the bounds
+// check and gives each handler its own indirect branch for the predictor.
+#define DISPATCH_TARGET(name) name:
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    byte1 = *ip++;                                                             \
+    goto *kDispatchTable[byte1];                                               \
+  } while (false)
+#else
+#define DISPATCH_TARGET(name)
+#define DISPATCH() break
+#endif  // THREADED_DISPATCH
+
+// Interpret keeps ip, sp and fp in locals so the compiler can hold them in
+// registers instead of reloading and storing the members around every heap
+// access. The members are written back before calling anything that may use
+// them or reach a safepoint, and reloaded after.
+#define SAVE_STATE()                                                           \
+  do {                                                                         \
+    ip_ = ip;                                                                  \
+    sp_ = sp;                                                                  \
+    fp_ = fp;                                                                  \
+  } while (false)
+#if BASELINE_JIT
+// Whenever the interpreter's state comes back from a call, compiled code takes
+// over until it reaches a bytecode it leaves to the interpreter.
+#define LOAD_STATE()                                                           \
+  do {                                                                         \
+    jit_.Run();                                                                \
+    ip = ip_;                                                                  \
+    sp = sp_;                                                                  \
+    fp = fp_;                                                                  \
+  } while (false)
+#define ENTER_COMPILED_CODE()                                                  \
+  do {                                                                         \
+    SAVE_STATE();                                                              \
+    LOAD_STATE();                                                              \
+  } while (false)
+#else
+#define LOAD_STATE()                                                           \
+  do {                                                                         \
+    ip = ip_;                                                                  \
+    sp = sp_;                                                                  \
+    fp = fp_;                                                                  \
+  } while (false)
+#define ENTER_COMPILED_CODE()
+#endif  // BASELINE_JIT
+#define STACK_DEPTH() (&fp[-4] - sp)
+#define PUSH(value)                                                            \
+  do {                                                                         \
+    Object pushed = (value);                                                   \
+    ASSERT(sp <= stack_base_);                                                 \
+    ASSERT(sp > stack_limit_);                                                 \
+    *--sp = pushed;                                                            \
+  } while (false)
+#define POP() (*sp++)
+#define STACK(depth) (sp[depth])
+#define DROP(n) (sp += (n))
+#define POP_N_AND_PUSH(n, value)                                               \
+  do {                                                                         \
+    sp += (n) - 1;                                                             \
+    *sp = (value);                                                             \
+  } while (false)
+#define LOCAL_RETURN(value)                                                    \
+  do {                                                                         \
+    Object result = (value);                                                   \
+    Object* saved_fp = FrameSavedFP(fp);                                       \
+    if (saved_fp == nullptr) [[unlikely]] {                                    \
+      SAVE_STATE();                                                            \
+      LocalBaseReturn(result);  /* SAFEPOINT */                                \
+      LOAD_STATE();                                                            \
+    } else {                                                                   \
+      ip = FrameSavedIP(fp);                                                   \
+      sp = FrameSavedSP(fp);                                                   \
+      fp = saved_fp;                                                           \
+      PUSH(result);                                                            \
+      ENTER_COMPILED_CODE();                                                   \
+    }                                                                          \
+  } while (false)
+
 void Interpreter::Interpret() {
+#if THREADED_DISPATCH
+  static const void* const kDispatchTable[] = {
+    REPEAT16(&&ShortJumpBackward),  // 0-15
+    REPEAT16(&&ShortJumpForward),  // 16-31
+    REPEAT16(&&ShortPopJumpTrue),  // 32-47
+    REPEAT16(&&ShortPopJumpFalse),  // 48-63
+    REPEAT16(&&ShortOrdinarySend),  // 64-79
+    REPEAT16(&&ShortSelfSend),  // 80-95
+    REPEAT16(&&ShortImplicitReceiverSend),  // 96-111
+    REPEAT8(&&ShortPushParameter),  // 112-119
+    REPEAT8(&&ShortPushLocal),  // 120-127
+    REPEAT8(&&ShortPopIntoLocal),  // 128-135
+    REPEAT8(&&ShortStoreIntoLocal),  // 136-143
+    REPEAT8(&&ShortPushLiteral),  // 144-151
+    &&PushNil,  // 152
+    &&PushFalse,
+    &&PushTrue,
+    &&PushReceiver,
+    &&PushMixin,
+    &&UnusedBytecode,
+    &&Pop,
+    &&Dup,
+    &&PushMinusOne,  // 160
+    &&PushZero,
+    &&PushOne,
+    &&PushTwo,
+    &&UnusedBytecode,
+    &&UnusedBytecode,
+    &&ReturnNil,
+    &&ReturnFalse,
+    &&ReturnTrue,
+    &&ReturnReceiver,
+    &&ReturnTop,  // 170
+    &&NonLocalReturnNil,
+    &&NonLocalReturnFalse,
+    &&NonLocalReturnTrue,
+    &&NonLocalReturnReceiver,
+    &&NonLocalReturnTop,
+#if STATIC_PREDICTION_BYTECODES
+    &&Add,  // 176
+    &&Subtract,
+    &&Multiply,
+    &&Divide,
+    &&Modulo,  // 180
+    &&ShiftLeft,
+    &&ShiftRight,
+    &&BitAnd,
+    &&BitOr,
+    &&Less,
+    &&Greater,
+    &&LessOrEqual,
+    &&GreaterOrEqual,
+    &&Equal,
+    &&New,  // 190
+    &&NewColon,
+    &&At,
+    &&AtPut,
+    &&Size,
+    &&CommonSendDispatch,
+    REPEAT4(&&CommonSendDispatch),  // 196-199
+    REPEAT8(&&CommonSendDispatch),  // 200-207
+#else
+    REPEAT16(&&CommonSendDispatch),  // 176-191
+    REPEAT16(&&CommonSendDispatch),  // 192-207
+#endif
+#if QUICKENING
+    &&QuickLessJump,  // 208
+    &&QuickGreaterJump,
+    &&QuickLessOrEqualJump,  // 210
+    &&QuickGreaterOrEqualJump,
+    &&QuickEqualJump,
+    REPEAT2(&&UnusedBytecode),  // 213-214
+    &&UnusedBytecode,  // 215
+#else
+    REPEAT8(&&UnusedBytecode),  // 208-215
+#endif
+    REPEAT4(&&UnusedBytecode),  // 216-219
+    REPEAT2(&&UnusedBytecode),  // 220-221
+    &&PushNewArray,  // 222
+    &&PushNewArrayWithElements,
+    REPEAT4(&&UnusedBytecode),  // 224-227
+    &&LongPushParameter,  // 228
+    &&LongPushLocal,
+    &&LongPopIntoLocal,  // 230
+    &&LongStoreIntoLocal,
+    &&UnusedBytecode,
+    &&PushEnclosingObject,
+    REPEAT4(&&UnusedBytecode),  // 234-237
+    &&UnusedBytecode,  // 238
+    &&EventualSend,
+    &&LongJumpBackward,  // 240
+    &&LongJumpForward,
+    &&LongPopJumpTrue,
+    &&LongPopJumpFalse,
+    &&UnusedBytecode,
+    &&PushIndirectLocal,
+    &&PopIntoIndirectLocal,
+    &&StoreIntoIndirectLocal,
+    &&LongPushLiteral,
+    &&PushInteger,
+    &&LongOrdinarySend,  // 250
+    &&LongSelfSend,
+    &&SuperSend,
+    &&LongImplicitReceiverSend,
+    &&OuterSend,
+    &&PushClosure,  // 255
+  };
+  COMPILE_ASSERT(sizeof(kDispatchTable) == 256 * sizeof(void*));
+#endif  // THREADED_DISPATCH
+
+  const uint8_t* ip = ip_;
+  Object* sp = sp_;
+  Object* fp = fp_;
+  uint8_t byte1;
+  ENTER_COMPILED_CODE();
   for (;;) {
-    ASSERT(ip_ != nullptr);
-    ASSERT(sp_ != nullptr);
-    ASSERT(fp_ != nullptr);
+    ASSERT(ip != nullptr);
+    ASSERT(sp != nullptr);
+    ASSERT(fp != nullptr);
 
-    uint8_t byte1 = *ip_++;
+    byte1 = *ip++;
     switch (byte1) {
     case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
     case 8: case 9: case 10: case 11: case 12: case 13: case 14: case 15:
-      ip_ -= (byte1 & 15);
-      StackOverflowOrInterruptCheck();  // SAFEPOINT
-      break;
+    DISPATCH_TARGET(ShortJumpBackward)
+      ip -= (byte1 & 15);
+      if (reinterpret_cast<uword>(sp) <
+          checked_stack_limit_.load(std::memory_order_relaxed)) [[unlikely]] {
+        SAVE_STATE();
+        StackOverflowOrInterrupt();  // SAFEPOINT
+        LOAD_STATE();
+      } else {
+        ENTER_COMPILED_CODE();
+      }
+      DISPATCH();
     case 16: case 17: case 18: case 19: case 20: case 21: case 22: case 23:
     case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31:
-      ip_ += (byte1 & 15);
-      break;
+    DISPATCH_TARGET(ShortJumpForward)
+      ip += (byte1 & 15);
+      DISPATCH();
     case 32: case 33: case 34: case 35: case 36: case 37: case 38: case 39:
     case 40: case 41: case 42: case 43: case 44: case 45: case 46: case 47: {
-      Object top = Pop();
+    DISPATCH_TARGET(ShortPopJumpTrue)
+      Object top = POP();
       if (top == true_) {
-        ip_ += (byte1 & 15);
+        ip += (byte1 & 15);
       } else if (top != false_) [[unlikely]] {
+        SAVE_STATE();
         SendNonBooleanReceiver(top);
+        LOAD_STATE();
       }
-      break;
+      DISPATCH();
     }
     case 48: case 49: case 50: case 51: case 52: case 53: case 54: case 55:
     case 56: case 57: case 58: case 59: case 60: case 61: case 62: case 63: {
-      Object top = Pop();
+    DISPATCH_TARGET(ShortPopJumpFalse)
+      Object top = POP();
       if (top == false_) {
-        ip_ += (byte1 & 15);
+        ip += (byte1 & 15);
       } else if (top != true_) [[unlikely]] {
+        SAVE_STATE();
         SendNonBooleanReceiver(top);
+        LOAD_STATE();
       }
-      break;
+      DISPATCH();
     }
     case 64: case 65: case 66: case 67:
     case 68: case 69: case 70: case 71:
     case 72: case 73: case 74: case 75:
     case 76: case 77: case 78: case 79:
+    DISPATCH_TARGET(ShortOrdinarySend)
+      SAVE_STATE();
       OrdinarySend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     case 80: case 81: case 82: case 83:
     case 84: case 85: case 86: case 87:
     case 88: case 89: case 90: case 91:
     case 92: case 93: case 94: case 95:
+    DISPATCH_TARGET(ShortSelfSend)
+      SAVE_STATE();
       SelfSend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     case 96: case 97: case 98: case 99:
     case 100: case 101: case 102: case 103:
     case 104: case 105: case 106: case 107:
     case 108: case 109: case 110: case 111:
+    DISPATCH_TARGET(ShortImplicitReceiverSend)
+      SAVE_STATE();
       ImplicitReceiverSend(byte1 & 7, (byte1 >> 3) & 1);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     case 112: case 113: case 114: case 115:
     case 116: case 117: case 118: case 119:
-      Push(FrameParameter(fp_, byte1 & 7));
-      break;
+    DISPATCH_TARGET(ShortPushParameter)
+      PUSH(FrameParameter(fp, byte1 & 7));
+      DISPATCH();
     case 120: case 121: case 122: case 123:
     case 124: case 125: case 126: case 127:
-      Push(FrameLocal(fp_, byte1 & 7));
-      break;
+    DISPATCH_TARGET(ShortPushLocal)
+      PUSH(FrameLocal(fp, byte1 & 7));
+      DISPATCH();
     case 128: case 129: case 130: case 131:
     case 132: case 133: case 134: case 135:
-      FrameLocalPut(fp_, byte1 & 7, Pop());
-      break;
+    DISPATCH_TARGET(ShortPopIntoLocal)
+      FrameLocalPut(fp, byte1 & 7, POP());
+      DISPATCH();
     case 136: case 137: case 138: case 139:
     case 140: case 141: case 142: case 143:
-      FrameLocalPut(fp_, byte1 & 7, Stack(0));
-      break;
+    DISPATCH_TARGET(ShortStoreIntoLocal)
+      FrameLocalPut(fp, byte1 & 7, STACK(0));
+      DISPATCH();
     case 144: case 145: case 146: case 147:
     case 148: case 149: case 150: case 151:
-      PushLiteral(byte1 & 7);
-      break;
-    case 152: Push(nil_); break;
-    case 153: Push(false_); break;
-    case 154: Push(true_); break;
-    case 155: Push(FrameReceiver(fp_)); break;
-    case 156: Push(FrameMethod(fp_)->mixin()); break;
-    case 158: Pop(); break;
-    case 159: Push(Stack(0)); break;
-    case 160: Push(SmallInteger::New(-1)); break;
-    case 161: Push(SmallInteger::New(0)); break;
-    case 162: Push(SmallInteger::New(1)); break;
-    case 163: Push(SmallInteger::New(2)); break;
-    case 166: LocalReturn(nil_); break;
-    case 167: LocalReturn(false_); break;
-    case 168: LocalReturn(true_); break;
-    case 169: LocalReturn(FrameReceiver(fp_)); break;
-    case 170: LocalReturn(Pop()); break;
-    case 171: NonLocalReturn(nil_); break;
-    case 172: NonLocalReturn(false_); break;
-    case 173: NonLocalReturn(true_); break;
-    case 174: NonLocalReturn(FrameReceiver(fp_)); break;
-    case 175: NonLocalReturn(Pop()); break;
+    DISPATCH_TARGET(ShortPushLiteral)
+      PUSH(FrameMethod(fp)->literals()->element(byte1 & 7));
+      DISPATCH();
+    case 152:
+    DISPATCH_TARGET(PushNil)
+      PUSH(nil_);
+      DISPATCH();
+    case 153:
+    DISPATCH_TARGET(PushFalse)
+      PUSH(false_);
+      DISPATCH();
+    case 154:
+    DISPATCH_TARGET(PushTrue)
+      PUSH(true_);
+      DISPATCH();
+    case 155:
+    DISPATCH_TARGET(PushReceiver)
+      PUSH(FrameReceiver(fp));
+      DISPATCH();
+    case 156:
+    DISPATCH_TARGET(PushMixin)
+      PUSH(FrameMethod(fp)->mixin());
+      DISPATCH();
+    case 158:
+    DISPATCH_TARGET(Pop)
+      DROP(1);
+      DISPATCH();
+    case 159:
+    DISPATCH_TARGET(Dup)
+      PUSH(STACK(0));
+      DISPATCH();
+    case 160:
+    DISPATCH_TARGET(PushMinusOne)
+      PUSH(SmallInteger::New(-1));
+      DISPATCH();
+    case 161:
+    DISPATCH_TARGET(PushZero)
+      PUSH(SmallInteger::New(0));
+      DISPATCH();
+    case 162:
+    DISPATCH_TARGET(PushOne)
+      PUSH(SmallInteger::New(1));
+      DISPATCH();
+    case 163:
+    DISPATCH_TARGET(PushTwo)
+      PUSH(SmallInteger::New(2));
+      DISPATCH();
+    case 166:
+    DISPATCH_TARGET(ReturnNil)
+      LOCAL_RETURN(nil_);
+      DISPATCH();
+    case 167:
+    DISPATCH_TARGET(ReturnFalse)
+      LOCAL_RETURN(false_);
+      DISPATCH();
+    case 168:
+    DISPATCH_TARGET(ReturnTrue)
+      LOCAL_RETURN(true_);
+      DISPATCH();
+    case 169:
+    DISPATCH_TARGET(ReturnReceiver)
+      LOCAL_RETURN(FrameReceiver(fp));
+      DISPATCH();
+    case 170:
+    DISPATCH_TARGET(ReturnTop)
+      LOCAL_RETURN(POP());
+      DISPATCH();
+    case 171:
+    DISPATCH_TARGET(NonLocalReturnNil)
+      SAVE_STATE();
+      NonLocalReturn(nil_);
+      LOAD_STATE();
+      DISPATCH();
+    case 172:
+    DISPATCH_TARGET(NonLocalReturnFalse)
+      SAVE_STATE();
+      NonLocalReturn(false_);
+      LOAD_STATE();
+      DISPATCH();
+    case 173:
+    DISPATCH_TARGET(NonLocalReturnTrue)
+      SAVE_STATE();
+      NonLocalReturn(true_);
+      LOAD_STATE();
+      DISPATCH();
+    case 174:
+    DISPATCH_TARGET(NonLocalReturnReceiver)
+      SAVE_STATE();
+      NonLocalReturn(FrameReceiver(fp));
+      LOAD_STATE();
+      DISPATCH();
+    case 175:
+    DISPATCH_TARGET(NonLocalReturnTop)
+      SAVE_STATE();
+      NonLocalReturn(POP());
+      LOAD_STATE();
+      DISPATCH();
 #if STATIC_PREDICTION_BYTECODES
-    case 176: {
+    case 176:
+    DISPATCH_TARGET(Add) {
       // +
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
         intptr_t raw_left = static_cast<intptr_t>(left);
         intptr_t raw_right = static_cast<intptr_t>(right);
         intptr_t raw_result;
         if (!Math::AddHasOverflow(raw_left, raw_right, &raw_result)) {
-          PopNAndPush(2, static_cast<SmallInteger>(raw_result));
-          break;
+          POP_N_AND_PUSH(2, static_cast<SmallInteger>(raw_result));
+          DISPATCH();
         }
       }
       goto CommonSendDispatch;
     }
-    case 177: {
+    case 177:
+    DISPATCH_TARGET(Subtract) {
       // -
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
         intptr_t raw_left = static_cast<intptr_t>(left);
         intptr_t raw_right = static_cast<intptr_t>(right);
         intptr_t raw_result;
         if (!Math::SubtractHasOverflow(raw_left, raw_right, &raw_result)) {
-          PopNAndPush(2, static_cast<SmallInteger>(raw_result));
-          break;
+          POP_N_AND_PUSH(2, static_cast<SmallInteger>(raw_result));
+          DISPATCH();
         }
       }
       goto CommonSendDispatch;
     }
-    case 178: {
+    case 178:
+    DISPATCH_TARGET(Multiply) {
       // *
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
         intptr_t raw_left = static_cast<intptr_t>(left);
         intptr_t raw_right = static_cast<intptr_t>(right) >> kSmiTagShift;
         intptr_t raw_result;
         if (!Math::MultiplyHasOverflow(raw_left, raw_right, &raw_result)) {
-          PopNAndPush(2, static_cast<SmallInteger>(raw_result));
-          break;
+          POP_N_AND_PUSH(2, static_cast<SmallInteger>(raw_result));
+          DISPATCH();
         }
       }
       goto CommonSendDispatch;
     }
-    case 179: {
+    case 179:
+    DISPATCH_TARGET(Divide) {
       // //
       goto CommonSendDispatch;
     }
-    case 180: {
+    case 180:
+    DISPATCH_TARGET(Modulo) {
       /* \\ */
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
         intptr_t raw_left = SmallInteger::Cast(left)->value();
         intptr_t raw_right = SmallInteger::Cast(right)->value();
         if (raw_right != 0) {
           intptr_t raw_result = Math::FloorMod(raw_left, raw_right);
           ASSERT(SmallInteger::IsSmiValue(raw_result));
-          PopNAndPush(2, SmallInteger::New(raw_result));
-          break;
+          POP_N_AND_PUSH(2, SmallInteger::New(raw_result));
+          DISPATCH();
         }
       }
       goto CommonSendDispatch;
     }
-    case 181: {
+    case 181:
+    DISPATCH_TARGET(ShiftLeft) {
       // <<
       goto CommonSendDispatch;
     }
-    case 182: {
+    case 182:
+    DISPATCH_TARGET(ShiftRight) {
       // >>
       goto CommonSendDispatch;
     }
-    case 183: {
+    case 183:
+    DISPATCH_TARGET(BitAnd) {
       // &
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
-        PopNAndPush(2, static_cast<SmallInteger>(static_cast<intptr_t>(left) &
-                                                 static_cast<intptr_t>(right)));
-        break;
+        intptr_t result = static_cast<intptr_t>(left) &
+                          static_cast<intptr_t>(right);
+        POP_N_AND_PUSH(2, static_cast<SmallInteger>(result));
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 184: {
+    case 184:
+    DISPATCH_TARGET(BitOr) {
       // |
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
-        PopNAndPush(2, static_cast<SmallInteger>(static_cast<intptr_t>(left) |
-                                                 static_cast<intptr_t>(right)));
-        break;
+        intptr_t result = static_cast<intptr_t>(left) |
+                          static_cast<intptr_t>(right);
+        POP_N_AND_PUSH(2, static_cast<SmallInteger>(result));
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 185: {
+    case 185:
+    DISPATCH_TARGET(Less) {
       // <
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
+#if QUICKENING
+        if (IsPopJump(*ip)) {
+          Quicken(FrameMethod(fp), ip);
+        }
+#endif
         if (static_cast<intptr_t>(left) < static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
+          POP_N_AND_PUSH(2, true_);
         } else {
-          PopNAndPush(2, false_);
+          POP_N_AND_PUSH(2, false_);
         }
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 186: {
+    case 186:
+    DISPATCH_TARGET(Greater) {
       // >
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
+#if QUICKENING
+        if (IsPopJump(*ip)) {
+          Quicken(FrameMethod(fp), ip);
+        }
+#endif
         if (static_cast<intptr_t>(left) > static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
+          POP_N_AND_PUSH(2, true_);
         } else {
-          PopNAndPush(2, false_);
+          POP_N_AND_PUSH(2, false_);
         }
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 187: {
+    case 187:
+    DISPATCH_TARGET(LessOrEqual) {
       // <=
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
+#if QUICKENING
+        if (IsPopJump(*ip)) {
+          Quicken(FrameMethod(fp), ip);
+        }
+#endif
         if (static_cast<intptr_t>(left) <= static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
+          POP_N_AND_PUSH(2, true_);
         } else {
-          PopNAndPush(2, false_);
+          POP_N_AND_PUSH(2, false_);
         }
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 188: {
+    case 188:
+    DISPATCH_TARGET(GreaterOrEqual) {
       // >=
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
+#if QUICKENING
+        if (IsPopJump(*ip)) {
+          Quicken(FrameMethod(fp), ip);
+        }
+#endif
         if (static_cast<intptr_t>(left) >= static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
+          POP_N_AND_PUSH(2, true_);
         } else {
-          PopNAndPush(2, false_);
+          POP_N_AND_PUSH(2, false_);
         }
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 189: {
+    case 189:
+    DISPATCH_TARGET(Equal) {
       // =
-      Object left = Stack(1);
-      Object right = Stack(0);
+      Object left = STACK(1);
+      Object right = STACK(0);
       if (Object::BothSmallIntegers(left, right)) {
+#if QUICKENING
+        if (IsPopJump(*ip)) {
+          Quicken(FrameMethod(fp), ip);
+        }
+#endif
         if (static_cast<intptr_t>(left) == static_cast<intptr_t>(right)) {
-          PopNAndPush(2, true_);
+          POP_N_AND_PUSH(2, true_);
         } else {
-          PopNAndPush(2, false_);
+          POP_N_AND_PUSH(2, false_);
         }
-        break;
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
-    case 190: {
+    case 190:
+    DISPATCH_TARGET(New) {
       // new
       goto CommonSendDispatch;
     }
-    case 191: {
+    case 191:
+    DISPATCH_TARGET(NewColon) {
       // new:
       goto CommonSendDispatch;
     }
-    case 192: {
+    case 192:
+    DISPATCH_TARGET(At) {
       // at:
-      Object array = Stack(1);
-      SmallInteger index = SmallInteger::Cast(Stack(0));
+      Object array = STACK(1);
+      SmallInteger index = SmallInteger::Cast(STACK(0));
       if (index->IsSmallInteger()) {
         intptr_t raw_index = index->value() - 1;
         if (array->IsArray()) {
           if ((raw_index >= 0) &&
               (raw_index < Array::Cast(array)->Size())) [[likely]] {
             Object value = Array::Cast(array)->element(raw_index);
-            PopNAndPush(2, value);
-            break;
+            POP_N_AND_PUSH(2, value);
+            DISPATCH();
           }
         } else if (array->IsBytes()) {
           if ((raw_index >= 0) &&
               (raw_index < Bytes::Cast(array)->Size())) [[likely]] {
+            EnsureDequickened(array);
             uint8_t raw_value = Bytes::Cast(array)->element(raw_index);
-            PopNAndPush(2, SmallInteger::New(raw_value));
-            break;
+            POP_N_AND_PUSH(2, SmallInteger::New(raw_value));
+            DISPATCH();
           }
         }
       }
       goto CommonSendDispatch;
     }
-    case 193: {
+    case 193:
+    DISPATCH_TARGET(AtPut) {
       // at:put:
-      Object array = Stack(2);
-      SmallInteger index = SmallInteger::Cast(Stack(1));
+      Object array = STACK(2);
+      SmallInteger index = SmallInteger::Cast(STACK(1));
       if (index->IsSmallInteger()) {
         intptr_t raw_index = index->value() - 1;
         if (array->IsArray()) {
           if ((raw_index >= 0) &&
               (raw_index < Array::Cast(array)->Size())) [[likely]] {
-            Object value = Stack(0);
+            Object value = STACK(0);
             Array::Cast(array)->set_element(raw_index, value);
-            PopNAndPush(3, value);
-            break;
+            POP_N_AND_PUSH(3, value);
+            DISPATCH();
           }
         } else if (array->IsByteArray()) {
-          SmallInteger value = SmallInteger::Cast(Stack(0));
+          SmallInteger value = SmallInteger::Cast(STACK(0));
           if ((raw_index >= 0) &&
               (raw_index < ByteArray::Cast(array)->Size()) &&
               SmallInteger::IsByte(value)) [[likely]] {
+            EnsureDequickened(array);
             ByteArray::Cast(array)->set_element(
                 raw_index, SmallInteger::Byte(value));
-            PopNAndPush(3, value);
-            break;
+            POP_N_AND_PUSH(3, value);
+            DISPATCH();
           }
         }
       }
       goto CommonSendDispatch;
     }
-    case 194: {
+    case 194:
+    DISPATCH_TARGET(Size) {
       // size
-      Object array = Stack(0);
+      Object array = STACK(0);
       if (array->IsArray()) {
-        PopNAndPush(1, Array::Cast(array)->size());
-        break;
+        POP_N_AND_PUSH(1, Array::Cast(array)->size());
+        DISPATCH();
       } else if (array->IsBytes()) {
-        PopNAndPush(1, Bytes::Cast(array)->size());
-        break;
+        POP_N_AND_PUSH(1, Bytes::Cast(array)->size());
+        DISPATCH();
       }
       goto CommonSendDispatch;
     }
@@ -1391,8 +1967,10 @@ void Interpreter::Interpret() {
     case 200: case 201: case 202: case 203:
     case 204: case 205: case 206: case 207:
       CommonSendDispatch:
+      SAVE_STATE();
       CommonSend(byte1 - 176);
-      break;
+      LOAD_STATE();
+      DISPATCH();
 #else  // !STATIC_PREDICTION_BYTECODES
     case 176: case 177: case 178: case 179:
     case 180: case 181: case 182: case 183:
@@ -1402,182 +1980,433 @@ void Interpreter::Interpret() {
     case 196: case 197: case 198: case 199:
     case 200: case 201: case 202: case 203:
     case 204: case 205: case 206: case 207:
+    DISPATCH_TARGET(CommonSendDispatch)
+      SAVE_STATE();
       CommonSend(byte1 - 176);
-      break;
+      LOAD_STATE();
+      DISPATCH();
 #endif  // STATIC_PREDICTION_BYTECODES
-    case 222: {
-      uint8_t byte2 = *ip_++;
-      PushNewArray(byte2);
-      break;
+#if QUICKENING
+    case 208:
+    DISPATCH_TARGET(QuickLessJump) {
+      // <, then a conditional jump
+      Object left = STACK(1);
+      Object right = STACK(0);
+      if (Object::BothSmallIntegers(left, right)) {
+        DROP(2);
+        ip = QuickPopJump(ip, static_cast<intptr_t>(left) <
+                              static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      byte1 -= kQuickenedOffset;
+      goto CommonSendDispatch;
     }
-    case 223: {
-      uint8_t byte2 = *ip_++;
-      PushNewArrayWithElements(byte2);
-      break;
+    case 209:
+    DISPATCH_TARGET(QuickGreaterJump) {
+      // >, then a conditional jump
+      Object left = STACK(1);
+      Object right = STACK(0);
+      if (Object::BothSmallIntegers(left, right)) {
+        DROP(2);
+        ip = QuickPopJump(ip, static_cast<intptr_t>(left) >
+                              static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      byte1 -= kQuickenedOffset;
+      goto CommonSendDispatch;
     }
-    case 228: {
-      uint8_t byte2 = *ip_++;
-      Push(FrameParameter(fp_, byte2));
-      break;
+    case 210:
+    DISPATCH_TARGET(QuickLessOrEqualJump) {
+      // <=, then a conditional jump
+      Object left = STACK(1);
+      Object right = STACK(0);
+      if (Object::BothSmallIntegers(left, right)) {
+        DROP(2);
+        ip = QuickPopJump(ip, static_cast<intptr_t>(left) <=
+                              static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      byte1 -= kQuickenedOffset;
+      goto CommonSendDispatch;
     }
-    case 229: {
-      uint8_t byte2 = *ip_++;
-      ASSERT(byte2 < StackDepth());
-      Push(FrameLocal(fp_, byte2));
-      break;
+    case 211:
+    DISPATCH_TARGET(QuickGreaterOrEqualJump) {
+      // >=, then a conditional jump
+      Object left = STACK(1);
+      Object right = STACK(0);
+      if (Object::BothSmallIntegers(left, right)) {
+        DROP(2);
+        ip = QuickPopJump(ip, static_cast<intptr_t>(left) >=
+                              static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      byte1 -= kQuickenedOffset;
+      goto CommonSendDispatch;
     }
-    case 230: {
-      uint8_t byte2 = *ip_++;
-      ASSERT(byte2 < StackDepth());
-      FrameLocalPut(fp_, byte2, Pop());
-      break;
+    case 212:
+    DISPATCH_TARGET(QuickEqualJump) {
+      // =, then a conditional jump
+      Object left = STACK(1);
+      Object right = STACK(0);
+      if (Object::BothSmallIntegers(left, right)) {
+        DROP(2);
+        ip = QuickPopJump(ip, static_cast<intptr_t>(left) ==
+                              static_cast<intptr_t>(right));
+        DISPATCH();
+      }
+      byte1 -= kQuickenedOffset;
+      goto CommonSendDispatch;
     }
-    case 231: {
-      uint8_t byte2 = *ip_++;
-      ASSERT(byte2 < StackDepth());
-      FrameLocalPut(fp_, byte2, Stack(0));
-      break;
+#endif  // QUICKENING
+    case 222:
+    DISPATCH_TARGET(PushNewArray) {
+      uint8_t byte2 = *ip++;
+      SAVE_STATE();
+      PushNewArray(byte2);
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 233: {
-      uint8_t byte2 = *ip_++;
+    case 223:
+    DISPATCH_TARGET(PushNewArrayWithElements) {
+      uint8_t byte2 = *ip++;
+      SAVE_STATE();
+      PushNewArrayWithElements(byte2);
+      LOAD_STATE();
+      DISPATCH();
+    }
+    case 228:
+    DISPATCH_TARGET(LongPushParameter) {
+      uint8_t byte2 = *ip++;
+      PUSH(FrameParameter(fp, byte2));
+      DISPATCH();
+    }
+    case 229:
+    DISPATCH_TARGET(LongPushLocal) {
+      uint8_t byte2 = *ip++;
+      ASSERT(byte2 < STACK_DEPTH());
+      PUSH(FrameLocal(fp, byte2));
+      DISPATCH();
+    }
+    case 230:
+    DISPATCH_TARGET(LongPopIntoLocal) {
+      uint8_t byte2 = *ip++;
+      ASSERT(byte2 < STACK_DEPTH());
+      FrameLocalPut(fp, byte2, POP());
+      DISPATCH();
+    }
+    case 231:
+    DISPATCH_TARGET(LongStoreIntoLocal) {
+      uint8_t byte2 = *ip++;
+      ASSERT(byte2 < STACK_DEPTH());
+      FrameLocalPut(fp, byte2, STACK(0));
+      DISPATCH();
+    }
+    case 233:
+    DISPATCH_TARGET(PushEnclosingObject) {
+      uint8_t byte2 = *ip++;
+      SAVE_STATE();
       PushEnclosingObject(byte2);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 239: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 239:
+    DISPATCH_TARGET(EventualSend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+      SAVE_STATE();
       EventualSend(selector_index, num_args);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 240: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 240:
+    DISPATCH_TARGET(LongJumpBackward) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t delta = (byte3 << 8) | byte2;
-      ip_ -= delta;
-      StackOverflowOrInterruptCheck();  // SAFEPOINT
-      break;
+      ip -= delta;
+      if (reinterpret_cast<uword>(sp) <
+          checked_stack_limit_.load(std::memory_order_relaxed)) [[unlikely]] {
+        SAVE_STATE();
+        StackOverflowOrInterrupt();  // SAFEPOINT
+        LOAD_STATE();
+      } else {
+        ENTER_COMPILED_CODE();
+      }
+      DISPATCH();
     }
-    case 241: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 241:
+    DISPATCH_TARGET(LongJumpForward) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t delta = (byte3 << 8) | byte2;
-      ip_ += delta;
-      break;
+      ip += delta;
+      DISPATCH();
     }
-    case 242: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 242:
+    DISPATCH_TARGET(LongPopJumpTrue) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t delta = (byte3 << 8) | byte2;
-      Object top = Pop();
+      Object top = POP();
       if (top == true_) {
-        ip_ += delta;
+        ip += delta;
       } else if (top != false_) [[unlikely]] {
+        SAVE_STATE();
         SendNonBooleanReceiver(top);
+        LOAD_STATE();
       }
-      break;
+      DISPATCH();
     }
-    case 243: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 243:
+    DISPATCH_TARGET(LongPopJumpFalse) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t delta = (byte3 << 8) | byte2;
-      Object top = Pop();
+      Object top = POP();
       if (top == false_) {
-        ip_ += delta;
+        ip += delta;
       } else if (top != true_) [[unlikely]] {
+        SAVE_STATE();
         SendNonBooleanReceiver(top);
+        LOAD_STATE();
       }
-      break;
-    }
-    case 245: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      PushIndirectLocal(byte3, byte2);
-      break;
-    }
-    case 246: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      PopIntoIndirectLocal(byte3, byte2);
-      break;
-    }
-    case 247: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      StoreIntoIndirectLocal(byte3, byte2);
-      break;
-    }
-    case 248: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      PushLiteral((byte3 << 8) | byte2);
-      break;
-    }
-    case 249: {
-      uint8_t byte2 = *ip_++;
-      uintptr_t byte3 = static_cast<intptr_t>(static_cast<int8_t>(*ip_++));
-      Push(SmallInteger::New((byte3 << 8) | byte2));
-      break;
-    }
-    case 250: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+      DISPATCH();
+    }
+    case 245:
+    DISPATCH_TARGET(PushIndirectLocal) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      Array vector = Array::Cast(FrameLocal(fp, byte3));
+      ASSERT(vector->IsArray());
+      PUSH(vector->element(byte2));
+      DISPATCH();
+    }
+    case 246:
+    DISPATCH_TARGET(PopIntoIndirectLocal) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      Array vector = Array::Cast(FrameLocal(fp, byte3));
+      ASSERT(vector->IsArray());
+      vector->set_element(byte2, POP());
+      DISPATCH();
+    }
+    case 247:
+    DISPATCH_TARGET(StoreIntoIndirectLocal) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      Array vector = Array::Cast(FrameLocal(fp, byte3));
+      ASSERT(vector->IsArray());
+      vector->set_element(byte2, STACK(0));
+      DISPATCH();
+    }
+    case 248:
+    DISPATCH_TARGET(LongPushLiteral) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      PUSH(FrameMethod(fp)->literals()->element((byte3 << 8) | byte2));
+      DISPATCH();
+    }
+    case 249:
+    DISPATCH_TARGET(PushInteger) {
+      uint8_t byte2 = *ip++;
+      uintptr_t byte3 = static_cast<intptr_t>(static_cast<int8_t>(*ip++));
+      PUSH(SmallInteger::New((byte3 << 8) | byte2));
+      DISPATCH();
+    }
+    case 250:
+    DISPATCH_TARGET(LongOrdinarySend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+      SAVE_STATE();
       OrdinarySend(selector_index, num_args);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 251: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 251:
+    DISPATCH_TARGET(LongSelfSend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+      SAVE_STATE();
       SelfSend(selector_index, num_args);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 252: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 252:
+    DISPATCH_TARGET(SuperSend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+      SAVE_STATE();
       SuperSend(selector_index, num_args);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
-    case 253: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
+    case 253:
+    DISPATCH_TARGET(LongImplicitReceiverSend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+      SAVE_STATE();
       ImplicitReceiverSend(selector_index, num_args);
-      break;
-    }
-    case 254: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      uint8_t byte4 = *ip_++;
+      LOAD_STATE();
+      DISPATCH();
+    }
+    case 254:
+    DISPATCH_TARGET(OuterSend) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      uint8_t byte4 = *ip++;
       intptr_t num_args = byte3 >> 4;
       intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
       intptr_t depth = byte4;
+      SAVE_STATE();
       OuterSend(selector_index, num_args, depth);
-      break;
-    }
-    case 255: {
-      uint8_t byte2 = *ip_++;
-      uint8_t byte3 = *ip_++;
-      uint8_t byte4 = *ip_++;
+      LOAD_STATE();
+      DISPATCH();
+    }
+    case 255:
+    DISPATCH_TARGET(PushClosure) {
+      uint8_t byte2 = *ip++;
+      uint8_t byte3 = *ip++;
+      uint8_t byte4 = *ip++;
       intptr_t num_copied = byte2 >> 4;
       intptr_t num_args = byte2 & 7;
       intptr_t block_size = byte3 | (byte4 << 8);
+      SAVE_STATE();
       PushClosure(num_copied, num_args, block_size);
-      break;
+      LOAD_STATE();
+      DISPATCH();
     }
     default:
+    DISPATCH_TARGET(UnusedBytecode)
       FATAL("Unused bytecode");
     }
   }
 }
 
+#undef DISPATCH_TARGET
+#undef DISPATCH
+#undef SAVE_STATE
+#undef LOAD_STATE
+#undef ENTER_COMPILED_CODE
+#undef STACK_DEPTH
+#undef PUSH
+#undef POP
+#undef STACK
+#undef DROP
+#undef POP_N_AND_PUSH
+#undef LOCAL_RETURN
+#if THREADED_DISPATCH
+#undef REPEAT2
+#undef REPEAT4
+#undef REPEAT8
+#undef REPEAT16
+#endif
+
+#if BASELINE_JIT
+// Performs the send or other bytecode at ip_ that compiled code leaves to the
+// interpreter, leaving ip_ after it unless it transfers control.
+void Interpreter::PerformBytecode() {
+  uint8_t byte1 = *ip_++;
+  if (byte1 <= 63) {
+    UNREACHABLE();
+  } else if (byte1 <= 79) {
+    OrdinarySend(byte1 & 7, (byte1 >> 3) & 1);  // SAFEPOINT
+  } else if (byte1 <= 95) {
+    SelfSend(byte1 & 7, (byte1 >> 3) & 1);  // SAFEPOINT
+  } else if (byte1 <= 111) {
+    ImplicitReceiverSend(byte1 & 7, (byte1 >> 3) & 1);  // SAFEPOINT
+  } else if ((byte1 >= 176) && (byte1 <= 207)) {
+    CommonSend(byte1 - 176);  // SAFEPOINT
+#if QUICKENING
+  } else if ((byte1 >= kFirstQuickened) && (byte1 <= kLastQuickened)) {
+    CommonSend(byte1 - kQuickenedOffset - 176);  // SAFEPOINT
+#endif
+  } else if ((byte1 >= 250) && (byte1 <= 254)) {
+    uint8_t byte2 = *ip_++;
+    uint8_t byte3 = *ip_++;
+    intptr_t num_args = byte3 >> 4;
+    intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+    if (byte1 == 250) {
+      OrdinarySend(selector_index, num_args);  // SAFEPOINT
+    } else if (byte1 == 251) {
+      SelfSend(selector_index, num_args);  // SAFEPOINT
+    } else if (byte1 == 252) {
+      SuperSend(selector_index, num_args);  // SAFEPOINT
+    } else if (byte1 == 253) {
+      ImplicitReceiverSend(selector_index, num_args);  // SAFEPOINT
+    } else {
+      intptr_t depth = *ip_++;
+      OuterSend(selector_index, num_args, depth);  // SAFEPOINT
+    }
+  } else {
+    switch (byte1) {
+      case 171:
+        NonLocalReturn(nil_);  // SAFEPOINT
+        break;
+      case 172:
+        NonLocalReturn(false_);  // SAFEPOINT
+        break;
+      case 173:
+        NonLocalReturn(true_);  // SAFEPOINT
+        break;
+      case 174:
+        NonLocalReturn(FrameReceiver(fp_));  // SAFEPOINT
+        break;
+      case 175:
+        NonLocalReturn(Pop());  // SAFEPOINT
+        break;
+      case 222:
+        PushNewArray(*ip_++);  // SAFEPOINT
+        break;
+      case 223:
+        PushNewArrayWithElements(*ip_++);  // SAFEPOINT
+        break;
+      case 233:
+        PushEnclosingObject(*ip_++);  // SAFEPOINT
+        break;
+      case 239: {
+        uint8_t byte2 = *ip_++;
+        uint8_t byte3 = *ip_++;
+        intptr_t num_args = byte3 >> 4;
+        intptr_t selector_index = ((byte3 & 0xF) << 8) | byte2;
+        EventualSend(selector_index, num_args);  // SAFEPOINT
+        break;
+      }
+      case 246:
+      case 247: {
+        uint8_t byte2 = *ip_++;
+        uint8_t byte3 = *ip_++;
+        Array vector = Array::Cast(FrameLocal(fp_, byte3));
+        ASSERT(vector->IsArray());
+        vector->set_element(byte2, byte1 == 246 ? Pop() : Stack(0));
+        break;
+      }
+      case 255: {
+        uint8_t byte2 = *ip_++;
+        uint8_t byte3 = *ip_++;
+        uint8_t byte4 = *ip_++;
+        intptr_t num_copied = byte2 >> 4;
+        intptr_t num_args = byte2 & 7;
+        intptr_t block_size = byte3 | (byte4 << 8);
+        PushClosure(num_copied, num_args, block_size);  // SAFEPOINT
+        break;
+      }
+      default:
+        UNREACHABLE();
+    }
+  }
+}
+#endif  // BASELINE_JIT
+
 Activation Interpreter::EnsureActivation(Object* fp) {
   Activation activation = FrameActivation(fp);
   if (activation == nullptr) {
@@ -1598,6 +2427,7 @@ Activation Interpreter::EnsureActivation(Object* fp) {
     // activations, but for now it is slightly simpler to treat all locals
     // uniformly.
     activation->set_stack_depth(SmallInteger::New(0));
+    activation->set_temps(Array::Cast(nil), kNoBarrier);
 
     FrameActivationPut(fp, activation);
   }
@@ -1611,6 +2441,10 @@ Activation Interpreter::FlushAllFrames() {
   while (fp_ != nullptr) {
     EnsureActivation(fp_);  // SAFEPOINT
 
+    intptr_t num_args = FlagsNumArgs(FrameFlags(fp_));
+    intptr_t num_temps = num_args + FrameNumLocals(fp_, sp_);
+    EnsureTempCapacity(FrameActivation(fp_), num_temps);  // SAFEPOINT
+
     Object* saved_fp = FrameSavedFP(fp_);
     Activation sender;
     if (saved_fp != nullptr) {
@@ -1625,8 +2459,6 @@ Activation Interpreter::FlushAllFrames() {
     activation->set_sender(sender);
     activation->set_bci(activation->method()->BCI(ip_));
 
-    intptr_t num_args = FlagsNumArgs(FrameFlags(fp_));
-    intptr_t num_temps = num_args + FrameNumLocals(fp_, sp_);
     for (intptr_t i = 0; i < num_temps; i++) {
       activation->set_temp(i, FrameTemp(fp_, i));
     }
@@ -1641,7 +2473,7 @@ Activation Interpreter::FlushAllFrames() {
   ASSERT(sp_ == stack_base_);
   ASSERT(fp_ == nullptr);
 #if defined(DEBUG)
-  for (intptr_t i = 0; i < kStackSlots; i++) {
+  for (intptr_t i = 0; i < stack_slots_; i++) {
     stack_limit_[i] = static_cast<Object>(kUninitializedWord);
   }
 #endif
@@ -1649,6 +2481,88 @@ Activation Interpreter::FlushAllFrames() {
   return top;
 }
 
+// Slots at or beyond an activation's stack depth are kept nil so the temps
+// array never retains stale references.
+void Interpreter::EnsureTempCapacity(Activation activation, intptr_t size) {
+  intptr_t capacity = activation->TempCapacity();
+  if (capacity >= size) {
+    return;
+  }
+  Array temps;
+  {
+    HandleScope h1(H, &activation);
+    temps = H->AllocateArray(size);  // SAFEPOINT
+  }
+  for (intptr_t i = 0; i < capacity; i++) {
+    temps->set_element(i, activation->temp(i));
+  }
+  for (intptr_t i = capacity; i < size; i++) {
+    temps->set_element(i, nil, kNoBarrier);
+  }
+  activation->set_temps(temps);
+}
+
+// Moves the frames to a stack twice the size, so that deep recursion does not
+// keep moving frames into the heap. The only pointers into the stack are the
+// saved FPs and the FPs of the activations paired with frames.
+bool Interpreter::GrowStack(uword overflow_limit) {
+  if (stack_slots_ >= max_stack_slots_) {
+    return false;
+  }
+  intptr_t new_slots = stack_slots_ * 2;
+  if (new_slots > max_stack_slots_) {
+    new_slots = max_stack_slots_;
+  }
+  Object* new_limit = reinterpret_cast<Object*>(
+      malloc(new_slots * sizeof(Object)));
+  if (new_limit == nullptr) {
+    return false;
+  }
+  Object* new_base = new_limit + new_slots;
+  intptr_t used = stack_base_ - sp_;
+  memcpy(new_base - used, sp_, used * sizeof(Object));
+#if defined(DEBUG)
+  for (intptr_t i = 0; i < new_slots - used; i++) {
+    new_limit[i] = static_cast<Object>(kUninitializedWord);
+  }
+#endif
+
+  uword delta = reinterpret_cast<uword>(new_base) -
+                reinterpret_cast<uword>(stack_base_);
+  auto move = [&](Object* old_pointer) {
+    return reinterpret_cast<Object*>(reinterpret_cast<uword>(old_pointer) +
+                                     delta);
+  };
+  Object* old_fp = fp_;
+  Object* fp = move(fp_);
+  fp_ = fp;
+  sp_ = move(sp_);
+  while (fp != nullptr) {
+    Activation activation = FrameActivation(fp);
+    if ((activation != nullptr) && (activation->sender_fp() == old_fp)) {
+      activation->set_sender_fp(fp);
+    }
+    old_fp = FrameSavedFP(fp);
+    if (old_fp == nullptr) {
+      break;  // Base frame.
+    }
+    fp[0] = static_cast<SmallInteger>(reinterpret_cast<uword>(move(old_fp)));
+    fp = FrameSavedFP(fp);
+  }
+
+  free(stack_limit_);
+  stack_limit_ = new_limit;
+  stack_base_ = new_base;
+  stack_slots_ = new_slots;
+
+  // Unless an interrupt arrived meanwhile, in which case the limit is reset
+  // when it is handled.
+  checked_stack_limit_.compare_exchange_strong(overflow_limit,
+                                               OverflowLimit(),
+                                               std::memory_order_relaxed);
+  return true;
+}
+
 bool Interpreter::HasLivingFrame(Activation activation) {
   if (!activation->sender()->IsSmallInteger()) {
     return false;
@@ -1700,6 +2614,60 @@ Object Interpreter::ActivationSender(Activation activation) {
   }
 }
 
+Object Interpreter::ActivationNextHandler(Activation activation) {
+  return NextMarkedSender(activation,
+                          (1 << kHandlerMarker) | (1 << kSimulationRootMarker),
+                          nil);  // SAFEPOINT
+}
+
+Object Interpreter::ActivationNextUnwindProtect(Activation activation,
+                                                Object stop) {
+  return NextMarkedSender(activation, 1 << kUnwindProtectMarker,
+                          stop);  // SAFEPOINT
+}
+
+// Searches the senders of the activation for one whose marker is in the given
+// set, giving up at nil or stop. Living frames are skipped by their flags
+// without creating activations for them, so only the frame found is given an
+// activation.
+Object Interpreter::NextMarkedSender(Activation activation,
+                                     intptr_t markers,
+                                     Object stop) {
+  Activation current = activation;
+  Object* fp = HasLivingFrame(current) ? current->sender_fp() : nullptr;
+  for (;;) {
+    Object sender;
+    if (fp != nullptr) {
+      Object* sender_fp = FrameSavedFP(fp);
+      if (sender_fp != nullptr) {
+        if (FrameActivation(sender_fp) == stop) {
+          return nil;
+        }
+        if (((1 << FlagsMarker(FrameFlags(sender_fp))) & markers) != 0) {
+          return EnsureActivation(sender_fp);  // SAFEPOINT
+        }
+        fp = sender_fp;
+        continue;
+      }
+      sender = FrameBaseSender(fp);
+    } else {
+      sender = current->sender();
+    }
+
+    if ((sender == nil) || (sender == stop)) {
+      return nil;
+    }
+    current = Activation::Cast(sender);
+    ASSERT(current->IsActivation());
+    Method method = current->method();
+    if ((method != nil) &&
+        (((1 << MarkerOf(method->Primitive())) & markers) != 0)) {
+      return current;
+    }
+    fp = HasLivingFrame(current) ? current->sender_fp() : nullptr;
+  }
+}
+
 void Interpreter::ActivationSenderPut(Activation activation,
                                       Activation new_sender) {
   ASSERT(!new_sender->IsSmallInteger());
@@ -1855,17 +2823,23 @@ void Interpreter::ActivationTempSizePut(Activation activation,
     Activation top;
     {
       HandleScope h1(H, &activation);
+      // Flushing only ever grows the temps, so this capacity survives it.
+      EnsureTempCapacity(activation, new_size);  // SAFEPOINT
       top = FlushAllFrames();  // SAFEPOINT
     }
     intptr_t old_size = activation->StackDepth();
-    for (intptr_t i = old_size; i < new_size; i++) {
+    for (intptr_t i = new_size; i < old_size; i++) {
       activation->set_temp(i, nil, kNoBarrier);
     }
     activation->set_stack_depth(SmallInteger::New(new_size));
     CreateBaseFrame(top);
   } else {
+    {
+      HandleScope h1(H, &activation);
+      EnsureTempCapacity(activation, new_size);  // SAFEPOINT
+    }
     intptr_t old_size = activation->StackDepth();
-    for (intptr_t i = old_size; i < new_size; i++) {
+    for (intptr_t i = new_size; i < old_size; i++) {
       activation->set_temp(i, nil, kNoBarrier);
     }
     activation->set_stack_depth(SmallInteger::New(new_size));
@@ -1889,7 +2863,8 @@ void Interpreter::GCPrologue() {
 }
 
 void Interpreter::GCEpilogue() {
-  // Convert BCIs to IPs. Invalidate lookup caches.
+  // Convert BCIs to IPs. Invalidate the lookup cache, which may refer to
+  // new-space objects.
 
   Object* fp = fp_;
   const uint8_t** ip_slot = &ip_;
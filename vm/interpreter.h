@@ -12,6 +12,8 @@
 #include "vm/assert.h"
 #include "vm/flags.h"
 #include "vm/globals.h"
+#include "vm/inline_cache.h"
+#include "vm/jit.h"
 #include "vm/lookup_cache.h"
 #include "vm/object.h"
 
@@ -23,13 +25,17 @@ class Object;
 
 class Interpreter {
  public:
-  Interpreter(Heap* heap, Isolate* isolate);
+  Interpreter(Heap* heap, Isolate* isolate, size_t max_stack_size);
   ~Interpreter();
 
   Isolate* isolate() const { return isolate_; }
 
   void Enter();
   void Exit();
+  // Ends the isolate for passing its heap limit, either because the
+  // out-of-memory signal went unhandled or because the heap kept growing.
+  // Unlike other failures of a spawned isolate, this does not end the process.
+  void ExitOutOfMemory();
   void ActivateDispatch(Method method, intptr_t num_args);
   void ReturnFromDispatch();
 
@@ -43,7 +49,11 @@ class Interpreter {
   enum Interrupt : uword {
     kInterruptSIGINT = 1 << 0,
     kInterruptRememberedSet = 1 << 1,
-    kInterruptMask = (1 << 2) - 1,
+    kInterruptIncrementalGC = 1 << 2,
+    kInterruptOutOfMemory = 1 << 3,
+    kInterruptGCStress = 1 << 4,
+    kInterruptProfile = 1 << 5,
+    kInterruptMask = (1 << 6) - 1,
   };
   void Interrupt(Interrupt interrupt) {
     checked_stack_limit_.fetch_or(~kInterruptMask | interrupt,
@@ -51,11 +61,18 @@ class Interpreter {
   }
   void PrintStack();
 
+  // The ring of profile samples, a root so the collector keeps the methods in
+  // it up to date. Zero unless the isolate is being profiled.
+  Object profile_samples() const { return profile_samples_; }
+  void set_profile_samples(Array samples) { profile_samples_ = samples; }
+
   const uint8_t* IPForAssert() { return ip_; }
 
   Activation CurrentActivation();
   void SetCurrentActivation(Activation new_activation);
   Object ActivationSender(Activation activation);
+  Object ActivationNextHandler(Activation activation);
+  Object ActivationNextUnwindProtect(Activation activation, Object stop);
   void ActivationSenderPut(Activation activation, Activation new_sender);
   Object ActivationBCI(Activation activation);
   void ActivationBCIPut(Activation activation, SmallInteger new_bci);
@@ -66,6 +83,35 @@ class Interpreter {
   void ActivationTempAtPut(Activation activation, intptr_t index, Object value);
   intptr_t ActivationTempSize(Activation activation);
   void ActivationTempSizePut(Activation activation, intptr_t new_size);
+  void Dequicken(Method method);
+  // Quickened bytecode and compiled code are private to the interpreter.
+  // Primitives that read or write the bytes of a ByteArray first restore its
+  // original bytecode and drop any code compiled from it.
+  void EnsureDequickened(Object bytes) {
+#if QUICKENING
+    if (bytes->IsByteArray() && ByteArray::Cast(bytes)->is_quickened()) {
+      DequickenBytecode(ByteArray::Cast(bytes));
+    }
+#endif
+#if BASELINE_JIT
+    if (bytes->IsByteArray() && bytes->IsOldObject()) {
+      jit_.Invalidate(ByteArray::Cast(bytes));
+    }
+#endif
+  }
+
+  // For collections that may move or free old-space objects.
+  void FlushInlineCaches() { inline_cache_.Clear(); }
+#if BASELINE_JIT
+  void FlushCompiledCode() { jit_.Flush(); }
+#endif
+
+  static intptr_t BytecodeSize(uint8_t byte1) {
+    if (byte1 <= 215) return 1;
+    if (byte1 <= 237) return 2;
+    if (byte1 <= 253) return 3;
+    return 4;
+  }
 
   void GCPrologue();
   void RootPointers(Object** from, Object** to) {
@@ -123,13 +169,13 @@ class Interpreter {
   }
 
  private:
-  void Interpret();
+  friend class JIT;
 
-  INLINE void PushIndirectLocal(intptr_t vector_offset, intptr_t offset);
-  INLINE void PopIntoIndirectLocal(intptr_t vector_offset, intptr_t offset);
-  INLINE void StoreIntoIndirectLocal(intptr_t vector_offset, intptr_t offset);
+  void Interpret();
+#if BASELINE_JIT
+  void PerformBytecode();
+#endif
 
-  INLINE void PushLiteral(intptr_t offset);
   INLINE void PushEnclosingObject(intptr_t depth);
   INLINE void PushNewArrayWithElements(intptr_t size);
   INLINE void PushNewArray(intptr_t size);
@@ -149,6 +195,14 @@ class Interpreter {
                               intptr_t depth);
   INLINE void SelfSend(intptr_t selector_index, intptr_t num_args);
   NOINLINE void SelfSendMiss(String selector, intptr_t num_args);
+  NOINLINE bool LookupCacheOrdinary(intptr_t cid,
+                                    String selector,
+                                    Method* target);
+  NOINLINE bool LookupCacheNS(intptr_t cid,
+                              String selector,
+                              intptr_t rule,
+                              Object* absent_receiver,
+                              Method* target);
 
   Behavior FindApplicationOf(AbstractMixin mixin, Behavior klass);
   bool HasMethod(Behavior, String selector);
@@ -174,6 +228,7 @@ class Interpreter {
   NOINLINE void SendAboutToReturnThrough(Object result, Activation unwind);
   NOINLINE void SendNonBooleanReceiver(Object non_boolean);
   NOINLINE void EventualSend(intptr_t selector_index, intptr_t num_args);
+  NOINLINE void SendOutOfMemory();
   NOINLINE void SendPrivate(Behavior cls, String selector, intptr_t num_args);
 
   INLINE void InsertAbsentReceiver(Object receiver, intptr_t num_args);
@@ -186,35 +241,53 @@ class Interpreter {
     }
   }
   NOINLINE void StackOverflowOrInterrupt();
+  // Leaves room for a frame with the most temps, plus its saved IP, saved FP,
+  // flags, method, activation and receiver, and keeps the interrupt bits
+  // clear.
+  uword OverflowLimit() const {
+    return Utils::RoundUp(reinterpret_cast<uword>(stack_limit_) +
+                              (kMaxTemps + 8) * sizeof(Object),
+                          kInterruptMask + 1);
+  }
 
-  INLINE void LocalReturn(Object result);
   NOINLINE void LocalBaseReturn(Object result);
   NOINLINE void NonLocalReturn(Object result);
 
   NOINLINE void CreateBaseFrame(Activation activation);
   NOINLINE Activation EnsureActivation(Object* fp);
   NOINLINE Activation FlushAllFrames();
+  Object NextMarkedSender(Activation activation, intptr_t markers, Object stop);
+  void EnsureTempCapacity(Activation activation, intptr_t size);
+  bool GrowStack(uword overflow_limit);
+  static void DequickenBytecode(ByteArray bytecode);
+  void RecordProfileSample();
   bool HasLivingFrame(Activation activation);
 
-  static constexpr intptr_t kStackSlots = 1024;
-  static constexpr intptr_t kStackSize = kStackSlots * sizeof(Object);
+  static constexpr intptr_t kInitialStackSlots = 1024;
 
   const uint8_t* ip_;
   Object* sp_;
   Object* fp_;
   Object* stack_base_;
   Object* stack_limit_;
+  intptr_t stack_slots_;
+  intptr_t max_stack_slots_;
   std::atomic<uword> volatile checked_stack_limit_;
 
   Object nil_;
   Object false_;
   Object true_;
+  Object profile_samples_;
   ObjectStore object_store_;
 
   Heap* const heap_;
   Isolate* const isolate_;
   jmp_buf* environment_;
   LookupCache lookup_cache_;
+  InlineCache inline_cache_;
+#if BASELINE_JIT
+  JIT jit_;
+#endif
 };
 
 }  // namespace psoup
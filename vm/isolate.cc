@@ -4,17 +4,123 @@
 
 #include "vm/isolate.h"
 
-#include "vm/heap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "vm/interpreter.h"
 #include "vm/lockers.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
+#include "vm/profiler.h"
 #include "vm/snapshot.h"
 #include "vm/thread.h"
 #include "vm/thread_pool.h"
 
 namespace psoup {
 
+static constexpr int64_t kMaxOptionValue = GB / KB;
+
+static const char* const kIsolateOptions[] = {
+  "stack-max-kb",
+  "profile-hz",
+  "profile-buffer-kb",
+  "profile-file",
+};
+
+IsolateOptions::IsolateOptions()
+    : gc_policy_(),
+      max_stack_size_(MB),
+      profile_hz_(0),
+      profile_buffer_size_(4 * MB) {
+  profile_file_[0] = '\0';
+}
+
+bool IsolateOptions::SetOption(const char* option) {
+  if (strncmp(option, "--", 2) != 0) {
+    return false;
+  }
+  const char* name = option + 2;
+  const char* equals = strchr(name, '=');
+  if (equals == nullptr) {
+    return false;
+  }
+  size_t name_length = equals - name;
+  auto is = [&](const char* candidate) {
+    return (strlen(candidate) == name_length) &&
+           (strncmp(name, candidate, name_length) == 0);
+  };
+  if (is("profile-file")) {
+    size_t length = strlen(equals + 1);
+    if ((length == 0) || (length >= kMaxProfileFileLength)) {
+      return false;
+    }
+    memcpy(profile_file_, equals + 1, length + 1);
+    return true;
+  }
+  if (!is("stack-max-kb") && !is("profile-hz") && !is("profile-buffer-kb")) {
+    return gc_policy_.SetOption(option);
+  }
+
+  char* end;
+  int64_t value = strtoll(equals + 1, &end, 10);
+  if ((end == equals + 1) || (*end != '\0') || (value < 0) ||
+      (value > kMaxOptionValue)) {
+    return false;
+  }
+  if (is("stack-max-kb")) {
+    max_stack_size_ = static_cast<size_t>(value) * KB;
+  } else if (is("profile-hz")) {
+    if (value > kMaxProfileHz) {
+      return false;
+    }
+    profile_hz_ = value;
+  } else {
+    if (value < 1) {
+      return false;
+    }
+    profile_buffer_size_ = static_cast<size_t>(value) * KB;
+  }
+  return true;
+}
+
+void IsolateOptions::SetFromEnvironment() {
+  gc_policy_.SetFromEnvironment();
+  for (const char* name : kIsolateOptions) {
+    // --stack-max-kb is read from PSOUP_STACK_MAX_KB.
+    char variable[64] = "PSOUP_";
+    size_t length = strlen(variable);
+    for (const char* c = name; *c != '\0'; c++) {
+      variable[length++] = (*c == '-') ? '_' : (*c - 'a' + 'A');
+    }
+    variable[length] = '\0';
+    const char* value = getenv(variable);
+    if (value == nullptr) {
+      continue;
+    }
+    char option[kMaxProfileFileLength + 64];
+    snprintf(option, sizeof(option), "--%s=%s", name, value);
+    if (!SetOption(option)) {
+      OS::PrintErr("Ignoring invalid %s=%s\n", variable, value);
+    }
+  }
+}
+
+void IsolateOptions::PrintOptions() {
+  GCPolicy::PrintOptions();
+  OS::PrintErr(
+      "  --stack-max-kb=N            Largest interpreter stack, past which\n"
+      "                              frames move to the heap (default: 1024)\n"
+      "  --profile-hz=N              Sample the stack N times a second and\n"
+      "                              write a profile when each isolate exits\n"
+      "  --profile-buffer-kb=N       Keep the newest N KB of samples\n"
+      "                              (default: 4096)\n"
+      "  --profile-file=PATH         Write the first isolate's profile to PATH,\n"
+      "                              others' with -<i> before the extension\n"
+      "                              (default: psoup-<pid>-<i>.cpuprofile)\n"
+      "Each may also be given as, e.g., PSOUP_NEW_SPACE_MAX_KB=N.\n");
+}
+
 Monitor* Isolate::isolates_list_monitor_ = nullptr;
 Isolate* Isolate::isolates_list_head_ = nullptr;
 ThreadPool* Isolate::thread_pool_ = nullptr;
@@ -83,19 +189,29 @@ void Isolate::PrintStack() {
   interpreter_->PrintStack();
 }
 
-Isolate::Isolate(const void* snapshot, size_t snapshot_length)
+Isolate::Isolate(const void* snapshot,
+                 size_t snapshot_length,
+                 const IsolateOptions& options)
     : heap_(nullptr),
       interpreter_(nullptr),
       loop_(nullptr),
+      profiler_(nullptr),
+      options_(options),
       snapshot_(snapshot),
       snapshot_length_(snapshot_length),
       random_(),
       salt_(static_cast<uintptr_t>(random_.NextUInt64())),
+      exited_out_of_memory_(false),
       next_(nullptr) {
-  heap_ = new Heap();
-  interpreter_ = new Interpreter(heap_, this);
+  heap_ = new Heap(options.gc_policy());
+  interpreter_ = new Interpreter(heap_, this, options.max_stack_size());
   loop_ = new PlatformMessageLoop(this);
   Deserialize(heap_, snapshot, snapshot_length);
+  if (options.profile_hz() != 0) {
+    profiler_ = new Profiler(heap_, interpreter_, options_.profile_hz(),
+                             options_.profile_buffer_size(),
+                             options_.profile_file());
+  }
 
   AddIsolateToList(this);
 
@@ -108,6 +224,10 @@ Isolate::~Isolate() {
   current_ = nullptr;
 
   RemoveIsolateFromList(this);
+  if (profiler_ != nullptr) {
+    profiler_->WriteProfile();
+    delete profiler_;
+  }
   delete heap_;
   delete interpreter_;
   delete loop_;
@@ -206,24 +326,33 @@ void Isolate::ActivateSignal(intptr_t handle,
 
 void Isolate::Interpret() {
   interpreter_->Enter();
+  if (profiler_ != nullptr) {
+    profiler_->RecordIdle();
+  }
 }
 
 class SpawnIsolateTask : public ThreadPool::Task {
  public:
   SpawnIsolateTask(const void* snapshot,
                    size_t snapshot_length,
+                   const IsolateOptions& options,
                    IsolateMessage* initial_message)
       : snapshot_(snapshot),
         snapshot_length_(snapshot_length),
+        options_(options),
         initial_message_(initial_message) {}
 
   virtual void Run() {
-    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_);
+    Isolate* child_isolate = new Isolate(snapshot_, snapshot_length_,
+                                         options_);
     child_isolate->loop()->PostMessage(initial_message_);
     initial_message_ = nullptr;
     intptr_t exit_code = child_isolate->loop()->Run();
+    // An isolate that died of the out-of-memory signal takes down only
+    // itself. Any other failure still exits the process, even over the limit.
+    bool out_of_memory = child_isolate->exited_out_of_memory();
     delete child_isolate;
-    if (exit_code != 0) {
+    if ((exit_code != 0) && !out_of_memory) {
       OS::Exit(exit_code);
     }
   }
@@ -231,6 +360,7 @@ class SpawnIsolateTask : public ThreadPool::Task {
  private:
   const void* snapshot_;
   size_t snapshot_length_;
+  IsolateOptions options_;
   IsolateMessage* initial_message_;
 
   DISALLOW_COPY_AND_ASSIGN(SpawnIsolateTask);
@@ -238,7 +368,7 @@ class SpawnIsolateTask : public ThreadPool::Task {
 
 void Isolate::Spawn(IsolateMessage* initial_message) {
   thread_pool_->Run(new SpawnIsolateTask(snapshot_, snapshot_length_,
-                                         initial_message));
+                                         options_, initial_message));
 }
 
 }  // namespace psoup
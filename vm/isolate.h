@@ -7,6 +7,7 @@
 
 #include "vm/allocation.h"
 #include "vm/globals.h"
+#include "vm/heap.h"
 #include "vm/port.h"
 #include "vm/random.h"
 
@@ -17,17 +18,63 @@ class Interpreter;
 class MessageLoop;
 class Monitor;
 class Object;
+class Profiler;
 class ThreadPool;
 
+// The settings an isolate is started with: its collector's policy and those of
+// the rest of the VM. Each isolate keeps its own copy, which the isolates it
+// spawns inherit.
+class IsolateOptions {
+ public:
+  static constexpr intptr_t kMaxProfileHz = 10000;
+  static constexpr size_t kMaxProfileFileLength = 1024;
+
+  IsolateOptions();
+
+  // Parses an option of the form "--name=value", whether of the isolate or of
+  // its collector. Returns false if either the name or the value is not valid.
+  bool SetOption(const char* option);
+  // Applies PSOUP_NAME=value from the environment for each option --name.
+  void SetFromEnvironment();
+  static void PrintOptions();
+
+  const GCPolicy& gc_policy() const { return gc_policy_; }
+  // Size the interpreter's stack may grow to before frames are moved into
+  // heap activations instead.
+  size_t max_stack_size() const { return max_stack_size_; }
+  // Rate at which the isolate's stack is sampled for a CPU profile (zero for
+  // never), and the size of the ring holding the newest samples.
+  intptr_t profile_hz() const { return profile_hz_; }
+  size_t profile_buffer_size() const { return profile_buffer_size_; }
+  // Where the first isolate's profile is written, with "-<i>" before the
+  // extension for the others. Empty for psoup-<pid>-<i>.cpuprofile in the
+  // working directory.
+  const char* profile_file() const { return profile_file_; }
+
+ private:
+  GCPolicy gc_policy_;
+  size_t max_stack_size_;
+  intptr_t profile_hz_;
+  size_t profile_buffer_size_;
+  char profile_file_[kMaxProfileFileLength];
+};
+
 class Isolate {
  public:
-  Isolate(const void* snapshot, size_t snapshot_length);
+  Isolate(const void* snapshot,
+          size_t snapshot_length,
+          const IsolateOptions& options);
   ~Isolate();
 
   Heap* heap() const { return heap_; }
   MessageLoop* loop() const { return loop_; }
+  const IsolateOptions& options() const { return options_; }
+  Profiler* profiler() const { return profiler_; }
   uintptr_t salt() const { return salt_; }
   Random& random() { return random_; }
+  // Whether the isolate ended for passing its heap limit.
+  bool exited_out_of_memory() const { return exited_out_of_memory_; }
+  void set_exited_out_of_memory() { exited_out_of_memory_ = true; }
 
   void ActivateMessage(IsolateMessage* message);
   void ActivateWakeup();
@@ -41,6 +88,7 @@ class Isolate {
   void Spawn(IsolateMessage* initial_message);
 
   static Isolate* Current() { return current_; }
+  static ThreadPool* thread_pool() { return thread_pool_; }
   static void Startup();
   static void Shutdown();
 
@@ -54,10 +102,13 @@ class Isolate {
   Heap* heap_;
   Interpreter* interpreter_;
   MessageLoop* loop_;
+  Profiler* profiler_;
+  const IsolateOptions options_;
   const void* const snapshot_;
   const size_t snapshot_length_;
   Random random_;
   const uintptr_t salt_;
+  bool exited_out_of_memory_;
   Isolate* next_;
 
   void AddIsolateToList(Isolate* isolate);
@@ -0,0 +1,1719 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/jit.h"
+
+#if BASELINE_JIT
+
+#include <stddef.h>
+
+#include "vm/assert.h"
+#include "vm/interpreter.h"
+#include "vm/primitives.h"
+#include "vm/utils.h"
+
+namespace psoup {
+
+// Register assignment in compiled code. RBX, R12, R13 and R14 are callee-saved
+// in the System V ABI, so they survive calls back into C++.
+//
+//   RBX  stack pointer, as Interpreter::sp_
+//   R12  frame pointer, as Interpreter::fp_
+//   R13  the Interpreter
+//   R14  address of the first bytecode of the current method
+//
+// RAX, RCX, RDX, RSI and RDI are scratch.
+enum Register {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+enum Condition {
+  kOverflow = 0x0,
+  kBelow = 0x2,
+  kAboveEqual = 0x3,
+  kEqual = 0x4,
+  kNotEqual = 0x5,
+  kLess = 0xC,
+  kGreaterEqual = 0xD,
+  kLessEqual = 0xE,
+  kGreater = 0xF,
+};
+
+static Condition Negate(Condition condition) {
+  return static_cast<Condition>(condition ^ 1);
+}
+
+// Frame slots, in words from the frame pointer. See Interpreter::Activate.
+static constexpr int32_t kSlotSize = kWordSize;
+static constexpr int32_t kSavedIPSlot = 1;
+static constexpr int32_t kSavedFPSlot = 0;
+static constexpr int32_t kFlagsSlot = -1;
+static constexpr int32_t kMethodSlot = -2;
+static constexpr int32_t kActivationSlot = -3;
+static constexpr int32_t kReceiverSlot = -4;
+static constexpr int32_t kFirstLocalSlot = -5;
+// The frame flags hold num_args above a two-bit frame marker and a closure bit.
+// Compiled code only builds frames for ordinary methods and their blocks, so
+// the marker stays kNoMarker. See MakeFlags.
+static constexpr intptr_t kFlagsNumArgsShift = 3;
+
+COMPILE_ASSERT(kSmiTag == 0);
+COMPILE_ASSERT(kSmiTagShift == 1);
+COMPILE_ASSERT(kClassIdFieldOffset + kClassIdFieldSize == 64);
+
+// Displacement of a field from a tagged pointer to its object. The layouts are
+// not standard-layout types, so offsetof does not apply.
+#define TAGGED_OFFSET(klass, field)                                            \
+  static_cast<int32_t>(                                                        \
+      reinterpret_cast<uword>(                                                 \
+          &reinterpret_cast<klass::Layout*>(kObjectAlignment)->field) -        \
+      kObjectAlignment - kHeapObjectTag)
+
+struct Address {
+  Address(Register base, int32_t disp) : base(base), disp(disp) {}
+
+  Register base;
+  int32_t disp;
+};
+
+static Address Slot(int32_t slot) {
+  return Address(R12, slot * kSlotSize);
+}
+
+// A label is either bound to a position in the code, or heads a chain of the
+// unresolved rel32 fields that refer to it, linked through the fields.
+struct Label {
+  Label() : position(-1), link(-1) {}
+
+  bool IsBound() const { return position >= 0; }
+
+  intptr_t position;
+  intptr_t link;
+};
+
+class Assembler {
+ public:
+  Assembler()
+      : buffer_(nullptr),
+        size_(0),
+        capacity_(0),
+        fixups_(nullptr),
+        num_fixups_(0),
+        fixups_capacity_(0) {}
+  ~Assembler() {
+    free(buffer_);
+    free(fixups_);
+  }
+
+  intptr_t size() const { return size_; }
+
+  void movq(Register dst, Address src) {
+    EmitRex(dst, src.base);
+    Emit8(0x8B);
+    EmitOperand(dst, src);
+  }
+  void movq(Address dst, Register src) {
+    EmitRex(src, dst.base);
+    Emit8(0x89);
+    EmitOperand(src, dst);
+  }
+  void movq(Address dst, int32_t imm) {
+    EmitRex(RAX, dst.base);
+    Emit8(0xC7);
+    EmitOperand(0, dst);
+    Emit32(imm);
+  }
+  void movq(Register dst, Register src) { EmitRegReg(0x89, src, dst); }
+  void movq(Register dst, uword imm) {
+    EmitRex(RAX, dst);
+    Emit8(0xB8 | (dst & 7));
+    Emit64(imm);
+  }
+  void movl(Register dst, int32_t imm) {
+    if (dst >= R8) Emit8(0x41);
+    Emit8(0xB8 | (dst & 7));
+    Emit32(imm);
+  }
+  void leaq(Register dst, Address src) {
+    EmitRex(dst, src.base);
+    Emit8(0x8D);
+    EmitOperand(dst, src);
+  }
+  // dst = base + index * 8 + disp
+  void leaq(Register dst, Register base, Register index, int8_t disp) {
+    ASSERT(index != RSP);
+    Emit8(0x48 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+    Emit8(0x8D);
+    Emit8(0x44 | ((dst & 7) << 3));
+    Emit8(0xC0 | ((index & 7) << 3) | (base & 7));
+    Emit8(disp);
+  }
+
+  void addq(Register dst, Register src) { EmitRegReg(0x01, src, dst); }
+  void orq(Register dst, Register src) { EmitRegReg(0x09, src, dst); }
+  void andq(Register dst, Register src) { EmitRegReg(0x21, src, dst); }
+  void subq(Register dst, Register src) { EmitRegReg(0x29, src, dst); }
+  void cmpq(Register left, Register right) { EmitRegReg(0x39, right, left); }
+  void testq(Register left, Register right) { EmitRegReg(0x85, right, left); }
+  void addq(Register dst, int32_t imm) { EmitImmediate(0, dst, imm); }
+  void andq(Register dst, int32_t imm) { EmitImmediate(4, dst, imm); }
+  void subq(Register dst, int32_t imm) { EmitImmediate(5, dst, imm); }
+  void cmpq(Register left, int32_t imm) { EmitImmediate(7, left, imm); }
+  void testq(Register reg, int32_t imm) {
+    EmitRex(RAX, reg);
+    Emit8(0xF7);
+    Emit8(0xC0 | (reg & 7));
+    Emit32(imm);
+  }
+  void subq(Register dst, Address src) {
+    EmitRex(dst, src.base);
+    Emit8(0x2B);
+    EmitOperand(dst, src);
+  }
+  void cmpq(Register left, Address right) {
+    EmitRex(left, right.base);
+    Emit8(0x3B);
+    EmitOperand(left, right);
+  }
+  void imulq(Register dst, Register src) {
+    EmitRex(dst, src);
+    Emit8(0x0F);
+    Emit8(0xAF);
+    Emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+  }
+  void cmovq(Condition condition, Register dst, Address src) {
+    EmitRex(dst, src.base);
+    Emit8(0x0F);
+    Emit8(0x40 | condition);
+    EmitOperand(dst, src);
+  }
+  void shlq(Register reg, uint8_t shift) { EmitShift(4, reg, shift); }
+  void shrq(Register reg, uint8_t shift) { EmitShift(5, reg, shift); }
+  void sarq(Register reg, uint8_t shift) { EmitShift(7, reg, shift); }
+
+  void pushq(Register reg) {
+    if (reg >= R8) Emit8(0x41);
+    Emit8(0x50 | (reg & 7));
+  }
+  void popq(Register reg) {
+    if (reg >= R8) Emit8(0x41);
+    Emit8(0x58 | (reg & 7));
+  }
+  void call(Register target) {
+    if (target >= R8) Emit8(0x41);
+    Emit8(0xFF);
+    Emit8(0xD0 | (target & 7));
+  }
+  void ret() { Emit8(0xC3); }
+
+  void jmp(Address target) {
+    if (target.base >= R8) Emit8(0x41);
+    Emit8(0xFF);
+    EmitOperand(4, target);
+  }
+  void jmp(Label* label) {
+    Emit8(0xE9);
+    EmitLabel(label);
+  }
+  void j(Condition condition, Label* label) {
+    Emit8(0x0F);
+    Emit8(0x80 | condition);
+    EmitLabel(label);
+  }
+  // A jump out of this code, resolved when it is copied to its final address.
+  void jmp(uword target) {
+    Emit8(0xE9);
+    EmitFixup(target);
+  }
+
+  void Bind(Label* label) {
+    ASSERT(!label->IsBound());
+    label->position = size_;
+    intptr_t link = label->link;
+    while (link >= 0) {
+      intptr_t next = Read32(link);
+      Write32(link, label->position - (link + 4));
+      link = next;
+    }
+    label->link = -1;
+  }
+
+  void FinalizeInto(uword address) const {
+    memcpy(reinterpret_cast<void*>(address), buffer_, size_);
+    for (intptr_t i = 0; i < num_fixups_; i++) {
+      intptr_t position = fixups_[i].position;
+      intptr_t displacement =
+          static_cast<intptr_t>(fixups_[i].target - (address + position + 4));
+      ASSERT(Utils::IsInt(32, displacement));
+      int32_t value = static_cast<int32_t>(displacement);
+      memcpy(reinterpret_cast<void*>(address + position), &value,
+             sizeof(value));
+    }
+  }
+
+ private:
+  struct Fixup {
+    intptr_t position;
+    uword target;
+  };
+
+  void Emit8(uint8_t value) {
+    if (size_ == capacity_) {
+      capacity_ = capacity_ == 0 ? 4 * KB : capacity_ * 2;
+      buffer_ = reinterpret_cast<uint8_t*>(realloc(buffer_, capacity_));
+      if (buffer_ == nullptr) {
+        FATAL("Failed to grow code buffer");
+      }
+    }
+    buffer_[size_++] = value;
+  }
+  void Emit32(int32_t value) {
+    for (intptr_t i = 0; i < 4; i++) {
+      Emit8(static_cast<uint8_t>(value >> (i * 8)));
+    }
+  }
+  void Emit64(uword value) {
+    for (intptr_t i = 0; i < 8; i++) {
+      Emit8(static_cast<uint8_t>(value >> (i * 8)));
+    }
+  }
+  int32_t Read32(intptr_t position) const {
+    int32_t value;
+    memcpy(&value, &buffer_[position], sizeof(value));
+    return value;
+  }
+  void Write32(intptr_t position, intptr_t value) {
+    ASSERT(Utils::IsInt(32, value));
+    int32_t value32 = static_cast<int32_t>(value);
+    memcpy(&buffer_[position], &value32, sizeof(value32));
+  }
+
+  // REX prefix with W set, for a ModRM reg field and rm field.
+  void EmitRex(intptr_t reg, intptr_t rm) {
+    Emit8(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+  }
+  void EmitRegReg(uint8_t opcode, Register reg, Register rm) {
+    EmitRex(reg, rm);
+    Emit8(opcode);
+    Emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+  void EmitOperand(intptr_t reg, Address address) {
+    intptr_t base = address.base & 7;
+    intptr_t mod;
+    if ((address.disp == 0) && (base != (RBP & 7))) {
+      mod = 0;
+    } else if (Utils::IsInt(8, address.disp)) {
+      mod = 1;
+    } else {
+      mod = 2;
+    }
+    Emit8((mod << 6) | ((reg & 7) << 3) | base);
+    if (base == (RSP & 7)) {
+      Emit8(0x24);  // SIB: no index.
+    }
+    if (mod == 1) {
+      Emit8(static_cast<uint8_t>(address.disp));
+    } else if (mod == 2) {
+      Emit32(address.disp);
+    }
+  }
+  void EmitImmediate(intptr_t extension, Register reg, int32_t imm) {
+    EmitRex(RAX, reg);
+    if (Utils::IsInt(8, imm)) {
+      Emit8(0x83);
+      Emit8(0xC0 | (extension << 3) | (reg & 7));
+      Emit8(static_cast<uint8_t>(imm));
+    } else {
+      Emit8(0x81);
+      Emit8(0xC0 | (extension << 3) | (reg & 7));
+      Emit32(imm);
+    }
+  }
+  void EmitShift(intptr_t extension, Register reg, uint8_t shift) {
+    EmitRex(RAX, reg);
+    Emit8(0xC1);
+    Emit8(0xC0 | (extension << 3) | (reg & 7));
+    Emit8(shift);
+  }
+  void EmitLabel(Label* label) {
+    if (label->IsBound()) {
+      Emit32(static_cast<int32_t>(label->position - (size_ + 4)));
+    } else {
+      intptr_t position = size_;
+      Emit32(static_cast<int32_t>(label->link));
+      label->link = position;
+    }
+  }
+  void EmitFixup(uword target) {
+    if (num_fixups_ == fixups_capacity_) {
+      fixups_capacity_ = fixups_capacity_ == 0 ? 64 : fixups_capacity_ * 2;
+      fixups_ = reinterpret_cast<Fixup*>(
+          realloc(fixups_, fixups_capacity_ * sizeof(Fixup)));
+      if (fixups_ == nullptr) {
+        FATAL("Failed to grow code buffer");
+      }
+    }
+    fixups_[num_fixups_].position = size_;
+    fixups_[num_fixups_].target = target;
+    num_fixups_++;
+    Emit32(0);
+  }
+
+  uint8_t* buffer_;
+  intptr_t size_;
+  intptr_t capacity_;
+  Fixup* fixups_;
+  intptr_t num_fixups_;
+  intptr_t fixups_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(Assembler);
+};
+
+// The code for one bytecode array, and the address in it of each bytecode.
+struct CompiledCode {
+  uword bytecode;
+  intptr_t length;  // 0 if the bytecode cannot be compiled.
+  CompiledCode* next;
+  uword pcs[];  // 0 where no bytecode starts.
+};
+
+// One of the entries of the cache of a send site. Compiled code checks the
+// receiver's class and the sender, which together with the site determine the
+// target as they do for InlineCache, against the first entry inline and the
+// others in a stub. It then builds the target's frame exactly as
+// Interpreter::Activate does, or performs the slot access of a getter or
+// setter in place. An entry for #value and friends sent to closures of one
+// block builds the block's frame as Interpreter::ActivateClosure does. For any
+// other target, compiled code has the interpreter activate it, which saves
+// looking it up again.
+//
+// A site needs more than one entry not only for polymorphic receivers, but
+// also because methods of different classes can share their bytecode, and so
+// their compiled code.
+struct SendCache {
+  intptr_t cid;  // kIllegalCid until a send fills the entry.
+  uword caller;
+  intptr_t accessor;  // Displacement of the slot of a getter or setter, or 0.
+  uword activate;  // The stub that builds the frame.
+  uword flags;
+  uword target;  // For a closure, the method of its home.
+  uword absent_receiver;  // For the interpreter to activate the target, or 0.
+  intptr_t num_nils;
+  uword initial_bci;  // For a closure, its initial bci, tagged.
+  intptr_t num_copied;  // For a closure.
+  uword bytecode;
+  uword start;  // Address of the first bytecode of the target.
+  uword entry;  // Its code.
+
+  // The same in every entry of the site.
+  uword ip;  // Address of the send bytecode.
+  uword hit;  // Where compiled code continues once an entry matches.
+  intptr_t victim;  // Of the first entry: the next to refill when all are.
+  intptr_t num_args;
+  bool is_self_send;  // Self and implicit receiver sends.
+};
+
+static constexpr intptr_t kSendCacheEntries = 4;
+
+class JIT::Compiler {
+ public:
+  Compiler(JIT* jit, const uint8_t* bytes, intptr_t length)
+      : jit_(jit),
+        bytes_(bytes),
+        length_(length),
+        labels_(nullptr),
+        slow_paths_(nullptr),
+        num_slow_paths_(0),
+        slow_paths_capacity_(0),
+        common_send_(nullptr) {}
+  ~Compiler() {
+    free(labels_);
+    free(slow_paths_);
+  }
+
+  bool Compile();
+
+  Assembler* assembler() { return &assembler_; }
+  void Relocate(uword address);
+  intptr_t PCOffset(intptr_t bci) const { return labels_[bci].position; }
+
+ private:
+  enum SlowPathKind {
+    kExit,  // Stop at the bytecode and let the interpreter perform it.
+    kSend,  // Have the interpreter perform the bytecode, and carry on after.
+    kProbe,  // Try the other entries of the cache of the send.
+  };
+
+  struct SlowPath {
+    Label label;
+    SlowPathKind kind;
+    intptr_t bci;
+    SendCache* cache;
+    intptr_t hit;  // For kProbe.
+  };
+
+  bool IsBytecodeStart(intptr_t bci) const {
+    return (bci >= 0) && (bci < length_) && (labels_[bci].link != -2);
+  }
+  Label* Target(intptr_t bci) {
+    if (!IsBytecodeStart(bci)) {
+      valid_ = false;
+      return &labels_[0];
+    }
+    return &labels_[bci];
+  }
+  Label* SlowPathFor(SlowPathKind kind, intptr_t bci, SendCache* cache);
+  Label* Exit(intptr_t bci) { return SlowPathFor(kExit, bci, nullptr); }
+  Label* Send(intptr_t bci) {
+    if (common_send_ != nullptr) {
+      return common_send_;
+    }
+    return SlowPathFor(kSend, bci, nullptr);
+  }
+
+  void Push(Register reg) {
+    assembler_.movq(Address(RBX, -kSlotSize), reg);
+    assembler_.subq(RBX, kSlotSize);
+  }
+  void PushSmi(intptr_t value) {
+    assembler_.movq(Address(RBX, -kSlotSize),
+                    static_cast<int32_t>(value << kSmiTagShift));
+    assembler_.subq(RBX, kSlotSize);
+  }
+  void PushInterpreterField(int32_t offset) {
+    assembler_.movq(RAX, Address(R13, offset));
+    Push(RAX);
+  }
+  void PushSlot(int32_t slot) {
+    assembler_.movq(RAX, Slot(slot));
+    Push(RAX);
+  }
+  void PopIntoSlot(int32_t slot) {
+    assembler_.movq(RAX, Address(RBX, 0));
+    assembler_.addq(RBX, kSlotSize);
+    assembler_.movq(Slot(slot), RAX);
+  }
+  void StoreIntoSlot(int32_t slot) {
+    assembler_.movq(RAX, Address(RBX, 0));
+    assembler_.movq(Slot(slot), RAX);
+  }
+  void PushLiteral(intptr_t index);
+  void JumpBackward(intptr_t bci, intptr_t target);
+  void PopJump(intptr_t bci, bool jump_if_true, intptr_t target);
+  void Return(intptr_t bci);
+  void LoadSmallIntegers(intptr_t bci);
+  void Arithmetic(intptr_t bci, uint8_t byte1);
+  void Compare(intptr_t bci, Condition condition, intptr_t next);
+  void LoadArray(Register array, intptr_t bci);
+  void At(intptr_t bci);
+  void Size(intptr_t bci);
+  void CachedSend(intptr_t bci,
+                  intptr_t next,
+                  intptr_t num_args,
+                  bool is_self_send);
+  void SlowSend(intptr_t bci);
+  void StoreIndirect(intptr_t bci, uint8_t byte1, uint8_t byte2, uint8_t byte3);
+  void CommonSend(intptr_t bci, intptr_t next, uint8_t byte1);
+  bool CompileBytecode(intptr_t bci, intptr_t next);
+
+  static bool IsPopJump(uint8_t byte1) {
+    return ((byte1 >= 32) && (byte1 <= 63)) || (byte1 == 242) ||
+           (byte1 == 243);
+  }
+
+  JIT* const jit_;
+  const uint8_t* const bytes_;
+  const intptr_t length_;
+  Assembler assembler_;
+  Label* labels_;
+  SlowPath* slow_paths_;
+  intptr_t num_slow_paths_;
+  intptr_t slow_paths_capacity_;
+  Label* common_send_;  // Where the template of a common send fails to.
+  bool valid_;
+
+  DISALLOW_COPY_AND_ASSIGN(Compiler);
+};
+
+Label* JIT::Compiler::SlowPathFor(SlowPathKind kind,
+                                  intptr_t bci,
+                                  SendCache* cache) {
+  if (num_slow_paths_ == slow_paths_capacity_) {
+    slow_paths_capacity_ =
+        slow_paths_capacity_ == 0 ? 16 : slow_paths_capacity_ * 2;
+    slow_paths_ = reinterpret_cast<SlowPath*>(
+        realloc(slow_paths_, slow_paths_capacity_ * sizeof(SlowPath)));
+    if (slow_paths_ == nullptr) {
+      FATAL("Failed to grow slow path list");
+    }
+  }
+  // Taken only by the jumps of the template being emitted, so the pointer
+  // is not used after the list grows.
+  SlowPath* path = &slow_paths_[num_slow_paths_++];
+  path->label = Label();
+  path->kind = kind;
+  path->bci = bci;
+  path->cache = cache;
+  path->hit = -1;
+  return &path->label;
+}
+
+void JIT::Compiler::PushLiteral(intptr_t index) {
+  assembler_.movq(RAX, Slot(kMethodSlot));
+  assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Method, literals_)));
+  assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Array, elements_) +
+                                        index * kSlotSize));
+  Push(RAX);
+}
+
+void JIT::Compiler::JumpBackward(intptr_t bci, intptr_t target) {
+  // Stack overflow or interrupt: the interpreter takes the jump and handles it.
+  assembler_.cmpq(RBX, Address(R13, jit_->stack_limit_offset_));
+  assembler_.j(kBelow, Exit(bci));
+  assembler_.jmp(Target(target));
+}
+
+void JIT::Compiler::PopJump(intptr_t bci, bool jump_if_true, intptr_t target) {
+  Label other;
+  int32_t jump_value = jump_if_true ? jit_->true_offset_ : jit_->false_offset_;
+  int32_t other_value = jump_if_true ? jit_->false_offset_ : jit_->true_offset_;
+  assembler_.movq(RAX, Address(RBX, 0));
+  assembler_.cmpq(RAX, Address(R13, jump_value));
+  assembler_.j(kNotEqual, &other);
+  assembler_.addq(RBX, kSlotSize);
+  assembler_.jmp(Target(target));
+  assembler_.Bind(&other);
+  // Not a Boolean: the interpreter sends #mustBeBoolean.
+  assembler_.cmpq(RAX, Address(R13, other_value));
+  assembler_.j(kNotEqual, Exit(bci));
+  assembler_.addq(RBX, kSlotSize);
+}
+
+// Returns RAX to the sender, as LOCAL_RETURN does.
+void JIT::Compiler::Return(intptr_t bci) {
+  assembler_.movq(RCX, Slot(kSavedFPSlot));
+  assembler_.testq(RCX, RCX);
+  assembler_.j(kEqual, Exit(bci));  // Base frame.
+  assembler_.movq(RDX, Slot(kSavedIPSlot));
+  // The saved SP is just above the receiver: fp + 3 + num_args.
+  assembler_.movq(RSI, Slot(kFlagsSlot));
+  assembler_.sarq(RSI, kFlagsNumArgsShift + kSmiTagShift);
+  assembler_.leaq(RBX, R12, RSI, 3 * kSlotSize);
+  assembler_.movq(R12, RCX);
+  Push(RAX);
+  assembler_.jmp(jit_->return_);
+}
+
+// Loads the receiver and argument of a binary send into RAX and RCX, going to
+// the interpreter unless both are SmallIntegers.
+void JIT::Compiler::LoadSmallIntegers(intptr_t bci) {
+  assembler_.movq(RAX, Address(RBX, kSlotSize));
+  assembler_.movq(RCX, Address(RBX, 0));
+  assembler_.movq(RDX, RAX);
+  assembler_.orq(RDX, RCX);
+  assembler_.testq(RDX, kSmiTagMask);
+  assembler_.j(kNotEqual, Send(bci));
+}
+
+void JIT::Compiler::Arithmetic(intptr_t bci, uint8_t byte1) {
+  LoadSmallIntegers(bci);
+  switch (byte1) {
+    case 176:
+      assembler_.addq(RAX, RCX);
+      assembler_.j(kOverflow, Send(bci));
+      break;
+    case 177:
+      assembler_.subq(RAX, RCX);
+      assembler_.j(kOverflow, Send(bci));
+      break;
+    case 178:
+      assembler_.sarq(RCX, kSmiTagShift);
+      assembler_.imulq(RAX, RCX);
+      assembler_.j(kOverflow, Send(bci));
+      break;
+    case 183:
+      assembler_.andq(RAX, RCX);
+      break;
+    case 184:
+      assembler_.orq(RAX, RCX);
+      break;
+    default:
+      UNREACHABLE();
+  }
+  assembler_.addq(RBX, kSlotSize);
+  assembler_.movq(Address(RBX, 0), RAX);
+}
+
+// A comparison followed by a conditional jump branches directly on the flags,
+// as the quickened bytecodes do in the interpreter. The jump keeps its own
+// template in case something else jumps to it.
+void JIT::Compiler::Compare(intptr_t bci, Condition condition, intptr_t next) {
+  LoadSmallIntegers(bci);
+  assembler_.cmpq(RAX, RCX);
+  if (IsBytecodeStart(next) && IsPopJump(bytes_[next])) {
+    uint8_t jump = bytes_[next];
+    bool jump_if_true;
+    intptr_t after;
+    intptr_t target;
+    if (jump <= 63) {
+      jump_if_true = jump <= 47;
+      after = next + 1;
+      target = after + (jump & 15);
+    } else {
+      jump_if_true = jump == 242;
+      after = next + 3;
+      target = after + ((bytes_[next + 2] << 8) | bytes_[next + 1]);
+    }
+    assembler_.leaq(RBX, Address(RBX, 2 * kSlotSize));  // Preserves flags.
+    assembler_.j(jump_if_true ? condition : Negate(condition), Target(target));
+    assembler_.jmp(Target(after));
+    return;
+  }
+  assembler_.movq(RAX, Address(R13, jit_->false_offset_));
+  assembler_.cmovq(condition, RAX, Address(R13, jit_->true_offset_));
+  assembler_.addq(RBX, kSlotSize);
+  assembler_.movq(Address(RBX, 0), RAX);
+}
+
+// Goes to the interpreter unless the object in the register is an Array.
+void JIT::Compiler::LoadArray(Register array, intptr_t bci) {
+  assembler_.testq(array, kSmiTagMask);
+  assembler_.j(kEqual, Send(bci));
+  assembler_.movq(RDX, Address(array, -kHeapObjectTag));
+  assembler_.shrq(RDX, kClassIdFieldOffset);
+  assembler_.cmpq(RDX, kArrayCid);
+  assembler_.j(kNotEqual, Send(bci));
+}
+
+void JIT::Compiler::At(intptr_t bci) {
+  assembler_.movq(RAX, Address(RBX, kSlotSize));
+  assembler_.movq(RCX, Address(RBX, 0));
+  assembler_.testq(RCX, kSmiTagMask);
+  assembler_.j(kNotEqual, Send(bci));
+  LoadArray(RAX, bci);
+  // Zero-based index, still tagged. Negative indices compare as large.
+  assembler_.subq(RCX, static_cast<int32_t>(1 << kSmiTagShift));
+  assembler_.cmpq(RCX, Address(RAX, TAGGED_OFFSET(Array, size_)));
+  assembler_.j(kAboveEqual, Send(bci));
+  assembler_.shlq(RCX, kWordSizeLog2 - kSmiTagShift);
+  assembler_.addq(RAX, RCX);
+  assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Array, elements_)));
+  assembler_.addq(RBX, kSlotSize);
+  assembler_.movq(Address(RBX, 0), RAX);
+}
+
+void JIT::Compiler::Size(intptr_t bci) {
+  assembler_.movq(RAX, Address(RBX, 0));
+  LoadArray(RAX, bci);
+  assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Array, size_)));
+  assembler_.movq(Address(RBX, 0), RAX);
+}
+
+void JIT::Compiler::CachedSend(intptr_t bci,
+                               intptr_t next,
+                               intptr_t num_args,
+                               bool is_self_send) {
+  SendCache* cache = jit_->AllocateSendCache();
+  if (cache == nullptr) {
+    valid_ = false;
+    return;
+  }
+  for (intptr_t i = 0; i < kSendCacheEntries; i++) {
+    cache[i].cid = kIllegalCid;
+    cache[i].caller = 0;
+    cache[i].ip = reinterpret_cast<uword>(&bytes_[bci]);
+    cache[i].victim = 0;
+    cache[i].num_args = num_args;
+    cache[i].is_self_send = is_self_send;
+  }
+  Label* miss = SlowPathFor(kProbe, bci, cache);
+  SlowPath* path = &slow_paths_[num_slow_paths_ - 1];
+
+  // Class id of the receiver into RCX.
+  Label have_cid;
+  if (is_self_send) {
+    assembler_.movq(RAX, Slot(kReceiverSlot));
+  } else {
+    assembler_.movq(RAX, Address(RBX, num_args * kSlotSize));
+  }
+  assembler_.movl(RCX, kSmallIntegerCid);
+  assembler_.testq(RAX, kSmiTagMask);
+  assembler_.j(kEqual, &have_cid);
+  assembler_.movq(RCX, Address(RAX, -kHeapObjectTag));
+  assembler_.shrq(RCX, kClassIdFieldOffset);
+  assembler_.Bind(&have_cid);
+
+  // The first entry. The probe stub for the others continues here with the
+  // matching entry in RDX.
+  assembler_.movq(RDX, reinterpret_cast<uword>(cache));
+  assembler_.cmpq(RCX, Address(RDX, offsetof(SendCache, cid)));
+  assembler_.j(kNotEqual, miss);
+  assembler_.movq(RSI, Slot(kMethodSlot));
+  assembler_.cmpq(RSI, Address(RDX, offsetof(SendCache, caller)));
+  assembler_.j(kNotEqual, miss);
+  path->hit = assembler_.size();
+
+  Label accessor;
+  if (num_args <= 1) {
+    assembler_.movq(RCX, Address(RDX, offsetof(SendCache, accessor)));
+    assembler_.testq(RCX, RCX);
+    assembler_.j(kNotEqual, &accessor);
+  }
+
+  if (is_self_send) {
+    // As Interpreter::InsertAbsentReceiver.
+    assembler_.subq(RBX, kSlotSize);
+    for (intptr_t i = 0; i < num_args; i++) {
+      assembler_.movq(RCX, Address(RBX, (i + 1) * kSlotSize));
+      assembler_.movq(Address(RBX, i * kSlotSize), RCX);
+    }
+    assembler_.movq(Address(RBX, num_args * kSlotSize), RAX);
+  }
+  assembler_.leaq(RSI, Address(R14, next));
+  assembler_.jmp(Address(RDX, offsetof(SendCache, activate)));
+
+  if (num_args == 0) {
+    // Getter.
+    assembler_.Bind(&accessor);
+    assembler_.addq(RCX, RAX);
+    assembler_.movq(RCX, Address(RCX, 0));
+    if (is_self_send) {
+      Push(RCX);
+    } else {
+      assembler_.movq(Address(RBX, 0), RCX);
+    }
+    assembler_.jmp(Target(next));
+  } else if (num_args == 1) {
+    // Setter, answering the receiver. Only stores that need no write barrier
+    // are done here: of a SmallInteger, or into an object in new-space. The
+    // interpreter does the others.
+    Label store, barrier;
+    assembler_.Bind(&accessor);
+    assembler_.movq(RSI, Address(RBX, 0));
+    assembler_.testq(RSI, kSmiTagMask);
+    assembler_.j(kEqual, &store);
+    assembler_.testq(RAX, kNewObjectAlignmentOffset);
+    assembler_.j(kEqual, &barrier);
+    assembler_.Bind(&store);
+    assembler_.addq(RCX, RAX);
+    assembler_.movq(Address(RCX, 0), RSI);
+    if (is_self_send) {
+      assembler_.movq(Address(RBX, 0), RAX);
+    } else {
+      assembler_.addq(RBX, kSlotSize);
+    }
+    assembler_.jmp(Target(next));
+    assembler_.Bind(&barrier);
+    if (is_self_send) {
+      assembler_.subq(RBX, kSlotSize);
+      assembler_.movq(Address(RBX, 0), RSI);
+      assembler_.movq(Address(RBX, kSlotSize), RAX);
+    }
+    assembler_.leaq(RSI, Address(R14, next));
+    assembler_.jmp(jit_->invoke_);
+  }
+}
+
+void JIT::Compiler::SlowSend(intptr_t bci) {
+  assembler_.jmp(Send(bci));
+}
+
+// Stores into a local of an outer scope. As for a setter, only stores that
+// need no write barrier are done here.
+void JIT::Compiler::StoreIndirect(intptr_t bci,
+                                  uint8_t byte1,
+                                  uint8_t byte2,
+                                  uint8_t byte3) {
+  Label store;
+  assembler_.movq(RAX, Slot(kFirstLocalSlot - byte3));
+  assembler_.movq(RCX, Address(RBX, 0));
+  assembler_.testq(RCX, kSmiTagMask);
+  assembler_.j(kEqual, &store);
+  assembler_.testq(RAX, kNewObjectAlignmentOffset);
+  assembler_.j(kEqual, Send(bci));
+  assembler_.Bind(&store);
+  assembler_.movq(Address(RAX, TAGGED_OFFSET(Array, elements_) +
+                                   byte2 * kSlotSize),
+                  RCX);
+  if (byte1 == 246) {
+    assembler_.addq(RBX, kSlotSize);
+  }
+}
+
+// The common sends that have a template fall back to an ordinary cached send
+// when its operands are not the ones it handles, as do those without one.
+void JIT::Compiler::CommonSend(intptr_t bci, intptr_t next, uint8_t byte1) {
+  Label send;
+  common_send_ = &send;
+  switch (byte1) {
+    case 176: case 177: case 178: case 183: case 184:
+      Arithmetic(bci, byte1);
+      break;
+    case 185: case 208:
+      Compare(bci, kLess, next);
+      break;
+    case 186: case 209:
+      Compare(bci, kGreater, next);
+      break;
+    case 187: case 210:
+      Compare(bci, kLessEqual, next);
+      break;
+    case 188: case 211:
+      Compare(bci, kGreaterEqual, next);
+      break;
+    case 189: case 212:
+      Compare(bci, kEqual, next);
+      break;
+    case 192:
+      At(bci);
+      break;
+    case 194:
+      Size(bci);
+      break;
+    default:
+      assembler_.jmp(&send);
+      break;
+  }
+  common_send_ = nullptr;
+  if (send.link == -1) {
+    return;  // The template never sends.
+  }
+  assembler_.jmp(Target(next));
+  assembler_.Bind(&send);
+
+  intptr_t offset = byte1 >= 208 ? byte1 - 208 + 185 - 176 : byte1 - 176;
+  Array common_selectors =
+      jit_->interpreter_->object_store()->common_selectors();
+  SmallInteger arity =
+      SmallInteger::Cast(common_selectors->element(offset * 2 + 1));
+  ASSERT(arity->IsSmallInteger());
+  CachedSend(bci, next, arity->value(), false);
+}
+
+bool JIT::Compiler::CompileBytecode(intptr_t bci, intptr_t next) {
+  uint8_t byte1 = bytes_[bci];
+  uint8_t byte2 = next - bci > 1 ? bytes_[bci + 1] : 0;
+  uint8_t byte3 = next - bci > 2 ? bytes_[bci + 2] : 0;
+  if (byte1 <= 15) {
+    JumpBackward(bci, next - (byte1 & 15));
+  } else if (byte1 <= 31) {
+    assembler_.jmp(Target(next + (byte1 & 15)));
+  } else if (byte1 <= 63) {
+    PopJump(bci, byte1 <= 47, next + (byte1 & 15));
+  } else if (byte1 <= 79) {
+    CachedSend(bci, next, (byte1 >> 3) & 1, false);
+  } else if (byte1 <= 111) {
+    CachedSend(bci, next, (byte1 >> 3) & 1, true);
+  } else if (byte1 <= 119) {
+    PushSlot(kSavedIPSlot + (byte1 & 7));
+  } else if (byte1 <= 127) {
+    PushSlot(kFirstLocalSlot - (byte1 & 7));
+  } else if (byte1 <= 135) {
+    PopIntoSlot(kFirstLocalSlot - (byte1 & 7));
+  } else if (byte1 <= 143) {
+    StoreIntoSlot(kFirstLocalSlot - (byte1 & 7));
+  } else if (byte1 <= 151) {
+    PushLiteral(byte1 & 7);
+  } else {
+    switch (byte1) {
+      case 152:
+        PushInterpreterField(jit_->nil_offset_);
+        break;
+      case 153:
+        PushInterpreterField(jit_->false_offset_);
+        break;
+      case 154:
+        PushInterpreterField(jit_->true_offset_);
+        break;
+      case 155:
+        PushSlot(kReceiverSlot);
+        break;
+      case 156:
+        assembler_.movq(RAX, Slot(kMethodSlot));
+        assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Method, mixin_)));
+        Push(RAX);
+        break;
+      case 158:
+        assembler_.addq(RBX, kSlotSize);
+        break;
+      case 159:
+        assembler_.movq(RAX, Address(RBX, 0));
+        Push(RAX);
+        break;
+      case 160: case 161: case 162: case 163:
+        PushSmi(byte1 - 161);
+        break;
+      case 166:
+        assembler_.movq(RAX, Address(R13, jit_->nil_offset_));
+        Return(bci);
+        break;
+      case 167:
+        assembler_.movq(RAX, Address(R13, jit_->false_offset_));
+        Return(bci);
+        break;
+      case 168:
+        assembler_.movq(RAX, Address(R13, jit_->true_offset_));
+        Return(bci);
+        break;
+      case 169:
+        assembler_.movq(RAX, Slot(kReceiverSlot));
+        Return(bci);
+        break;
+      case 170:
+        assembler_.movq(RAX, Address(RBX, 0));
+        Return(bci);
+        break;
+      case 176: case 177: case 178: case 179:
+      case 180: case 181: case 182: case 183:
+      case 184: case 185: case 186: case 187:
+      case 188: case 189: case 190: case 191:
+      case 192: case 193: case 194: case 195:
+      case 196: case 197: case 198: case 199:
+      case 200: case 201: case 202: case 203:
+      case 204: case 205: case 206: case 207:
+      case 208: case 209: case 210: case 211: case 212:
+        CommonSend(bci, next, byte1);
+        break;
+      case 171: case 172: case 173: case 174: case 175:
+      case 222: case 223: case 233: case 239:
+      case 252: case 254: case 255:
+        // Non-local returns, array literals, enclosing objects, eventual,
+        // super and outer sends, and closures.
+        SlowSend(bci);
+        break;
+      case 228:
+        PushSlot(kSavedIPSlot + byte2);
+        break;
+      case 229:
+        PushSlot(kFirstLocalSlot - byte2);
+        break;
+      case 230:
+        PopIntoSlot(kFirstLocalSlot - byte2);
+        break;
+      case 231:
+        StoreIntoSlot(kFirstLocalSlot - byte2);
+        break;
+      case 240:
+        JumpBackward(bci, next - ((byte3 << 8) | byte2));
+        break;
+      case 241:
+        assembler_.jmp(Target(next + ((byte3 << 8) | byte2)));
+        break;
+      case 242: case 243:
+        PopJump(bci, byte1 == 242, next + ((byte3 << 8) | byte2));
+        break;
+      case 245:
+        assembler_.movq(RAX, Slot(kFirstLocalSlot - byte3));
+        assembler_.movq(RAX, Address(RAX, TAGGED_OFFSET(Array, elements_) +
+                                              byte2 * kSlotSize));
+        Push(RAX);
+        break;
+      case 246: case 247:
+        StoreIndirect(bci, byte1, byte2, byte3);
+        break;
+      case 248:
+        PushLiteral((byte3 << 8) | byte2);
+        break;
+      case 249:
+        PushSmi((static_cast<intptr_t>(static_cast<int8_t>(byte3)) << 8) |
+                byte2);
+        break;
+      case 250:
+        CachedSend(bci, next, byte3 >> 4, false);
+        break;
+      case 251: case 253:
+        CachedSend(bci, next, byte3 >> 4, true);
+        break;
+      default:
+        assembler_.jmp(Exit(bci));
+        break;
+    }
+  }
+  return valid_;
+}
+
+bool JIT::Compiler::Compile() {
+  // Every bytecode gets a label, since the interpreter may hand over at any of
+  // them. Positions that are not the start of a bytecode are marked with a
+  // link that no unbound label has.
+  labels_ = reinterpret_cast<Label*>(malloc(length_ * sizeof(Label)));
+  if (labels_ == nullptr) {
+    FATAL("Failed to allocate labels");
+  }
+  for (intptr_t i = 0; i < length_; i++) {
+    labels_[i] = Label();
+    labels_[i].link = -2;
+  }
+  intptr_t bci = 0;
+  while (bci < length_) {
+    labels_[bci].link = -1;
+    bci += Interpreter::BytecodeSize(bytes_[bci]);
+  }
+  if (bci != length_) {
+    return false;  // Truncated final bytecode.
+  }
+
+  valid_ = true;
+  bci = 0;
+  while (bci < length_) {
+    intptr_t next = bci + Interpreter::BytecodeSize(bytes_[bci]);
+    assembler_.Bind(&labels_[bci]);
+    if (!CompileBytecode(bci, next)) {
+      return false;
+    }
+    bci = next;
+  }
+  // The compiler does not produce methods that run off the end, but leave
+  // whatever happens then to the interpreter.
+  assembler_.jmp(Exit(length_));
+
+  for (intptr_t i = 0; i < num_slow_paths_; i++) {
+    SlowPath* path = &slow_paths_[i];
+    assembler_.Bind(&path->label);
+    if (path->kind == kProbe) {
+      assembler_.jmp(jit_->probe_entries_);
+      continue;
+    }
+    assembler_.leaq(RAX, Address(R14, path->bci));
+    if (path->kind == kExit) {
+      assembler_.jmp(jit_->exit_);
+    } else {
+      if (path->cache == nullptr) {
+        assembler_.movl(RDX, 0);
+      } else {
+        assembler_.movq(RDX, reinterpret_cast<uword>(path->cache));
+      }
+      assembler_.jmp(jit_->send_);
+    }
+  }
+  return true;
+}
+
+// Points the send caches at the code, once it is installed at address.
+void JIT::Compiler::Relocate(uword address) {
+  for (intptr_t i = 0; i < num_slow_paths_; i++) {
+    SlowPath* path = &slow_paths_[i];
+    if (path->kind == kProbe) {
+      for (intptr_t j = 0; j < kSendCacheEntries; j++) {
+        path->cache[j].hit = address + path->hit;
+      }
+    }
+  }
+}
+
+static int32_t FieldOffset(const Interpreter* interpreter,
+                           const volatile void* field) {
+  return static_cast<int32_t>(reinterpret_cast<uword>(field) -
+                              reinterpret_cast<uword>(interpreter));
+}
+
+JIT::JIT(Interpreter* interpreter)
+    : interpreter_(interpreter),
+      code_(VirtualMemory::Allocate(kCodeSize,
+                                    VirtualMemory::kReadWrite,
+                                    "primordialsoup-code")),
+      data_(VirtualMemory::Allocate(kDataSize,
+                                    VirtualMemory::kReadWrite,
+                                    "primordialsoup-code-data")),
+      code_top_(0),
+      code_stubs_end_(0),
+      data_top_(0),
+      ip_cache_(reinterpret_cast<IPCacheEntry*>(data_.base())),
+      epoch_(0),
+      reset_pending_(false),
+      ip_offset_(FieldOffset(interpreter, &interpreter->ip_)),
+      sp_offset_(FieldOffset(interpreter, &interpreter->sp_)),
+      fp_offset_(FieldOffset(interpreter, &interpreter->fp_)),
+      stack_limit_offset_(
+          FieldOffset(interpreter, &interpreter->checked_stack_limit_)),
+      nil_offset_(FieldOffset(interpreter, &interpreter->nil_)),
+      false_offset_(FieldOffset(interpreter, &interpreter->false_)),
+      true_offset_(FieldOffset(interpreter, &interpreter->true_)),
+      enter_(nullptr),
+      exit_(0),
+      exit_at_rdx_(0),
+      transfer_(0),
+      return_(0),
+      send_(0),
+      activate_(0),
+      activate_closure_(0),
+      invoke_(0),
+      probe_entries_(0) {
+  COMPILE_ASSERT(sizeof(IPCacheEntry) == 32);
+  for (intptr_t i = 0; i < kCodeTableSize; i++) {
+    code_table_[i] = nullptr;
+  }
+  GenerateStubs();
+  if (!code_.Protect(VirtualMemory::kReadExecute)) {
+    FATAL("Failed to protect code");
+  }
+  Reset();
+}
+
+JIT::~JIT() {
+  Flush();
+  code_.Free();
+  data_.Free();
+}
+
+void JIT::Run() {
+  // Nothing the interpreter calls while compiled code is on the C stack
+  // re-enters the interpreter, so there is no compiled code to keep here.
+  if (reset_pending_) {
+    Reset();
+  }
+  enter_(interpreter_);
+}
+
+void JIT::Flush() {
+  for (intptr_t i = 0; i < kCodeTableSize; i++) {
+    CompiledCode* code = code_table_[i];
+    while (code != nullptr) {
+      CompiledCode* next = code->next;
+      free(code);
+      code = next;
+    }
+    code_table_[i] = nullptr;
+  }
+  memset(ip_cache_, 0, kIPCacheSize * sizeof(IPCacheEntry));
+  epoch_++;
+  reset_pending_ = true;
+}
+
+void JIT::Invalidate(ByteArray bytes) {
+  uword start = reinterpret_cast<uword>(bytes->element_addr(0));
+  intptr_t hash = (start >> kObjectAlignmentLog2) & kCodeTableMask;
+  for (CompiledCode* code = code_table_[hash];
+       code != nullptr;
+       code = code->next) {
+    if (code->bytecode == start) {
+      Flush();
+      return;
+    }
+  }
+}
+
+void JIT::Reset() {
+  Flush();
+  code_top_ = code_stubs_end_;
+  data_top_ = data_.base() + kIPCacheSize * sizeof(IPCacheEntry);
+  reset_pending_ = false;
+}
+
+void JIT::GenerateStubs() {
+  Assembler assembler;
+  Label enter, transfer, probe, miss, exit_at_rdx, exit, leave, send, activate;
+  Label nils_loop, nils_done, overflow;
+  Label activate_closure, copied_loop, other_closure, invoke;
+  Label probe_entries, found_entry;
+  uword jit = reinterpret_cast<uword>(this);
+
+  // Enter(Interpreter*): saves the C++ registers and continues at the
+  // interpreter's state.
+  assembler.Bind(&enter);
+  assembler.pushq(RBP);
+  assembler.pushq(RBX);
+  assembler.pushq(R12);
+  assembler.pushq(R13);
+  assembler.pushq(R14);
+  assembler.pushq(R15);
+  assembler.subq(RSP, kSlotSize);  // Aligns calls to 16 bytes.
+  assembler.movq(R13, RDI);
+
+  // Transfer: loads the interpreter's state, which a call out may have changed.
+  assembler.Bind(&transfer);
+  assembler.movq(RBX, Address(R13, sp_offset_));
+  assembler.movq(R12, Address(R13, fp_offset_));
+  assembler.movq(RDX, Address(R13, ip_offset_));
+
+  // Return: continues at the bytecode at RDX in the frame at R12.
+  assembler.Bind(&probe);
+  assembler.movq(RCX, RDX);
+  assembler.andq(RCX, kIPCacheMask);
+  assembler.shlq(RCX, 5);
+  assembler.movq(RSI, reinterpret_cast<uword>(ip_cache_));
+  assembler.addq(RCX, RSI);
+  assembler.cmpq(RDX, Address(RCX, offsetof(IPCacheEntry, ip)));
+  assembler.j(kNotEqual, &miss);
+  assembler.movq(R14, RDX);
+  assembler.subq(R14, Address(RCX, offsetof(IPCacheEntry, offset)));
+  assembler.jmp(Address(RCX, offsetof(IPCacheEntry, pc)));
+  assembler.Bind(&miss);
+  assembler.movq(Address(R13, ip_offset_), RDX);
+  assembler.movq(Address(R13, sp_offset_), RBX);
+  assembler.movq(Address(R13, fp_offset_), R12);
+  assembler.movq(RDI, jit);
+  assembler.movq(RAX, reinterpret_cast<uword>(&JIT::Miss));
+  assembler.call(RAX);
+  assembler.andq(RAX, 0xFF);
+  assembler.j(kNotEqual, &transfer);
+  assembler.jmp(&leave);
+
+  // Exit: stops at the bytecode at RAX, or RDX, and returns to the
+  // interpreter.
+  assembler.Bind(&exit_at_rdx);
+  assembler.movq(RAX, RDX);
+  assembler.Bind(&exit);
+  assembler.movq(Address(R13, ip_offset_), RAX);
+  assembler.movq(Address(R13, sp_offset_), RBX);
+  assembler.movq(Address(R13, fp_offset_), R12);
+  assembler.Bind(&leave);
+  assembler.addq(RSP, kSlotSize);
+  assembler.popq(R15);
+  assembler.popq(R14);
+  assembler.popq(R13);
+  assembler.popq(R12);
+  assembler.popq(RBX);
+  assembler.popq(RBP);
+  assembler.ret();
+
+  // Send: has the interpreter perform the send or other bytecode at RAX, and
+  // fill the SendCache at RDX, if any.
+  assembler.Bind(&send);
+  assembler.movq(Address(R13, ip_offset_), RAX);
+  assembler.movq(Address(R13, sp_offset_), RBX);
+  assembler.movq(Address(R13, fp_offset_), R12);
+  assembler.movq(RDI, jit);
+  assembler.movq(RSI, RDX);
+  assembler.movq(RAX, reinterpret_cast<uword>(&JIT::Send));
+  assembler.call(RAX);
+  assembler.jmp(&transfer);
+
+  // ProbeEntries: looks for the class id in RCX and the sender among the other
+  // entries of the SendCache at RDX, after the first, and continues at the
+  // send site with the matching entry in RDX. Otherwise has the interpreter
+  // perform the send.
+  assembler.Bind(&probe_entries);
+  assembler.movq(RSI, Slot(kMethodSlot));
+  for (intptr_t i = 1; i < kSendCacheEntries; i++) {
+    Label next_entry;
+    assembler.addq(RDX, sizeof(SendCache));
+    assembler.cmpq(RCX, Address(RDX, offsetof(SendCache, cid)));
+    assembler.j(kNotEqual, &next_entry);
+    assembler.cmpq(RSI, Address(RDX, offsetof(SendCache, caller)));
+    assembler.j(kEqual, &found_entry);
+    assembler.Bind(&next_entry);
+  }
+  assembler.subq(RDX, (kSendCacheEntries - 1) * sizeof(SendCache));
+  assembler.movq(RAX, Address(RDX, offsetof(SendCache, ip)));
+  assembler.jmp(&send);
+  assembler.Bind(&found_entry);
+  assembler.jmp(Address(RDX, offsetof(SendCache, hit)));
+
+  // Activate: builds a frame for the target of the SendCache at RDX, with the
+  // receiver in RAX and the return IP in RSI, as Interpreter::Activate does.
+  assembler.Bind(&activate);
+  assembler.movq(Address(RBX, -kSlotSize), RSI);
+  assembler.movq(Address(RBX, -2 * kSlotSize), R12);
+  assembler.leaq(R12, Address(RBX, -2 * kSlotSize));
+  assembler.movq(RCX, Address(RDX, offsetof(SendCache, flags)));
+  assembler.movq(Slot(kFlagsSlot), RCX);
+  assembler.movq(RCX, Address(RDX, offsetof(SendCache, target)));
+  assembler.movq(Slot(kMethodSlot), RCX);
+  assembler.movq(Slot(kActivationSlot), 0);
+  assembler.movq(Slot(kReceiverSlot), RAX);
+  assembler.leaq(RBX, Slot(kReceiverSlot));
+  assembler.movq(RCX, Address(RDX, offsetof(SendCache, num_nils)));
+  assembler.testq(RCX, RCX);
+  assembler.j(kEqual, &nils_done);
+  assembler.movq(RAX, Address(R13, nil_offset_));
+  assembler.Bind(&nils_loop);
+  assembler.subq(RBX, kSlotSize);
+  assembler.movq(Address(RBX, 0), RAX);
+  assembler.subq(RCX, 1);
+  assembler.j(kNotEqual, &nils_loop);
+  assembler.Bind(&nils_done);
+  Label check_stack;
+  assembler.Bind(&check_stack);
+  assembler.movq(R14, Address(RDX, offsetof(SendCache, bytecode)));
+  assembler.cmpq(RBX, Address(R13, stack_limit_offset_));
+  assembler.j(kBelow, &overflow);
+  assembler.jmp(Address(RDX, offsetof(SendCache, entry)));
+
+  // ActivateClosure: builds a frame for the closure in RAX, with the return IP
+  // in RSI, as Interpreter::ActivateClosure does, if it is of the block in the
+  // SendCache at RDX. Otherwise has the interpreter perform the send.
+  assembler.Bind(&activate_closure);
+  assembler.movq(RCX,
+                 Address(RAX, TAGGED_OFFSET(Closure, defining_activation_)));
+  assembler.movq(RDI, Address(RCX, TAGGED_OFFSET(Activation, method_)));
+  assembler.cmpq(RDI, Address(RDX, offsetof(SendCache, target)));
+  assembler.j(kNotEqual, &other_closure);
+  assembler.movq(RDI, Address(RAX, TAGGED_OFFSET(Closure, initial_bci_)));
+  assembler.cmpq(RDI, Address(RDX, offsetof(SendCache, initial_bci)));
+  assembler.j(kNotEqual, &other_closure);
+  assembler.movq(Address(RBX, -kSlotSize), RSI);
+  assembler.movq(Address(RBX, -2 * kSlotSize), R12);
+  assembler.leaq(R12, Address(RBX, -2 * kSlotSize));
+  assembler.movq(RDI, Address(RDX, offsetof(SendCache, flags)));
+  assembler.movq(Slot(kFlagsSlot), RDI);
+  assembler.movq(RDI, Address(RDX, offsetof(SendCache, target)));
+  assembler.movq(Slot(kMethodSlot), RDI);
+  assembler.movq(Slot(kActivationSlot), 0);
+  assembler.movq(RDI, Address(RCX, TAGGED_OFFSET(Activation, receiver_)));
+  assembler.movq(Slot(kReceiverSlot), RDI);
+  assembler.leaq(RBX, Slot(kReceiverSlot));
+  assembler.movq(RCX, Address(RDX, offsetof(SendCache, num_copied)));
+  assembler.testq(RCX, RCX);
+  assembler.j(kEqual, &check_stack);
+  assembler.addq(RAX, TAGGED_OFFSET(Closure, copied_));
+  assembler.Bind(&copied_loop);
+  assembler.movq(RDI, Address(RAX, 0));
+  assembler.subq(RBX, kSlotSize);
+  assembler.movq(Address(RBX, 0), RDI);
+  assembler.addq(RAX, kSlotSize);
+  assembler.subq(RCX, 1);
+  assembler.j(kNotEqual, &copied_loop);
+  assembler.jmp(&check_stack);
+  assembler.Bind(&other_closure);
+  assembler.movq(RAX, Address(RDX, offsetof(SendCache, ip)));
+  assembler.jmp(&send);
+
+  // Invoke: has the interpreter activate the target of the SendCache at RDX,
+  // with the return IP in RSI.
+  assembler.Bind(&invoke);
+  assembler.movq(Address(R13, ip_offset_), RSI);
+  assembler.movq(Address(R13, sp_offset_), RBX);
+  assembler.movq(Address(R13, fp_offset_), R12);
+  assembler.movq(RDI, jit);
+  assembler.movq(RSI, RDX);
+  assembler.movq(RAX, reinterpret_cast<uword>(&JIT::Invoke));
+  assembler.call(RAX);
+  assembler.jmp(&transfer);
+
+  assembler.Bind(&overflow);
+  assembler.movq(RAX, Address(RDX, offsetof(SendCache, start)));
+  assembler.movq(Address(R13, ip_offset_), RAX);
+  assembler.movq(Address(R13, sp_offset_), RBX);
+  assembler.movq(Address(R13, fp_offset_), R12);
+  assembler.movq(RDI, jit);
+  assembler.movq(RAX, reinterpret_cast<uword>(&JIT::StackOverflowOrInterrupt));
+  assembler.call(RAX);
+  assembler.jmp(&transfer);
+
+  uword base = code_.base();
+  assembler.FinalizeInto(base);
+  enter_ = reinterpret_cast<void (*)(Interpreter*)>(base + enter.position);
+  exit_ = base + exit.position;
+  exit_at_rdx_ = base + exit_at_rdx.position;
+  transfer_ = base + transfer.position;
+  return_ = base + probe.position;
+  send_ = base + send.position;
+  activate_ = base + activate.position;
+  activate_closure_ = base + activate_closure.position;
+  invoke_ = base + invoke.position;
+  probe_entries_ = base + probe_entries.position;
+  code_stubs_end_ = base + assembler.size();
+}
+
+CompiledCode* JIT::CodeFor(ByteArray bytecode) {
+  ASSERT(bytecode->IsOldObject());
+  uword start = reinterpret_cast<uword>(bytecode->element_addr(0));
+  intptr_t hash = (start >> kObjectAlignmentLog2) & kCodeTableMask;
+  for (CompiledCode* code = code_table_[hash];
+       code != nullptr;
+       code = code->next) {
+    if (code->bytecode == start) {
+      return code->length == 0 ? nullptr : code;
+    }
+  }
+  if (reset_pending_) {
+    return nullptr;  // Wait for the space to be reclaimed.
+  }
+
+  intptr_t length = bytecode->Size();
+  if (length == 0) {
+    return nullptr;
+  }
+  // Compiling does not allocate in the heap, so the bytes cannot move.
+  Compiler compiler(this, bytecode->element_addr(0), length);
+  if (!compiler.Compile()) {
+    if (!reset_pending_) {
+      // Remember that it cannot be compiled, rather than trying every time.
+      CompiledCode* code =
+          reinterpret_cast<CompiledCode*>(malloc(sizeof(CompiledCode)));
+      if (code == nullptr) {
+        FATAL("Failed to allocate compiled code");
+      }
+      code->bytecode = start;
+      code->length = 0;
+      code->next = code_table_[hash];
+      code_table_[hash] = code;
+    }
+    return nullptr;
+  }
+  uword address = Install(compiler.assembler());
+  if (address == 0) {
+    return nullptr;
+  }
+  compiler.Relocate(address);
+
+  CompiledCode* code = reinterpret_cast<CompiledCode*>(
+      malloc(sizeof(CompiledCode) + length * sizeof(uword)));
+  if (code == nullptr) {
+    FATAL("Failed to allocate compiled code");
+  }
+  code->bytecode = start;
+  code->length = length;
+  for (intptr_t i = 0; i < length; i++) {
+    intptr_t offset = compiler.PCOffset(i);
+    code->pcs[i] = offset < 0 ? 0 : address + offset;
+  }
+  code->next = code_table_[hash];
+  code_table_[hash] = code;
+  return code;
+}
+
+uword JIT::Install(Assembler* assembler) {
+  uword address = Utils::RoundUp(code_top_, 16);
+  if (address + assembler->size() > code_.limit()) {
+    reset_pending_ = true;
+    return 0;
+  }
+  if (!code_.Protect(VirtualMemory::kReadWrite)) {
+    FATAL("Failed to unprotect code");
+  }
+  assembler->FinalizeInto(address);
+  if (!code_.Protect(VirtualMemory::kReadExecute)) {
+    FATAL("Failed to protect code");
+  }
+  code_top_ = address + assembler->size();
+  return address;
+}
+
+SendCache* JIT::AllocateSendCache() {
+  uword address = Utils::RoundUp(data_top_, sizeof(uword));
+  uword size = kSendCacheEntries * sizeof(SendCache);
+  if (address + size > data_.limit()) {
+    reset_pending_ = true;
+    return nullptr;
+  }
+  data_top_ = address + size;
+  return reinterpret_cast<SendCache*>(address);
+}
+
+void JIT::InsertIP(const uint8_t* ip, uword pc, intptr_t offset) {
+  IPCacheEntry* entry =
+      &ip_cache_[reinterpret_cast<uword>(ip) & kIPCacheMask];
+  entry->ip = ip;
+  entry->pc = pc;
+  entry->offset = offset;
+}
+
+bool JIT::Miss(JIT* jit) {
+  Interpreter* I = jit->interpreter_;
+  const uint8_t* ip = I->ip_;
+  Method method = Method::Cast(I->fp_[kMethodSlot]);
+  ByteArray bytecode = method->bytecode();
+  if (!bytecode->IsByteArray()) {
+    return false;
+  }
+  intptr_t offset = ip - bytecode->element_addr(0);
+  if ((offset < 0) || (offset >= bytecode->Size())) {
+    return false;
+  }
+  if (!bytecode->IsOldObject()) {
+    // Not worth compiling before it is promoted, when its address changes.
+    jit->InsertIP(ip, jit->exit_at_rdx_, 0);
+    return false;
+  }
+  CompiledCode* code = jit->CodeFor(bytecode);
+  if ((code == nullptr) || (code->pcs[offset] == 0)) {
+    if (!jit->reset_pending_) {
+      // Left to the interpreter until the next flush.
+      jit->InsertIP(ip, jit->exit_at_rdx_, 0);
+    }
+    return false;
+  }
+  jit->InsertIP(ip, code->pcs[offset], offset);
+  return true;
+}
+
+// The entry of a site's cache to fill for the class id and sender: the one
+// they already have, else an empty one, else each of the others in turn.
+static SendCache* EntryFor(SendCache* cache, intptr_t cid, Method caller) {
+  for (intptr_t i = 0; i < kSendCacheEntries; i++) {
+    if ((cache[i].cid == cid) &&
+        (cache[i].caller == static_cast<uword>(caller))) {
+      return &cache[i];
+    }
+  }
+  for (intptr_t i = 0; i < kSendCacheEntries; i++) {
+    if (cache[i].cid == kIllegalCid) {
+      return &cache[i];
+    }
+  }
+  intptr_t victim = cache->victim;
+  cache->victim = (victim + 1) % kSendCacheEntries;
+  return &cache[victim];
+}
+
+void JIT::Send(JIT* jit, SendCache* cache) {
+  Interpreter* I = jit->interpreter_;
+  if (cache == nullptr) {
+    I->PerformBytecode();  // SAFEPOINT
+    return;
+  }
+
+  Object* fp = I->fp_;
+  Object receiver = cache->is_self_send ? fp[kReceiverSlot]
+                                        : I->sp_[cache->num_args];
+  intptr_t cid = receiver->ClassId();
+  Method caller = Method::Cast(fp[kMethodSlot]);
+  const uint8_t* next_ip = I->ip_ + Interpreter::BytecodeSize(*I->ip_);
+  intptr_t epoch = jit->epoch_;
+
+  // The block of a closure receiver, taken before the send may move it.
+  Method home_method = nullptr;
+  SmallInteger initial_bci = SmallInteger::New(0);
+  intptr_t num_copied = 0;
+  if ((cid == kClosureCid) && !cache->is_self_send &&
+      (Closure::Cast(receiver)->num_args() ==
+       SmallInteger::New(cache->num_args))) {
+    Closure closure = Closure::Cast(receiver);
+    home_method = closure->defining_activation()->method();
+    initial_bci = closure->initial_bci();
+    num_copied = closure->NumCopied();
+  }
+
+  I->PerformBytecode();  // SAFEPOINT
+
+  // Fill the cache from the interpreter's inline cache, which now has the
+  // outcome of this send, unless a collection may have moved the sender.
+  if ((jit->epoch_ != epoch) || !caller->IsOldObject()) {
+    return;
+  }
+  Object absent_receiver;
+  Method target;
+  if (!I->inline_cache_.Lookup(next_ip, caller, cid, &absent_receiver,
+                               &target)) {
+    return;
+  }
+  if (!target->IsOldObject() ||
+      ((absent_receiver != nullptr) &&
+       (!cache->is_self_send || !absent_receiver->IsOldObject()))) {
+    return;
+  }
+  intptr_t num_args = target->NumArgs();
+  ASSERT(num_args == cache->num_args);
+  cache = EntryFor(cache, cid, caller);
+  intptr_t prim = target->Primitive();
+  if (Primitives::IsClosureValue(prim) && (home_method != nullptr) &&
+      jit->FillClosureCache(cache, caller, home_method, initial_bci,
+                            num_copied)) {
+    return;
+  }
+  CompiledCode* code = nullptr;
+  if (absent_receiver == nullptr) {
+    if (prim == 0) {
+      ByteArray bytecode = target->bytecode();
+      if (bytecode->IsByteArray() && bytecode->IsOldObject()) {
+        code = jit->CodeFor(bytecode);
+      }
+    } else if ((((prim & 512) != 0) && (num_args == 0)) ||
+               (((prim & 1024) != 0) && (num_args == 1))) {
+      // Getters and setters, as in Interpreter::Activate.
+      cache->caller = static_cast<uword>(caller);
+      cache->accessor = TAGGED_OFFSET(RegularObject, slots_) +
+                        (prim & 511) * kSlotSize;
+      cache->target = static_cast<uword>(target);
+      cache->absent_receiver = 0;
+      cache->cid = cid;
+      return;
+    }
+  }
+  if (code == nullptr) {
+    // Other primitives, methods without code and receivers other than self:
+    // the interpreter activates the target without looking it up again.
+    cache->caller = static_cast<uword>(caller);
+    cache->accessor = 0;
+    cache->activate = jit->invoke_;
+    cache->target = static_cast<uword>(target);
+    cache->absent_receiver = static_cast<uword>(absent_receiver);
+    cache->cid = cid;
+    return;
+  }
+  cache->caller = static_cast<uword>(caller);
+  cache->accessor = 0;
+  cache->activate = jit->activate_;
+  cache->absent_receiver = 0;
+  cache->flags = static_cast<uword>(
+      SmallInteger::New(num_args << kFlagsNumArgsShift));
+  cache->target = static_cast<uword>(target);
+  cache->num_nils = target->NumTemps() - num_args;
+  cache->bytecode = code->bytecode;
+  cache->start = code->bytecode;
+  cache->entry = code->pcs[0];
+  cache->cid = cid;
+}
+
+bool JIT::FillClosureCache(SendCache* cache,
+                           Method caller,
+                           Method home_method,
+                           SmallInteger initial_bci,
+                           intptr_t num_copied) {
+  // Only a block of an ordinary method that stays put, with code for its first
+  // bytecode.
+  if (!home_method->IsOldObject() || (home_method->Primitive() != 0)) {
+    return false;
+  }
+  ByteArray bytecode = home_method->bytecode();
+  if (!bytecode->IsByteArray() || !bytecode->IsOldObject()) {
+    return false;
+  }
+  intptr_t offset = initial_bci->value() - 1;
+  CompiledCode* code = CodeFor(bytecode);
+  if ((code == nullptr) || (offset < 0) || (offset >= code->length) ||
+      (code->pcs[offset] == 0)) {
+    return false;
+  }
+  intptr_t num_args = cache->num_args;
+  cache->caller = static_cast<uword>(caller);
+  cache->accessor = 0;
+  cache->activate = activate_closure_;
+  cache->absent_receiver = 0;
+  cache->flags = static_cast<uword>(
+      SmallInteger::New((num_args << kFlagsNumArgsShift) | 1));
+  cache->target = static_cast<uword>(home_method);
+  cache->initial_bci = static_cast<uword>(initial_bci);
+  cache->num_copied = num_copied;
+  cache->bytecode = code->bytecode;
+  cache->start = code->bytecode + offset;
+  cache->entry = code->pcs[offset];
+  cache->cid = kClosureCid;
+  return true;
+}
+
+void JIT::Invoke(JIT* jit, SendCache* cache) {
+  Interpreter* I = jit->interpreter_;
+  if (cache->absent_receiver != 0) {
+    // In place of self, which compiled code pushed.
+    I->StackPut(cache->num_args, Object(cache->absent_receiver));
+  }
+  Method target = Method::Cast(Object(cache->target));
+  I->Activate(target, cache->num_args);  // SAFEPOINT
+}
+
+void JIT::StackOverflowOrInterrupt(JIT* jit) {
+  jit->interpreter_->StackOverflowOrInterrupt();  // SAFEPOINT
+}
+
+}  // namespace psoup
+
+#endif  // BASELINE_JIT
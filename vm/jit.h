@@ -0,0 +1,130 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_JIT_H_
+#define VM_JIT_H_
+
+#include "vm/flags.h"
+#include "vm/globals.h"
+
+#if BASELINE_JIT
+
+#include "vm/object.h"
+#include "vm/virtual_memory.h"
+
+namespace psoup {
+
+class Assembler;
+class Interpreter;
+struct CompiledCode;
+struct SendCache;
+
+// A baseline compiler that translates each bytecode of a method into a fixed
+// template of machine code, without any analysis across bytecodes beyond fusing
+// a comparison with the conditional jump that follows it.
+//
+// Compiled code runs on the interpreter's stack with the interpreter's frame
+// layout, and a saved IP is always the address of a bytecode, so frames look the
+// same to the collector, the debugger and the interpreter whichever of the two
+// created them. Compiled code handles stack and local variable traffic, jumps,
+// returns, SmallInteger arithmetic and comparisons, and monomorphic sends to
+// methods that are not primitives, to slot accessors and to closures. For
+// anything else it calls back into the interpreter, which performs one send on
+// its behalf, or stops at the bytecode and lets the interpreter carry on from
+// there.
+//
+// Code is generated only for bytecode in old-space, whose address does not
+// change until a mark-sweep or a become, and is discarded by either.
+class JIT {
+ public:
+  explicit JIT(Interpreter* interpreter);
+  ~JIT();
+
+  // Runs compiled code from the interpreter's ip_, sp_ and fp_ until it
+  // reaches a bytecode that it leaves to the interpreter, and stores the state
+  // at that bytecode back in ip_, sp_ and fp_.
+  void Run();
+
+  // Forgets all compiled code. The memory it occupies is reused the next time
+  // Run is entered, since compiled code may still be on the C stack under the
+  // collection that calls this.
+  void Flush();
+
+  // Forgets all compiled code if any was compiled from the bytes, which
+  // primitives are about to treat as data.
+  void Invalidate(ByteArray bytes);
+
+ private:
+  class Compiler;
+
+  struct IPCacheEntry {
+    const uint8_t* ip;
+    uword pc;
+    intptr_t offset;
+    uword padding;
+  };
+
+  void Reset();
+  void GenerateStubs();
+  CompiledCode* CodeFor(ByteArray bytecode);
+  uword Install(Assembler* assembler);
+  SendCache* AllocateSendCache();
+  void InsertIP(const uint8_t* ip, uword pc, intptr_t offset);
+  bool FillClosureCache(SendCache* cache,
+                        Method caller,
+                        Method home_method,
+                        SmallInteger initial_bci,
+                        intptr_t num_copied);
+
+  // Called from compiled code.
+  static bool Miss(JIT* jit);
+  static void Send(JIT* jit, SendCache* cache);
+  static void Invoke(JIT* jit, SendCache* cache);
+  static void StackOverflowOrInterrupt(JIT* jit);
+
+  static constexpr size_t kCodeSize = 16 * MB;
+  static constexpr size_t kDataSize = 8 * MB;
+  static constexpr intptr_t kIPCacheSize = 4096;
+  static constexpr intptr_t kIPCacheMask = kIPCacheSize - 1;
+  static constexpr intptr_t kCodeTableSize = 1024;
+  static constexpr intptr_t kCodeTableMask = kCodeTableSize - 1;
+
+  Interpreter* const interpreter_;
+  VirtualMemory code_;
+  VirtualMemory data_;
+  uword code_top_;
+  uword code_stubs_end_;
+  uword data_top_;
+  IPCacheEntry* ip_cache_;
+  CompiledCode* code_table_[kCodeTableSize];
+  intptr_t epoch_;
+  bool reset_pending_;
+
+  // Displacements of interpreter fields from the Interpreter.
+  int32_t ip_offset_;
+  int32_t sp_offset_;
+  int32_t fp_offset_;
+  int32_t stack_limit_offset_;
+  int32_t nil_offset_;
+  int32_t false_offset_;
+  int32_t true_offset_;
+
+  // Entry points, each at a fixed address in code_.
+  void (*enter_)(Interpreter* interpreter);
+  uword exit_;
+  uword exit_at_rdx_;
+  uword transfer_;
+  uword return_;
+  uword send_;
+  uword activate_;
+  uword activate_closure_;
+  uword invoke_;
+  uword probe_entries_;
+};
+
+}  // namespace psoup
+
+#endif  // BASELINE_JIT
+
+#endif  // VM_JIT_H_
@@ -136,7 +136,11 @@ static void Clamp(LargeInteger result) {
     }
   }
   result->set_negative(false);
-  Truncate(result, 0);
+  if (result->size() > 0) {
+    // Leave room for AbsAddOneInPlace to turn a zero into a one.
+    Truncate(result, 1);
+  }
+  result->set_size(0);
 }
 
 static void Verify(LargeInteger integer) {
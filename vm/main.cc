@@ -6,6 +6,7 @@
 #if !defined(OS_EMSCRIPTEN)
 
 #include <signal.h>
+#include <string.h>
 
 #include "vm/isolate.h"
 #include "vm/message_loop.h"
@@ -18,13 +19,32 @@ static void SIGINT_handler(int sig) {
   psoup::Isolate::InterruptAll();
 }
 
+static void PrintUsage(const char* executable) {
+  psoup::OS::PrintErr("Usage: %s [options] <program.vfuel> [arguments]\n",
+                      executable);
+  psoup::IsolateOptions::PrintOptions();
+}
+
 int main(int argc, const char** argv) {
-  if (argc < 2) {
-    psoup::OS::PrintErr("Usage: %s <program.vfuel>\n", argv[0]);
+  // Options on the command line override those in the environment.
+  psoup::IsolateOptions options;
+  options.SetFromEnvironment();
+  int first = 1;
+  while ((first < argc) && (strncmp(argv[first], "--", 2) == 0)) {
+    if (!options.SetOption(argv[first])) {
+      psoup::OS::PrintErr("Invalid option: %s\n", argv[first]);
+      PrintUsage(argv[0]);
+      return -1;
+    }
+    first++;
+  }
+  if (first >= argc) {
+    PrintUsage(argv[0]);
     return -1;
   }
 
-  psoup::MappedMemory snapshot = psoup::MappedMemory::MapReadOnly(argv[1]);
+  psoup::MappedMemory snapshot =
+      psoup::MappedMemory::MapReadOnly(argv[first]);
   psoup::OS::Startup();
   psoup::Primitives::Startup();
   psoup::PortMap::Startup();
@@ -35,9 +55,10 @@ int main(int argc, const char** argv) {
 #endif
 
   psoup::Isolate* isolate = new psoup::Isolate(snapshot.address(),
-                                               snapshot.size());
-  isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
-                                                         argc - 2, &argv[2]));
+                                               snapshot.size(), options);
+  isolate->loop()->PostMessage(
+      new psoup::IsolateMessage(ILLEGAL_PORT, argc - first - 1,
+                                &argv[first + 1]));
   intptr_t exit_code = isolate->loop()->Run();
   delete isolate;
 
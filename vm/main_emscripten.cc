@@ -7,6 +7,7 @@
 
 #include <emscripten.h>
 
+#include "vm/heap.h"
 #include "vm/isolate.h"
 #include "vm/message_loop.h"
 #include "vm/os.h"
@@ -63,7 +64,7 @@ int main(int argc, char** argv) {
 
 static psoup::Isolate* isolate;
 extern "C" void load_snapshot(const void* snapshot, size_t snapshot_length) {
-  isolate = new psoup::Isolate(snapshot, snapshot_length);
+  isolate = new psoup::Isolate(snapshot, snapshot_length, psoup::IsolateOptions());
   int argc = 0;
   const char** argv = nullptr;
   isolate->loop()->PostMessage(new psoup::IsolateMessage(ILLEGAL_PORT,
@@ -15,10 +15,10 @@ Behavior Object::Klass(Heap* heap) const {
   return heap->ClassAt(ClassId());
 }
 
-size_t HeapObject::HeapSizeFromClass() const {
+size_t HeapObject::HeapSizeFromClass(intptr_t cid) const {
   ASSERT(IsHeapObject());
 
-  switch (cid()) {
+  switch (cid) {
   case kIllegalCid:
     UNREACHABLE();
   case kForwardingCorpseCid:
@@ -60,10 +60,10 @@ size_t HeapObject::HeapSizeFromClass() const {
   }
 }
 
-void HeapObject::Pointers(Object** from, Object** to) {
+void HeapObject::Pointers(uword header, Object** from, Object** to) {
   ASSERT(IsHeapObject());
 
-  switch (cid()) {
+  switch (ClassIdField::decode(header)) {
   case kIllegalCid:
   case kForwardingCorpseCid:
   case kFreeListElementCid:
@@ -98,11 +98,15 @@ void HeapObject::Pointers(Object** from, Object** to) {
     *from = Closure::Cast(*this)->from();
     *to = Closure::Cast(*this)->to();
     return;
-  default:
+  default: {
+    intptr_t num_slots =
+        ((SizeField::decode(header) << kObjectAlignmentLog2) -
+         sizeof(HeapObject::Layout)) >> kWordSizeLog2;
     *from = RegularObject::Cast(*this)->from();
-    *to = RegularObject::Cast(*this)->to();
+    *to = *from + num_slots - 1;
     return;
   }
+  }
 }
 
 void HeapObject::AddToRememberedSet() const {
@@ -111,6 +115,18 @@ void HeapObject::AddToRememberedSet() const {
   isolate->heap()->AddToRememberedSet(*this);
 }
 
+void HeapObject::RememberCard(uword slot) const {
+  Isolate* isolate = Isolate::Current();
+  ASSERT(isolate != nullptr);
+  isolate->heap()->RememberCard(*this, slot);
+}
+
+void HeapObject::MarkForIncrementalMarking(Object value) const {
+  Isolate* isolate = Isolate::Current();
+  ASSERT(isolate != nullptr);
+  isolate->heap()->MarkForIncrementalMarking(HeapObject::Cast(value));
+}
+
 char* Object::ToCString(Heap* heap) const {
   switch (ClassId()) {
   case kIllegalCid:
@@ -239,7 +255,7 @@ static uintptr_t kFNVPrime = 1099511628211;
 #endif
 
 SmallInteger String::EnsureHash(Isolate* isolate) {
-  if (header_hash() == 0) {
+  if (hash() == 0) {
     // FNV-1a hash
     intptr_t length = Size();
     uintptr_t h = length + 1;
@@ -252,9 +268,9 @@ SmallInteger String::EnsureHash(Isolate* isolate) {
     if (h == 0) {
       h = 1;
     }
-    set_header_hash(h);
+    set_hash(h);
   }
-  return SmallInteger::New(header_hash());
+  return SmallInteger::New(hash());
 }
 
 }  // namespace psoup
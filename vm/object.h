@@ -47,6 +47,14 @@ enum HeaderBits {
   // For LargeIntegers.
   kNegativeBit = 3,
 
+  // For bytecode ByteArrays: seen by reflection, do not quicken.
+  kPristineBit = 4,
+
+  // For bytecode ByteArrays: holds private bytecodes, restore before reading.
+  kQuickenedBit = 5,
+  // For large Arrays: stores into new-space are remembered by card.
+  kCardTableBit = 6,
+
 #if defined(ARCH_IS_32_BIT)
   kSizeFieldOffset = 8,
   kSizeFieldSize = 8,
@@ -226,12 +234,16 @@ class HeapObject : public Object {
   inline void set_is_canonical(bool value);
   inline bool negative() const;
   inline void set_negative(bool value);
+  inline bool is_pristine() const;
+  inline void set_is_pristine(bool value);
+  inline bool is_quickened() const;
+  inline void set_is_quickened(bool value);
+  inline bool has_card_table() const;
+  inline void set_has_card_table(bool value);
   inline size_t heap_size() const;
   inline void set_heap_size(size_t value);
   inline intptr_t cid() const;
   inline void set_cid(intptr_t value);
-  inline intptr_t header_hash() const;
-  inline void set_header_hash(intptr_t value);
 
   uword Addr() const { return tagged_pointer_ - kHeapObjectTag; }
   static HeapObject FromAddr(uword addr) {
@@ -250,8 +262,22 @@ class HeapObject : public Object {
     }
     return HeapSizeFromClass();
   }
-  size_t HeapSizeFromClass() const;
-  void Pointers(Object** from, Object** to);
+  // For a header read once by the parallel scavenger, which must not re-read
+  // a header another worker may be replacing with a forwarding pointer.
+  size_t HeapSize(uword header) const {
+    size_t heap_size_from_tag =
+        SizeField::decode(header) << kObjectAlignmentLog2;
+    if (heap_size_from_tag != 0) [[likely]] {
+      return heap_size_from_tag;
+    }
+    return HeapSizeFromClass(ClassIdField::decode(header));
+  }
+  size_t HeapSizeFromClass() const { return HeapSizeFromClass(cid()); }
+  size_t HeapSizeFromClass(intptr_t cid) const;
+  inline void Pointers(Object** from, Object** to);
+  // For a header read once by a parallel marker, which must not re-read a
+  // header another worker may be racing to set the mark bit in.
+  void Pointers(uword header, Object** from, Object** to);
 
  protected:
   template <typename type>
@@ -266,19 +292,40 @@ class HeapObject : public Object {
       ASSERT(value->IsImmediateOrOldObject());
     } else {
       // Generational write barrier:
-      if (IsOldObject() && value->IsNewObject() && !is_remembered()) {
-        AddToRememberedSet();
+      if (IsOldObject() && value->IsNewObject()) {
+        if (has_card_table()) [[unlikely]] {
+          RememberCard(reinterpret_cast<uword>(addr));
+        } else if (!is_remembered()) {
+          AddToRememberedSet();
+        }
       }
     }
+    // Incremental marking write barrier: an object the marker may have
+    // already scanned must not be left as the only path to an unmarked one.
+    if (value->IsOldObject() && IsOldObject() && incremental_marking_ &&
+        is_marked() && !HeapObject::Cast(value)->is_marked()) {
+      MarkForIncrementalMarking(value);
+    }
   }
 
  private:
+  friend class Heap;
+
+  // Set while the heap of the isolate on this thread is marking
+  // incrementally.
+  static inline thread_local bool incremental_marking_ = false;
+
   void AddToRememberedSet() const;
+  void RememberCard(uword slot) const;
+  void MarkForIncrementalMarking(Object value) const;
 
   class MarkBit : public BitField<bool, kMarkBit, 1> {};
   class RememberedBit : public BitField<bool, kRememberedBit, 1> {};
   class CanonicalBit : public BitField<bool, kCanonicalBit, 1> {};
   class NegativeBit : public BitField<bool, kNegativeBit, 1> {};
+  class PristineBit : public BitField<bool, kPristineBit, 1> {};
+  class QuickenedBit : public BitField<bool, kQuickenedBit, 1> {};
+  class CardTableBit : public BitField<bool, kCardTableBit, 1> {};
   class SizeField
       : public BitField<size_t, kSizeFieldOffset, kSizeFieldSize> {};
   class ClassIdField
@@ -546,6 +593,8 @@ class String : public Bytes {
   HEAP_OBJECT_IMPLEMENTATION(String, Bytes)
 
  public:
+  inline intptr_t hash() const;
+  inline void set_hash(intptr_t value);
   SmallInteger EnsureHash(Isolate* isolate);
 };
 
@@ -586,6 +635,12 @@ class Activation : public HeapObject {
   inline void set_stack_depth(SmallInteger d);
   intptr_t StackDepth() const { return stack_depth()->value(); }
 
+  // Temps are only stored here while the activation has no living frame; the
+  // array is nil until the activation is first flushed.
+  inline Array temps() const;
+  inline void set_temps(Array t, Barrier barrier = kBarrier);
+  inline intptr_t TempCapacity() const;
+
   inline Object temp(intptr_t index) const;
   inline void set_temp(intptr_t index, Object o, Barrier barrier = kBarrier);
 
@@ -750,21 +805,23 @@ class ObjectStore : public HeapObject {
   inline Behavior WeakArray() const;
   inline Behavior Activation() const;
   inline Behavior Method() const;
+  inline Object out_of_memory() const;  // nil in older snapshots.
 };
 
 class HeapObject::Layout {
  public:
   uword header_;
-  uword header_hash_;
 };
 
 class ForwardingCorpse::Layout : public HeapObject::Layout {
  public:
+  Object target_;
   intptr_t overflow_size_;
 };
 
 class FreeListElement::Layout : public HeapObject::Layout {
  public:
+  FreeListElement next_;
   intptr_t overflow_size_;
 };
 
@@ -809,6 +866,7 @@ class Ephemeron::Layout : public HeapObject::Layout {
 class Bytes::Layout : public HeapObject::Layout {
  public:
   SmallInteger size_;
+  uword hash_;  // Content hash of a String, 0 until computed. Not visited.
 };
 
 class String::Layout : public Bytes::Layout {};
@@ -833,7 +891,7 @@ class Activation::Layout : public HeapObject::Layout {
   Closure closure_;
   Object receiver_;
   SmallInteger stack_depth_;
-  Object temps_[kMaxTemps];
+  Array temps_;
 };
 
 class Float::Layout : public HeapObject::Layout {
@@ -912,6 +970,7 @@ class ObjectStore::Layout : public HeapObject::Layout {
   Behavior WeakArray_;
   Behavior Activation_;
   Behavior Method_;
+  class String out_of_memory_;
 };
 
 bool HeapObject::is_marked() const {
@@ -938,6 +997,27 @@ bool HeapObject::negative() const {
 void HeapObject::set_negative(bool value) {
   ptr()->header_ = NegativeBit::update(value, ptr()->header_);
 }
+bool HeapObject::is_pristine() const {
+  return PristineBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_pristine(bool value) {
+  ptr()->header_ = PristineBit::update(value, ptr()->header_);
+}
+bool HeapObject::is_quickened() const {
+  return QuickenedBit::decode(ptr()->header_);
+}
+void HeapObject::set_is_quickened(bool value) {
+  ptr()->header_ = QuickenedBit::update(value, ptr()->header_);
+}
+bool HeapObject::has_card_table() const {
+  return CardTableBit::decode(ptr()->header_);
+}
+void HeapObject::set_has_card_table(bool value) {
+  ptr()->header_ = CardTableBit::update(value, ptr()->header_);
+}
+void HeapObject::Pointers(Object** from, Object** to) {
+  Pointers(ptr()->header_, from, to);
+}
 size_t HeapObject::heap_size() const {
   return SizeField::decode(ptr()->header_) << kObjectAlignmentLog2;
 }
@@ -954,12 +1034,6 @@ intptr_t HeapObject::cid() const {
 void HeapObject::set_cid(intptr_t value) {
   ptr()->header_ = ClassIdField::update(value, ptr()->header_);
 }
-intptr_t HeapObject::header_hash() const {
-  return ptr()->header_hash_;
-}
-void HeapObject::set_header_hash(intptr_t value) {
-  ptr()->header_hash_ = value;
-}
 
 HeapObject HeapObject::Initialize(uword addr,
                                   intptr_t cid,
@@ -977,17 +1051,16 @@ HeapObject HeapObject::Initialize(uword addr,
   header = ClassIdField::update(cid, header);
   HeapObject obj = FromAddr(addr);
   obj.ptr()->header_ = header;
-  obj.ptr()->header_hash_ = 0;
   ASSERT(obj.cid() == cid);
   ASSERT(!obj.is_marked());
   return obj;
 }
 
 Object ForwardingCorpse::target() const {
-  return static_cast<Object>(ptr()->header_hash_);
+  return ptr()->target_;
 }
 void ForwardingCorpse::set_target(Object value) {
-  ptr()->header_hash_ = static_cast<uword>(value);
+  ptr()->target_ = value;
 }
 intptr_t ForwardingCorpse::overflow_size() const {
   return ptr()->overflow_size_;
@@ -997,11 +1070,11 @@ void ForwardingCorpse::set_overflow_size(intptr_t value) {
 }
 
 FreeListElement FreeListElement::next() const {
-  return static_cast<FreeListElement>(ptr()->header_hash_);
+  return ptr()->next_;
 }
 void FreeListElement::set_next(FreeListElement value) {
   ASSERT((value == nullptr) || value->IsHeapObject());  // Tagged.
-  ptr()->header_hash_ = static_cast<uword>(value);
+  ptr()->next_ = value;
 }
 intptr_t FreeListElement::overflow_size() const {
   return ptr()->overflow_size_;
@@ -1121,6 +1194,9 @@ const uint8_t* Bytes::element_addr(intptr_t index) const {
   return &elements[index];
 }
 
+intptr_t String::hash() const { return ptr()->hash_; }
+void String::set_hash(intptr_t value) { ptr()->hash_ = value; }
+
 SmallInteger Method::header() const { return Load(&ptr()->header_); }
 Array Method::literals() const { return Load(&ptr()->literals_); }
 ByteArray Method::bytecode() const { return Load(&ptr()->bytecode_); }
@@ -1152,17 +1228,27 @@ SmallInteger Activation::stack_depth() const {
 void Activation::set_stack_depth(SmallInteger d) {
   Store(&ptr()->stack_depth_, d, kNoBarrier);
 }
+Array Activation::temps() const { return Load(&ptr()->temps_); }
+void Activation::set_temps(Array t, Barrier barrier) {
+  Store(&ptr()->temps_, t, barrier);
+}
+intptr_t Activation::TempCapacity() const {
+  Array t = temps();
+  return t->IsArray() ? t->Size() : 0;
+}
 Object Activation::temp(intptr_t index) const {
-  return Load(&ptr()->temps_[index]);
+  ASSERT(index < TempCapacity());
+  return temps()->element(index);
 }
 void Activation::set_temp(intptr_t index, Object o, Barrier barrier) {
-  Store(&ptr()->temps_[index], o, barrier);
+  ASSERT(index < TempCapacity());
+  temps()->set_element(index, o, barrier);
 }
 Object* Activation::from() {
   return &ptr()->sender_;
 }
 Object* Activation::to() {
-  return &ptr()->stack_depth_ + StackDepth();
+  return &ptr()->temps_;
 }
 
 double Float::value() const { return ptr()->value_; }
@@ -1279,6 +1365,15 @@ Behavior ObjectStore::SmallInteger() const { return ptr()->SmallInteger_; }
 Behavior ObjectStore::WeakArray() const { return ptr()->WeakArray_; }
 Behavior ObjectStore::Activation() const { return ptr()->Activation_; }
 Behavior ObjectStore::Method() const { return ptr()->Method_; }
+Object ObjectStore::out_of_memory() const {
+  // Slots are counted from nil, the first element of the store.
+  intptr_t index =
+      reinterpret_cast<const Object*>(&ptr()->out_of_memory_) - &ptr()->nil_;
+  if (size()->value() <= index) {
+    return nil_obj();
+  }
+  return ptr()->out_of_memory_;
+}
 
 }  // namespace psoup
 
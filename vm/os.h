@@ -22,6 +22,7 @@ class OS : public AllStatic {
 
   static const char* Name();
   static intptr_t NumberOfAvailableProcessors();
+  static intptr_t ProcessId();
 
   static void Print(const char* format, ...) PRINTF_ATTRIBUTE(1, 2);
   static void PrintErr(const char* format, ...) PRINTF_ATTRIBUTE(1, 2);
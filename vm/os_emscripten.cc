@@ -50,6 +50,10 @@ intptr_t OS::NumberOfAvailableProcessors() {
   return 1;
 }
 
+intptr_t OS::ProcessId() {
+  return 0;
+}
+
 static void VFPrint(FILE* stream, const char* format, va_list args) {
   vfprintf(stream, format, args);
   fflush(stream);
@@ -9,6 +9,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <zircon/process.h>
 #include <zircon/syscalls.h>
 #include <zircon/types.h>
 
@@ -43,6 +44,17 @@ intptr_t OS::NumberOfAvailableProcessors() {
   return zx_system_get_num_cpus();
 }
 
+intptr_t OS::ProcessId() {
+  zx_info_handle_basic_t info;
+  zx_status_t status = zx_object_get_info(zx_process_self(),
+                                          ZX_INFO_HANDLE_BASIC, &info,
+                                          sizeof(info), nullptr, nullptr);
+  if (status != ZX_OK) {
+    return 0;
+  }
+  return info.koid;
+}
+
 void OS::Print(const char* format, ...) {
   va_list args;
   va_start(args, format);
@@ -45,6 +45,10 @@ intptr_t OS::NumberOfAvailableProcessors() {
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+intptr_t OS::ProcessId() {
+  return getpid();
+}
+
 void OS::Print(const char* format, ...) {
   va_list args;
   va_start(args, format);
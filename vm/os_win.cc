@@ -86,6 +86,10 @@ intptr_t OS::NumberOfAvailableProcessors() {
   return info.dwNumberOfProcessors;
 }
 
+intptr_t OS::ProcessId() {
+  return _getpid();
+}
+
 static void VFPrint(FILE* stream, const char* format, va_list args) {
   vfprintf(stream, format, args);
   fflush(stream);
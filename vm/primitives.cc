@@ -120,7 +120,7 @@ const bool kFailure = false;
   V(71, Array_size)                                                            \
   V(72, Array_replaceFromToWithStartingAt)                                     \
   V(73, Array_copyFromTo)                                                      \
-  /* V(74, Array_?) */                                                         \
+  V(74, Array_copyWithSize)                                                    \
   V(75, WeakArray_class_new)                                                   \
   /* V(76, WeakArray_class_new_fill) */                                        \
   /* V(77, WeakArray_class_new_selffill) */                                    \
@@ -157,7 +157,7 @@ const bool kFailure = false;
   V(108, Bytes_copyStringFromTo)                                               \
   V(109, Bytes_copyByteArrayFromTo)                                            \
   V(110, ByteArray_class_new)                                                  \
-  /* V(111, ByteArray_class_with) */                                           \
+  V(111, ByteArray_copyWithSize)                                               \
   V(112, ByteArray_class_withAll)                                              \
   V(113, ByteArray_at)                                                         \
   V(114, ByteArray_atPut)                                                      \
@@ -245,6 +245,9 @@ const bool kFailure = false;
   /* V(196, killtree) */                                                       \
   /* V(197, sendoob) */                                                        \
   /* V(198, mailboxpeek) */                                                    \
+  V(199, Activation_nextHandler)                                               \
+  V(200, Activation_nextUnwindProtectUpTo)                                     \
+  V(201, MessageLoop_exitOutOfMemory)                                          \
   V(256, Platform_numberOfProcessors)                                          \
   V(257, Platform_operatingSystem)                                             \
   V(264, Time_monotonicNanos)                                                  \
@@ -1437,6 +1440,7 @@ DEFINE_PRIMITIVE(ByteArray_at) {
   if ((index < 0) || (index >= array->Size())) {
     return kFailure;
   }
+  I->EnsureDequickened(array);
   uint8_t value = array->element(index);
   RETURN(SmallInteger::New(value));
 }
@@ -1454,6 +1458,7 @@ DEFINE_PRIMITIVE(ByteArray_atPut) {
   if (!SmallInteger::IsByte(value)) {
     return kFailure;
   }
+  I->EnsureDequickened(array);
   array->set_element(index, SmallInteger::Byte(value));
   RETURN(value);
 }
@@ -1475,6 +1480,7 @@ DEFINE_PRIMITIVE(ByteArray_size) {
     if ((index < 0) || ((index + width) > array->Size())) {                    \
       return kFailure;                                                         \
     }                                                                          \
+    I->EnsureDequickened(array);                                               \
     int64_t value =                                                            \
         *reinterpret_cast<const ctype*>(array->element_addr(index));           \
     RETURN_MINT(value);                                                        \
@@ -1492,6 +1498,7 @@ DEFINE_PRIMITIVE(ByteArray_size) {
     if ((value < min) || (value > max)) {                                      \
       return kFailure;                                                         \
     }                                                                          \
+    I->EnsureDequickened(array);                                               \
     *reinterpret_cast<ctype*>(array->element_addr(index)) =                    \
         static_cast<ctype>(value);                                             \
     RETURN(I->Stack(0));                                                       \
@@ -1514,6 +1521,7 @@ DEFINE_PRIMITIVE(Bytes_uint64At) {
   if ((index < 0) || ((index + width) > array->Size())) {
     return kFailure;
   }
+  I->EnsureDequickened(array);
   uint64_t value = *reinterpret_cast<uint64_t*>(array->element_addr(index));
   Object result = LargeInteger::FromUint64(value, H);
   RETURN(result);
@@ -1531,6 +1539,7 @@ DEFINE_PRIMITIVE(Bytes_uint64AtPut) {
   if (!LargeInteger::AsUint64(I->Stack(0), &value)) {
     return kFailure;
   }
+  I->EnsureDequickened(array);
   *reinterpret_cast<uint64_t*>(array->element_addr(index)) = value;
   RETURN(I->Stack(0));
 }
@@ -1546,6 +1555,7 @@ DEFINE_PRIMITIVE(Bytes_uint64AtPut) {
       return kFailure;                                                         \
     }                                                                          \
     ctype value;                                                               \
+    I->EnsureDequickened(array);                                               \
     memcpy(&value, array->element_addr(index), sizeof(ctype));                 \
     RETURN_FLOAT(static_cast<double>(value));                                  \
   }                                                                            \
@@ -1560,6 +1570,7 @@ DEFINE_PRIMITIVE(Bytes_uint64AtPut) {
     }                                                                          \
     FLOAT_ARGUMENT(double_value, 0);                                           \
     ctype value = static_cast<ctype>(double_value);                            \
+    I->EnsureDequickened(array);                                               \
     memcpy(array->element_addr(index), &value, sizeof(ctype));                 \
     RETURN(I->Stack(0));                                                       \
   }
@@ -1588,12 +1599,28 @@ DEFINE_PRIMITIVE(Bytes_copyByteArrayFromTo) {
 
   ByteArray result = H->AllocateByteArray(subsize);  // SAFEPOINT
   bytes = Bytes::Cast(I->Stack(2));
+  I->EnsureDequickened(bytes);
   memcpy(result->element_addr(0),
          bytes->element_addr(start - 1),
          subsize);
   RETURN(result);
 }
 
+DEFINE_PRIMITIVE(ByteArray_copyWithSize) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(new_size, 0);
+  if ((new_size < 0) || !I->Stack(1)->IsByteArray()) {
+    return kFailure;
+  }
+  ByteArray result = H->AllocateByteArray(new_size);  // SAFEPOINT
+  ByteArray bytes = ByteArray::Cast(I->Stack(1));
+  I->EnsureDequickened(bytes);
+  intptr_t overlap = bytes->Size() < new_size ? bytes->Size() : new_size;
+  memcpy(result->element_addr(0), bytes->element_addr(0), overlap);
+  memset(result->element_addr(overlap), 0, new_size - overlap);
+  RETURN(result);
+}
+
 DEFINE_PRIMITIVE(ByteArray_replaceFromToWithStartingAt) {
   ASSERT(num_args == 4);
   ByteArray receiver = ByteArray::Cast(I->Stack(4));
@@ -1628,6 +1655,8 @@ DEFINE_PRIMITIVE(ByteArray_replaceFromToWithStartingAt) {
     return kFailure;
   }
 
+  I->EnsureDequickened(receiver);
+  I->EnsureDequickened(replacement);
   // Note replacement may be receiver.
   memmove(receiver->element_addr(start - 1),
           replacement->element_addr(replacementStart - 1),
@@ -1712,6 +1741,26 @@ DEFINE_PRIMITIVE(Array_copyFromTo) {
   RETURN(result);
 }
 
+// Copying into an uninitialized result writes each byte or slot once, where
+// allocating with new: and then replacing writes the copied part twice.
+DEFINE_PRIMITIVE(Array_copyWithSize) {
+  ASSERT(num_args == 1);
+  SMI_ARGUMENT(new_size, 0);
+  if ((new_size < 0) || !I->Stack(1)->IsArray()) {
+    return kFailure;
+  }
+  Array result = H->AllocateArray(new_size);  // SAFEPOINT
+  Array array = Array::Cast(I->Stack(1));
+  intptr_t overlap = array->Size() < new_size ? array->Size() : new_size;
+  for (intptr_t i = 0; i < overlap; i++) {
+    result->set_element(i, array->element(i));
+  }
+  for (intptr_t i = overlap; i < new_size; i++) {
+    result->set_element(i, nil, kNoBarrier);
+  }
+  RETURN(result);
+}
+
 DEFINE_PRIMITIVE(String_at) {
   ASSERT(num_args == 1);
   String string = String::Cast(I->Stack(1));
@@ -1747,6 +1796,21 @@ DEFINE_PRIMITIVE(Activation_sender) {
   RETURN(I->ActivationSender(activation));  // SAFEPOINT
 }
 
+DEFINE_PRIMITIVE(Activation_nextHandler) {
+  ASSERT(num_args == 0);
+  Activation activation = Activation::Cast(I->Stack(0));
+  ASSERT(activation->IsActivation());
+  RETURN(I->ActivationNextHandler(activation));  // SAFEPOINT
+}
+
+DEFINE_PRIMITIVE(Activation_nextUnwindProtectUpTo) {
+  ASSERT(num_args == 1);
+  Activation activation = Activation::Cast(I->Stack(1));
+  ASSERT(activation->IsActivation());
+  Object stop = I->Stack(0);
+  RETURN(I->ActivationNextUnwindProtect(activation, stop));  // SAFEPOINT
+}
+
 DEFINE_PRIMITIVE(Activation_senderPut) {
   ASSERT(num_args == 1);
   Activation activation = Activation::Cast(I->Stack(1));
@@ -1763,6 +1827,7 @@ DEFINE_PRIMITIVE(Activation_bci) {
   ASSERT(num_args == 0);
   Activation activation = Activation::Cast(I->Stack(0));
   ASSERT(activation->IsActivation());
+  I->Dequicken(activation->method());
   RETURN(I->ActivationBCI(activation));
 }
 
@@ -1782,6 +1847,7 @@ DEFINE_PRIMITIVE(Activation_method) {
   ASSERT(num_args == 0);
   Activation activation = Activation::Cast(I->Stack(0));
   ASSERT(activation->IsActivation());
+  I->Dequicken(activation->method());
   // No frame state to sync.
   RETURN(activation->method());
 }
@@ -1887,6 +1953,7 @@ DEFINE_PRIMITIVE(Activation_class_new) {
   result->set_closure(Closure::Cast(nil), kNoBarrier);
   result->set_receiver(nil, kNoBarrier);
   result->set_stack_depth(SmallInteger::New(0));
+  result->set_temps(Array::Cast(nil), kNoBarrier);
   RETURN(result);
 }
 
@@ -2094,16 +2161,15 @@ DEFINE_PRIMITIVE(Object_identityHash) {
       hash = 1;
     }
   } else if (receiver->IsString()) {
-    String::Cast(receiver)->EnsureHash(I->isolate());
-    hash = String::Cast(receiver)->header_hash();
+    hash = String::Cast(receiver)->EnsureHash(I->isolate())->value();
   } else {
-    hash = HeapObject::Cast(receiver)->header_hash();
+    hash = H->IdentityHash(HeapObject::Cast(receiver));
     if (hash == 0) {
       hash = I->isolate()->random().NextUInt64() & SmallInteger::kMaxValue;
       if (hash == 0) {
         hash = 1;
       }
-      HeapObject::Cast(receiver)->set_header_hash(hash);
+      H->SetIdentityHash(HeapObject::Cast(receiver), hash);
     }
   }
   RETURN_SMI(hash);
@@ -2322,6 +2388,7 @@ DEFINE_PRIMITIVE(Random_getEntropy) {
   if (size < 0) return kFailure;
   ByteArray buffer = ByteArray::Cast(I->Stack(1));
   if (!buffer->IsByteArray() || (buffer->Size() < size)) return kFailure;
+  I->EnsureDequickened(buffer);
   intptr_t status = OS::GetEntropy(buffer->element_addr(0), size);
   RETURN_SMI(status);
 }
@@ -2375,6 +2442,13 @@ DEFINE_PRIMITIVE(MessageLoop_exit) {
   return kFailure;
 }
 
+DEFINE_PRIMITIVE(MessageLoop_exitOutOfMemory) {
+  ASSERT(num_args == 0);
+  I->ExitOutOfMemory();
+  UNREACHABLE();
+  return kFailure;
+}
+
 DEFINE_PRIMITIVE(Double_asStringFixed) {
   ASSERT(num_args == 1);
   FLOAT_ARGUMENT(value, 1);
@@ -2525,6 +2599,8 @@ DEFINE_PRIMITIVE(Bytes_startsWith) {
   if (!string->IsBytes() || !prefix->IsBytes()) {
     return kFailure;
   }
+  I->EnsureDequickened(string);
+  I->EnsureDequickened(prefix);
 
   intptr_t string_length = string->Size();
   intptr_t prefix_length = prefix->Size();
@@ -2546,6 +2622,8 @@ DEFINE_PRIMITIVE(Bytes_endsWith) {
   if (!string->IsBytes() || !suffix->IsBytes()) {
     return kFailure;
   }
+  I->EnsureDequickened(string);
+  I->EnsureDequickened(suffix);
 
   intptr_t string_length = string->Size();
   intptr_t suffix_length = suffix->Size();
@@ -2578,6 +2656,8 @@ DEFINE_PRIMITIVE(Bytes_indexOf) {
   if (!start->IsSmallInteger()) {
     return kFailure;
   }
+  I->EnsureDequickened(string);
+  I->EnsureDequickened(substring);
   intptr_t string_length = string->Size();
   intptr_t substring_length = substring->Size();
   intptr_t start_index = start->value() - 1;
@@ -2624,6 +2704,8 @@ DEFINE_PRIMITIVE(Bytes_lastIndexOf) {
   if (!start->IsSmallInteger()) {
     return kFailure;
   }
+  I->EnsureDequickened(string);
+  I->EnsureDequickened(substring);
 
   intptr_t string_length = string->Size();
   intptr_t substring_length = substring->Size();
@@ -2677,6 +2759,7 @@ DEFINE_PRIMITIVE(Bytes_copyStringFromTo) {
 
   String result = H->AllocateString(subsize);  // SAFEPOINT
   bytes = Bytes::Cast(I->Stack(2));
+  I->EnsureDequickened(bytes);
   memcpy(result->element_addr(0),
          bytes->element_addr(start - 1),
          subsize);
@@ -2701,6 +2784,7 @@ DEFINE_PRIMITIVE(String_class_withAll) {
     intptr_t length = Bytes::Cast(I->Stack(0))->Size();
     String result = H->AllocateString(length);  // SAFEPOINT
     Bytes bytes = Bytes::Cast(I->Stack(0));
+    I->EnsureDequickened(bytes);
     memcpy(result->element_addr(0), bytes->element_addr(0), length);
     RETURN(result);
   } else if (I->Stack(0)->IsArray()) {
@@ -2735,6 +2819,7 @@ DEFINE_PRIMITIVE(ByteArray_class_withAll) {
     intptr_t length = Bytes::Cast(I->Stack(0))->Size();
     ByteArray result = H->AllocateByteArray(length);  // SAFEPOINT
     Bytes bytes = Bytes::Cast(I->Stack(0));
+    I->EnsureDequickened(bytes);
     memcpy(result->element_addr(0), bytes->element_addr(0), length);
     RETURN(result);
   } else if (I->Stack(0)->IsArray()) {
@@ -2793,6 +2878,7 @@ DEFINE_PRIMITIVE(writeBytesToFile) {
   if (!content->IsBytes() || !filename->IsBytes()) {
     return kFailure;
   }
+  I->EnsureDequickened(content);
 
   char* raw_filename = reinterpret_cast<char*>(malloc(filename->Size() + 1));
   memcpy(raw_filename, filename->element_addr(0), filename->Size());
@@ -2922,6 +3008,7 @@ DEFINE_PRIMITIVE(spawn) {
   ASSERT(num_args == 1);
   ByteArray message = ByteArray::Cast(I->Stack(0));
   if (message->IsByteArray()) {
+    I->EnsureDequickened(message);
     intptr_t length = message->Size();
     uint8_t* data = reinterpret_cast<uint8_t*>(malloc(length));
     memcpy(data, message->element_addr(0), length);
@@ -2941,6 +3028,7 @@ DEFINE_PRIMITIVE(send) {
   if (!data->IsByteArray()) {
     return kFailure;
   }
+  I->EnsureDequickened(data);
 
   intptr_t length = data->Size();
   uint8_t* raw_data = reinterpret_cast<uint8_t*>(malloc(length));
@@ -2954,6 +3042,7 @@ DEFINE_PRIMITIVE(send) {
 DEFINE_PRIMITIVE(MessageLoop_finish) {
   ASSERT(num_args == 1);
   MINT_ARGUMENT(new_wakeup, 0);
+  H->ReleaseIdleMemory();
   I->isolate()->loop()->MessageEpilogue(new_wakeup);
   I->ReturnFromDispatch();
   I->Exit();
@@ -3178,6 +3267,7 @@ DEFINE_PRIMITIVE(ZXChannel_write) {
   if (!bytes->IsByteArray()) {
     return kFailure;
   }
+  I->EnsureDequickened(bytes);
   Array handles = Array::Cast(I->Stack(1));
   if (!handles->IsArray()) {
     return kFailure;
@@ -3312,6 +3402,7 @@ DEFINE_PRIMITIVE(ZXVmo_write) {
   if (!buffer->IsByteArray()) {
     return kFailure;
   }
+  I->EnsureDequickened(buffer);
   SmallInteger offset = SmallInteger::Cast(I->Stack(1));
   if (!offset->IsSmallInteger() || offset->value() < 0) {
     return kFailure;
@@ -3783,7 +3874,8 @@ DEFINE_PRIMITIVE(OSError_statusToString) {
 
 #if defined(OS_ANDROID) || defined(OS_LINUX) || \
     defined(OS_MACOS) || defined(OS_WINDOWS)
-static char* AsMallocString(Bytes bytes) {
+static char* AsMallocString(Interpreter* I, Bytes bytes) {
+  I->EnsureDequickened(bytes);
   intptr_t n = bytes->Size();
   char* result = reinterpret_cast<char*>(malloc(n + 1));
   memcpy(result, bytes->element_addr(0), n);
@@ -3791,11 +3883,11 @@ static char* AsMallocString(Bytes bytes) {
   return result;
 }
 
-static char** AsMallocArrayOfStrings(Array array) {
+static char** AsMallocArrayOfStrings(Interpreter* I, Array array) {
   intptr_t n = array->Size();
   char** result = reinterpret_cast<char**>(malloc(sizeof(char*) * (n + 1)));
   for (intptr_t i = 0; i < n; i++) {
-    result[i] = AsMallocString(Bytes::Cast(array->element(i)));
+    result[i] = AsMallocString(I, Bytes::Cast(array->element(i)));
   }
   result[n] = nullptr;
   return result;
@@ -3856,10 +3948,10 @@ DEFINE_PRIMITIVE(Process_start) {
   }
 
   intptr_t opt = options->value();
-  char** argv = AsMallocArrayOfStrings(arguments);
+  char** argv = AsMallocArrayOfStrings(I, arguments);
   char** env = environment == nil ? nullptr
-                                  : AsMallocArrayOfStrings(environment);
-  char* cwd = workingdir == nil ? nullptr : AsMallocString(workingdir);
+                                  : AsMallocArrayOfStrings(I, environment);
+  char* cwd = workingdir == nil ? nullptr : AsMallocString(I, workingdir);
   intptr_t process, stdin_, stdout_, stderr_;
   PlatformMessageLoop* loop =
       static_cast<PlatformMessageLoop*>(I->isolate()->loop());
@@ -3933,6 +4025,7 @@ DEFINE_PRIMITIVE(Pipe_write) {
   if (offset < 0 || count < 0 || offset + count > buffer->Size()) {
     return kFailure;
   }
+  I->EnsureDequickened(buffer);
 
   PlatformMessageLoop* loop =
       static_cast<PlatformMessageLoop*>(I->isolate()->loop());
@@ -4072,6 +4165,7 @@ DEFINE_PRIMITIVE(Term_write) {
 #if defined(OS_MACOS) || defined(OS_LINUX)
   Bytes buffer = Bytes::Cast(I->Stack(0));
   if (!buffer->IsBytes()) return kFailure;
+  I->EnsureDequickened(buffer);
 
   size_t length = buffer->Size();
   size_t start = 0;
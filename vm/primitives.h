@@ -22,6 +22,10 @@ class Primitives {
   static void Startup();
   static void Shutdown();
 
+  static bool IsClosureValue(intptr_t prim) {
+    return (prim >= 156) && (prim <= 159);
+  }
+  static bool IsExceptionHandler(intptr_t prim) { return prim == 161; }
   static bool IsUnwindProtect(intptr_t prim) { return prim == 162; }
   static bool IsSimulationRoot(intptr_t prim) { return prim == 163; }
 
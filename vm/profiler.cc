@@ -0,0 +1,439 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#include "vm/profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "vm/heap.h"
+#include "vm/interpreter.h"
+#include "vm/isolate.h"
+#include "vm/lockers.h"
+#include "vm/os.h"
+#include "vm/thread_pool.h"
+
+namespace psoup {
+
+// Numbers the profile files of the isolates of this process.
+static std::atomic<intptr_t> profile_sequence(0);
+
+static int64_t CurrentMicros() {
+  return OS::CurrentMonotonicNanos() / kNanosecondsPerMicrosecond;
+}
+
+class Profiler::SamplerTask : public ThreadPool::Task {
+ public:
+  explicit SamplerTask(Profiler* profiler) : profiler_(profiler) {}
+
+  void Run() override { profiler_->RunSampler(); }
+
+ private:
+  Profiler* const profiler_;
+
+  DISALLOW_COPY_AND_ASSIGN(SamplerTask);
+};
+
+Profiler::Profiler(Heap* heap,
+                   Interpreter* interpreter,
+                   intptr_t hz,
+                   size_t buffer_size,
+                   const char* file)
+    : interpreter_(interpreter),
+      period_nanos_(kNanosecondsPerSecond / hz),
+      sequence_(profile_sequence.fetch_add(1, std::memory_order_relaxed)),
+      file_(file),
+      start_micros_(CurrentMicros()),
+      last_micros_(start_micros_),
+      head_(0),
+      tail_(0),
+      used_(0),
+      num_samples_(0),
+      num_dropped_(0),
+      idle_(false),
+      monitor_(),
+      stopping_(false),
+      running_(true) {
+  intptr_t capacity = buffer_size / sizeof(Object);
+  if (capacity < 2 + 2 * kMaxDepth) {
+    capacity = 2 + 2 * kMaxDepth;  // Room for the deepest sample.
+  }
+  Array samples = heap->AllocateArray(capacity);  // SAFEPOINT
+  for (intptr_t i = 0; i < capacity; i++) {
+    samples->set_element(i, SmallInteger::New(0), kNoBarrier);
+  }
+  interpreter_->set_profile_samples(samples);
+
+  if (!Isolate::thread_pool()->Run(new SamplerTask(this))) {
+    FATAL("Failed to start profiler task");
+  }
+}
+
+Profiler::~Profiler() {
+  MonitorLocker ml(&monitor_);
+  stopping_ = true;
+  ml.Notify();
+  while (running_) {
+    ml.Wait();
+  }
+}
+
+void Profiler::RunSampler() {
+  MonitorLocker ml(&monitor_);
+  int64_t next = OS::CurrentMonotonicNanos() + period_nanos_;
+  while (!stopping_) {
+    if (ml.WaitUntilNanos(next) == Monitor::kTimedOut) {
+      interpreter_->Interrupt(Interpreter::kInterruptProfile);
+      next += period_nanos_;
+      int64_t now = OS::CurrentMonotonicNanos();
+      if (next <= now) {
+        // Fell behind, e.g. the machine was suspended. Don't catch up.
+        next = now + period_nanos_;
+      }
+    }
+  }
+  running_ = false;
+  ml.Notify();
+}
+
+void Profiler::Record(intptr_t depth, const Object* frames) {
+  ASSERT((depth > 0) && (depth <= kMaxDepth));
+  idle_ = false;
+  Append(depth, frames);
+}
+
+void Profiler::RecordIdle() {
+  if (idle_) {
+    return;  // Still idle since the last sample.
+  }
+  idle_ = true;
+  Append(0, nullptr);
+}
+
+void Profiler::Append(intptr_t depth, const Object* frames) {
+  Array samples = Array::Cast(interpreter_->profile_samples());
+  intptr_t capacity = samples->Size();
+  intptr_t size = 2 + 2 * depth;
+
+  while (used_ + size > capacity) {
+    // Drop the oldest sample.
+    intptr_t oldest_depth =
+        SmallInteger::Cast(samples->element(head_))->value();
+    intptr_t oldest_delta =
+        SmallInteger::Cast(samples->element((head_ + 1) % capacity))->value();
+    intptr_t oldest_size = 2 + 2 * oldest_depth;
+    start_micros_ += oldest_delta;
+    head_ = (head_ + oldest_size) % capacity;
+    used_ -= oldest_size;
+    num_samples_--;
+    num_dropped_++;
+  }
+
+  int64_t now = CurrentMicros();
+  int64_t delta = now - last_micros_;
+  if (delta > SmallInteger::kMaxValue) {
+    delta = SmallInteger::kMaxValue;
+  }
+  last_micros_ += delta;
+
+  intptr_t slot = tail_;
+  samples->set_element(slot, SmallInteger::New(depth), kNoBarrier);
+  slot = (slot + 1) % capacity;
+  samples->set_element(slot, SmallInteger::New(delta), kNoBarrier);
+  slot = (slot + 1) % capacity;
+  for (intptr_t i = 0; i < 2 * depth; i += 2) {
+    samples->set_element(slot, frames[i]);
+    slot = (slot + 1) % capacity;
+    samples->set_element(slot, frames[i + 1], kNoBarrier);
+    slot = (slot + 1) % capacity;
+  }
+  tail_ = slot;
+  used_ += size;
+  num_samples_++;
+}
+
+// A node of the call tree written to the profile. Children are chained
+// through their siblings; ticks are (BCI, count) pairs for the samples that
+// stopped in this node.
+struct ProfileNode {
+  Object method;  // SmallInteger 0 for the root and idle nodes.
+  bool is_closure;
+  intptr_t first_child;
+  intptr_t next_sibling;
+  intptr_t hit_count;
+  intptr_t* ticks;
+  intptr_t num_ticks;
+};
+
+class ProfileTree {
+ public:
+  ProfileTree()
+      : nodes_(nullptr), size_(0), capacity_(0), idle_(kNone) {
+    AddNode(kNone, Object(), false);  // The root.
+  }
+
+  ~ProfileTree() {
+    for (intptr_t i = 0; i < size_; i++) {
+      free(nodes_[i].ticks);
+    }
+    free(nodes_);
+  }
+
+  static constexpr intptr_t kRoot = 0;
+  static constexpr intptr_t kNone = -1;
+
+  intptr_t size() const { return size_; }
+  ProfileNode* node(intptr_t index) const { return &nodes_[index]; }
+  bool IsIdle(intptr_t index) const { return index == idle_; }
+
+  intptr_t Idle() {
+    if (idle_ == kNone) {
+      idle_ = AddNode(kRoot, Object(), false);
+    }
+    return idle_;
+  }
+
+  intptr_t Child(intptr_t parent, Object method, bool is_closure) {
+    intptr_t child = nodes_[parent].first_child;
+    while (child != kNone) {
+      if ((nodes_[child].method == method) &&
+          (nodes_[child].is_closure == is_closure) && (child != idle_)) {
+        return child;
+      }
+      child = nodes_[child].next_sibling;
+    }
+    return AddNode(parent, method, is_closure);
+  }
+
+  void AddTick(intptr_t index, intptr_t bci) {
+    ProfileNode* n = &nodes_[index];
+    n->hit_count++;
+    for (intptr_t i = 0; i < n->num_ticks; i++) {
+      if (n->ticks[2 * i] == bci) {
+        n->ticks[2 * i + 1]++;
+        return;
+      }
+    }
+    n->ticks = reinterpret_cast<intptr_t*>(
+        realloc(n->ticks, 2 * (n->num_ticks + 1) * sizeof(intptr_t)));
+    if (n->ticks == nullptr) {
+      FATAL("Out of memory");
+    }
+    n->ticks[2 * n->num_ticks] = bci;
+    n->ticks[2 * n->num_ticks + 1] = 1;
+    n->num_ticks++;
+  }
+
+ private:
+  intptr_t AddNode(intptr_t parent, Object method, bool is_closure) {
+    if (size_ == capacity_) {
+      capacity_ = capacity_ == 0 ? 64 : capacity_ * 2;
+      nodes_ = reinterpret_cast<ProfileNode*>(
+          realloc(nodes_, capacity_ * sizeof(ProfileNode)));
+      if (nodes_ == nullptr) {
+        FATAL("Out of memory");
+      }
+    }
+    intptr_t index = size_++;
+    ProfileNode* n = &nodes_[index];
+    n->method = method;
+    n->is_closure = is_closure;
+    n->first_child = kNone;
+    n->next_sibling = kNone;
+    n->hit_count = 0;
+    n->ticks = nullptr;
+    n->num_ticks = 0;
+    if (parent != kNone) {
+      n->next_sibling = nodes_[parent].first_child;
+      nodes_[parent].first_child = index;
+    }
+    return index;
+  }
+
+  ProfileNode* nodes_;
+  intptr_t size_;
+  intptr_t capacity_;
+  intptr_t idle_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProfileTree);
+};
+
+static void WriteJSONString(FILE* f, const uint8_t* chars, intptr_t length) {
+  for (intptr_t i = 0; i < length; i++) {
+    uint8_t c = chars[i];
+    if ((c == '"') || (c == '\\')) {
+      fprintf(f, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(f, "\\u%04x", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+}
+
+static void WriteJSONString(FILE* f, String string) {
+  WriteJSONString(f, string->element_addr(0), string->Size());
+}
+
+static void WriteJSONString(FILE* f, const char* cstr) {
+  WriteJSONString(f, reinterpret_cast<const uint8_t*>(cstr), strlen(cstr));
+}
+
+// As in Activation::PrintStack, except that a sample knows only the method,
+// not the receiver's class.
+static void WriteFunctionName(FILE* f, Method method, bool is_closure,
+                              Object nil) {
+  if (is_closure) {
+    WriteJSONString(f, "[] in ");
+  }
+  AbstractMixin mixin = method->mixin();
+  if (mixin != nil) {
+    String mixin_name = mixin->name();
+    if (mixin_name->IsString()) {
+      WriteJSONString(f, mixin_name);
+    } else {
+      mixin_name = AbstractMixin::Cast(mixin_name)->name();
+      WriteJSONString(f, mixin_name);
+      WriteJSONString(f, " class");
+    }
+    WriteJSONString(f, " ");
+  }
+  WriteJSONString(f, method->selector());
+}
+
+void Profiler::GetFilename(char* buffer, size_t size) const {
+  if (file_[0] == '\0') {
+    // The pid keeps runs that share a working directory apart.
+    snprintf(buffer, size, "psoup-%" Pd "-%" Pd ".cpuprofile",
+             OS::ProcessId(), sequence_);
+    return;
+  }
+  if (sequence_ == 0) {
+    snprintf(buffer, size, "%s", file_);
+    return;
+  }
+  // The other isolates' profiles go next to the first: a.cpuprofile,
+  // a-1.cpuprofile, ...
+  const char* dot = strrchr(file_, '.');
+  const char* slash = strrchr(file_, '/');
+  if ((dot == nullptr) || ((slash != nullptr) && (dot < slash)) ||
+      (dot == file_) || (dot[-1] == '/')) {
+    dot = file_ + strlen(file_);
+  }
+  snprintf(buffer, size, "%.*s-%" Pd "%s", static_cast<int>(dot - file_),
+           file_, sequence_, dot);
+}
+
+void Profiler::WriteProfile() {
+  Array samples = Array::Cast(interpreter_->profile_samples());
+  intptr_t capacity = samples->Size();
+  Object nil = interpreter_->nil_obj();
+
+  // Nothing here allocates in the heap, so the methods in the ring stay put.
+  ProfileTree tree;
+  size_t length = (num_samples_ + 1) * sizeof(intptr_t);
+  intptr_t* leaves = reinterpret_cast<intptr_t*>(malloc(length));
+  intptr_t* deltas = reinterpret_cast<intptr_t*>(malloc(length));
+  if ((leaves == nullptr) || (deltas == nullptr)) {
+    FATAL("Out of memory");
+  }
+  int64_t end_micros = start_micros_;
+  intptr_t slot = head_;
+  for (intptr_t i = 0; i < num_samples_; i++) {
+    intptr_t depth = SmallInteger::Cast(samples->element(slot))->value();
+    deltas[i] = SmallInteger::Cast(
+        samples->element((slot + 1) % capacity))->value();
+    end_micros += deltas[i];
+    if (depth == 0) {
+      leaves[i] = tree.Idle();
+      tree.node(leaves[i])->hit_count++;
+    } else {
+      // Frames are top first; the tree is built from the bottom.
+      intptr_t node = ProfileTree::kRoot;
+      intptr_t bci = 0;
+      for (intptr_t j = depth - 1; j >= 0; j--) {
+        Object method = samples->element((slot + 2 + 2 * j) % capacity);
+        intptr_t flags = SmallInteger::Cast(
+            samples->element((slot + 3 + 2 * j) % capacity))->value();
+        node = tree.Child(node, method, (flags & 1) != 0);
+        bci = flags >> 1;
+      }
+      tree.AddTick(node, bci);
+      leaves[i] = node;
+    }
+    slot = (slot + 2 + 2 * depth) % capacity;
+  }
+  end_micros += period_nanos_ / kNanosecondsPerMicrosecond;
+
+  char filename[IsolateOptions::kMaxProfileFileLength + 32];
+  GetFilename(filename, sizeof(filename));
+  FILE* f = fopen(filename, "w");
+  if (f == nullptr) {
+    OS::PrintErr("Cannot open %s\n", filename);
+    free(leaves);
+    free(deltas);
+    return;
+  }
+
+  // Node ids are 1-based, as DevTools numbers them.
+  fprintf(f, "{\"nodes\":[");
+  for (intptr_t i = 0; i < tree.size(); i++) {
+    ProfileNode* n = tree.node(i);
+    fprintf(f, "%s{\"id\":%" Pd ",\"callFrame\":{\"functionName\":\"",
+            i == 0 ? "" : ",\n", i + 1);
+    if (i == ProfileTree::kRoot) {
+      WriteJSONString(f, "(root)");
+    } else if (tree.IsIdle(i)) {
+      WriteJSONString(f, "(idle)");
+    } else {
+      WriteFunctionName(f, Method::Cast(n->method), n->is_closure, nil);
+    }
+    fprintf(f, "\",\"scriptId\":\"0\",\"url\":\"\","
+            "\"lineNumber\":-1,\"columnNumber\":-1},"
+            "\"hitCount\":%" Pd, n->hit_count);
+    if (n->first_child != ProfileTree::kNone) {
+      fprintf(f, ",\"children\":[");
+      for (intptr_t c = n->first_child; c != ProfileTree::kNone;
+           c = tree.node(c)->next_sibling) {
+        fprintf(f, "%s%" Pd, c == n->first_child ? "" : ",", c + 1);
+      }
+      fprintf(f, "]");
+    }
+    if (n->num_ticks != 0) {
+      // Bytecode indices stand in for line numbers.
+      fprintf(f, ",\"positionTicks\":[");
+      for (intptr_t t = 0; t < n->num_ticks; t++) {
+        fprintf(f, "%s{\"line\":%" Pd ",\"ticks\":%" Pd "}", t == 0 ? "" : ",",
+                n->ticks[2 * t], n->ticks[2 * t + 1]);
+      }
+      fprintf(f, "]");
+    }
+    fprintf(f, "}");
+  }
+  fprintf(f, "],\n\"startTime\":%" Pd64 ",\"endTime\":%" Pd64 ",\n",
+          start_micros_, end_micros);
+  fprintf(f, "\"samples\":[");
+  for (intptr_t i = 0; i < num_samples_; i++) {
+    fprintf(f, "%s%" Pd, i == 0 ? "" : ",", leaves[i] + 1);
+  }
+  fprintf(f, "],\n\"timeDeltas\":[");
+  for (intptr_t i = 0; i < num_samples_; i++) {
+    fprintf(f, "%s%" Pd, i == 0 ? "" : ",", deltas[i]);
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+
+  if (num_dropped_ != 0) {
+    OS::PrintErr("%s: dropped the oldest %" Pd " samples\n", filename,
+                 num_dropped_);
+  }
+
+  free(leaves);
+  free(deltas);
+}
+
+}  // namespace psoup
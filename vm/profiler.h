@@ -0,0 +1,84 @@
+// Copyright (c) 2026, the Newspeak project authors. Please see the AUTHORS file
+// for details. All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+#ifndef VM_PROFILER_H_
+#define VM_PROFILER_H_
+
+#include "vm/globals.h"
+#include "vm/object.h"
+#include "vm/thread.h"
+
+namespace psoup {
+
+class Heap;
+class Interpreter;
+
+// A sampling CPU profiler. A sampler task on the thread pool interrupts the
+// isolate at a fixed rate, and at its next interrupt check the interpreter
+// walks its frames and hands them to Record. Samples go into a ring held in a
+// heap array that is a root of the interpreter, so the collector keeps the
+// methods in them alive and up to date without any help from the profiler.
+// When the ring is full the oldest samples are dropped.
+//
+// Each sample in the ring is
+//   [depth] [microseconds since the previous sample] [method] [bci flags] ...
+// with one method and (BCI << 1 | is closure) pair per frame, top first. A
+// sample without frames marks the isolate going back to its message loop; the
+// time until the next sample is idle.
+//
+// When the isolate exits the samples are written out as a Chrome DevTools
+// .cpuprofile, which DevTools, speedscope and Perfetto all load. Isolates are
+// numbered in the order they start profiling, which names their files.
+class Profiler {
+ public:
+  static constexpr intptr_t kMaxDepth = 128;
+
+  // Samples the interpreter hz times a second, into a ring of buffer_size
+  // bytes allocated in the heap. The profile is written to file as given by
+  // IsolateOptions::profile_file, which must outlive the profiler.
+  Profiler(Heap* heap,
+           Interpreter* interpreter,
+           intptr_t hz,
+           size_t buffer_size,
+           const char* file);
+  ~Profiler();  // Stops the sampler.
+
+  // Record is called by the interpreter at an interrupt check, RecordIdle by
+  // the isolate when it goes back to its message loop.
+  void Record(intptr_t depth, const Object* frames);
+  void RecordIdle();
+
+  void WriteProfile();
+
+ private:
+  class SamplerTask;
+
+  void RunSampler();
+  void Append(intptr_t depth, const Object* frames);
+  void GetFilename(char* buffer, size_t size) const;
+
+  Interpreter* const interpreter_;
+  const int64_t period_nanos_;
+  const intptr_t sequence_;
+  const char* const file_;
+
+  int64_t start_micros_;  // Of the oldest sample still in the ring.
+  int64_t last_micros_;
+  intptr_t head_;  // Slot of the oldest sample.
+  intptr_t tail_;  // Slot where the next sample goes.
+  intptr_t used_;
+  intptr_t num_samples_;
+  intptr_t num_dropped_;
+  bool idle_;
+
+  Monitor monitor_;
+  bool stopping_;  // Protected by monitor_.
+  bool running_;   // Protected by monitor_.
+
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+}  // namespace psoup
+
+#endif  // VM_PROFILER_H_
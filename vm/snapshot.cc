@@ -289,12 +289,11 @@ class ActivationCluster : public Cluster {
       ASSERT(size < kMaxTemps);
       object->set_stack_depth(SmallInteger::New(size));
 
+      Array temps = h->AllocateArray(size, Heap::kSnapshot);
       for (intptr_t j = 0; j < size; j++) {
-        object->set_temp(j, d->ReadRef(), kNoBarrier);
-      }
-      for (intptr_t j = size; j < kMaxTemps; j++) {
-        object->set_temp(j, SmallInteger::New(0), kNoBarrier);
+        temps->set_element(j, d->ReadRef(), kNoBarrier);
       }
+      object->set_temps(temps, kNoBarrier);
     }
   }
 };
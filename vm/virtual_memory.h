@@ -32,14 +32,34 @@ class VirtualMemory {
     kNoAccess,
     kReadOnly,
     kReadWrite,
+    kReadExecute,
   };
 
+  // Transparent huge pages on the platforms that have them.
+  static constexpr size_t kHugePageSize = 2 * MB;
+
   static VirtualMemory Allocate(size_t size,
                                 Protection protection,
                                 const char* name);
+  // Reserves address space, aligned to kHugePageSize, without backing it with
+  // memory. Returns an empty VirtualMemory where this is not supported.
+  static VirtualMemory Reserve(size_t size, const char* name);
   void Free();
   bool Protect(Protection protection);
 
+  // Backs part of a reservation with read-write memory and returns it.
+  VirtualMemory Commit(uword address, size_t size);
+  // Returns the memory behind a committed part to the system, leaving the
+  // address space reserved.
+  void Decommit(const VirtualMemory& part);
+  // Returns the memory behind a range to the system, leaving it accessible but
+  // with undefined contents. Ignored where not supported.
+  void Discard(uword address, size_t size) const;
+
+  // Hints, ignored where not supported.
+  void AdviseHugePages();
+  void BindToCurrentNode();  // Prefer the NUMA node of the calling thread.
+
   uword base() const { return reinterpret_cast<uword>(address_); }
   uword limit() const { return base() + size(); }
   size_t size() const { return size_; }
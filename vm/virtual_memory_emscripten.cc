@@ -31,6 +31,25 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
   return VirtualMemory(address, size);
 }
 
+VirtualMemory VirtualMemory::Reserve(size_t size, const char* name) {
+  return VirtualMemory();  // Not supported: regions are allocated separately.
+}
+
+VirtualMemory VirtualMemory::Commit(uword address, size_t size) {
+  UNREACHABLE();
+  return VirtualMemory();
+}
+
+void VirtualMemory::Decommit(const VirtualMemory& part) {
+  UNREACHABLE();
+}
+
+void VirtualMemory::Discard(uword address, size_t size) const {}
+
+void VirtualMemory::AdviseHugePages() {}
+
+void VirtualMemory::BindToCurrentNode() {}
+
 void VirtualMemory::Free() {
   free(address_);
 }
@@ -68,6 +68,9 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
     case kReadWrite:
       prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE;
       break;
+    case kReadExecute:
+      prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_EXECUTE;
+      break;
     default:
       UNREACHABLE();
       prot = 0;
@@ -95,6 +98,25 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
   return VirtualMemory(reinterpret_cast<void*>(addr), size);
 }
 
+VirtualMemory VirtualMemory::Reserve(size_t size, const char* name) {
+  return VirtualMemory();  // Not supported: regions are allocated separately.
+}
+
+VirtualMemory VirtualMemory::Commit(uword address, size_t size) {
+  UNREACHABLE();
+  return VirtualMemory();
+}
+
+void VirtualMemory::Decommit(const VirtualMemory& part) {
+  UNREACHABLE();
+}
+
+void VirtualMemory::Discard(uword address, size_t size) const {}
+
+void VirtualMemory::AdviseHugePages() {}
+
+void VirtualMemory::BindToCurrentNode() {}
+
 void VirtualMemory::Free() {
   zx_handle_t vmar = zx_vmar_root_self();
   zx_status_t status = zx_vmar_unmap(vmar,
@@ -117,6 +139,9 @@ bool VirtualMemory::Protect(Protection protection) {
     case kReadWrite:
       prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE;
       break;
+    case kReadExecute:
+      prot = ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_EXECUTE;
+      break;
     default:
       UNREACHABLE();
       prot = 0;
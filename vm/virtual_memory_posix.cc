@@ -14,10 +14,12 @@
 
 #if defined(OS_ANDROID) || defined(OS_LINUX)
 #include <sys/prctl.h>
+#include <sys/syscall.h>
 #endif
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -57,6 +59,7 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
     case kNoAccess: prot = PROT_NONE; break;
     case kReadOnly: prot = PROT_READ; break;
     case kReadWrite: prot = PROT_READ | PROT_WRITE; break;
+    case kReadExecute: prot = PROT_READ | PROT_EXEC; break;
     default:
       UNREACHABLE();
       prot = 0;
@@ -82,6 +85,92 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
   return VirtualMemory(address, size);
 }
 
+VirtualMemory VirtualMemory::Reserve(size_t size, const char* name) {
+  ASSERT(Utils::IsAligned(size, kHugePageSize));
+  // Over-reserve, then trim to alignment.
+  size_t padded_size = size + kHugePageSize;
+  void* address = mmap(nullptr, padded_size, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+  if (address == MAP_FAILED) {
+    return VirtualMemory();
+  }
+  uword start = reinterpret_cast<uword>(address);
+  uword aligned_start = Utils::RoundUp(start, kHugePageSize);
+  if (aligned_start > start) {
+    munmap(address, aligned_start - start);
+  }
+  uword end = start + padded_size;
+  uword aligned_end = aligned_start + size;
+  if (end > aligned_end) {
+    munmap(reinterpret_cast<void*>(aligned_end), end - aligned_end);
+  }
+  address = reinterpret_cast<void*>(aligned_start);
+
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, address, size, name);
+#endif
+
+  return VirtualMemory(address, size);
+}
+
+VirtualMemory VirtualMemory::Commit(uword address, size_t size) {
+  ASSERT((address >= base()) && (address + size <= limit()));
+  if (mprotect(reinterpret_cast<void*>(address), size,
+               PROT_READ | PROT_WRITE) != 0) {
+    FATAL("Failed to commit %" Pd " bytes\n", size);
+  }
+  return VirtualMemory(reinterpret_cast<void*>(address), size);
+}
+
+void VirtualMemory::Decommit(const VirtualMemory& part) {
+  ASSERT((part.base() >= base()) && (part.limit() <= limit()));
+#if defined(OS_ANDROID) || defined(OS_LINUX)
+  // Keeps the hints given for the reservation, unlike mapping over it.
+  int result = madvise(part.address_, part.size_, MADV_DONTNEED);
+  if (result == 0) {
+    result = mprotect(part.address_, part.size_, PROT_NONE);
+  }
+#else
+  void* address = mmap(part.address_, part.size_, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_FIXED,
+                       -1, 0);
+  int result = address == MAP_FAILED ? -1 : 0;
+#endif
+  if (result != 0) {
+    FATAL("Failed to decommit %" Pd " bytes\n", part.size_);
+  }
+}
+
+void VirtualMemory::Discard(uword address, size_t size) const {
+  ASSERT((address >= base()) && ((address + size) <= limit()));
+  madvise(reinterpret_cast<void*>(address), size, MADV_DONTNEED);
+}
+
+void VirtualMemory::AdviseHugePages() {
+#if defined(MADV_HUGEPAGE)
+  madvise(address_, size_, MADV_HUGEPAGE);
+#endif
+}
+
+void VirtualMemory::BindToCurrentNode() {
+#if defined(OS_LINUX) && defined(SYS_getcpu) && defined(SYS_mbind)
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return;
+  }
+  unsigned long nodemask = 1;  // NOLINT (long used by mbind).
+  if (node >= kBitsPerByte * sizeof(nodemask)) {
+    return;
+  }
+  nodemask <<= node;
+  // Preferred rather than bound, so that allocation falls back to other nodes
+  // rather than failing when this one is full.
+  const int kMPolPreferred = 1;
+  syscall(SYS_mbind, address_, size_, kMPolPreferred, &nodemask,
+          kBitsPerByte * sizeof(nodemask) + 1, 0);
+#endif
+}
+
 void VirtualMemory::Free() {
   int result = munmap(address_, size_);
   if (result != 0) {
@@ -95,6 +184,7 @@ bool VirtualMemory::Protect(Protection protection) {
     case kNoAccess: prot = PROT_NONE; break;
     case kReadOnly: prot = PROT_READ; break;
     case kReadWrite: prot = PROT_READ | PROT_WRITE; break;
+    case kReadExecute: prot = PROT_READ | PROT_EXEC; break;
     default:
       UNREACHABLE();
       prot = 0;
@@ -9,6 +9,7 @@
 
 #include "vm/assert.h"
 #include "vm/os.h"
+#include "vm/utils.h"
 
 namespace psoup {
 
@@ -57,6 +58,7 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
     case kNoAccess: prot = PAGE_NOACCESS; break;
     case kReadOnly: prot = PAGE_READONLY; break;
     case kReadWrite: prot = PAGE_READWRITE; break;
+    case kReadExecute: prot = PAGE_EXECUTE_READ; break;
     default:
       UNREACHABLE();
       prot = 0;
@@ -70,6 +72,59 @@ VirtualMemory VirtualMemory::Allocate(size_t size,
   return VirtualMemory(address, size);
 }
 
+VirtualMemory VirtualMemory::Reserve(size_t size, const char* name) {
+  ASSERT(Utils::IsAligned(size, kHugePageSize));
+  // A reservation can only be released whole, so find an aligned address by
+  // over-reserving, then reserve again exactly there.
+  for (intptr_t attempt = 0; attempt < 3; attempt++) {
+    void* address = VirtualAlloc(nullptr, size + kHugePageSize, MEM_RESERVE,
+                                 PAGE_NOACCESS);
+    if (address == nullptr) {
+      return VirtualMemory();
+    }
+    uword aligned = Utils::RoundUp(reinterpret_cast<uword>(address),
+                                   kHugePageSize);
+    VirtualFree(address, 0, MEM_RELEASE);
+    address = VirtualAlloc(reinterpret_cast<void*>(aligned), size,
+                           MEM_RESERVE, PAGE_NOACCESS);
+    if (address != nullptr) {
+      return VirtualMemory(address, size);
+    }
+  }
+  return VirtualMemory();
+}
+
+VirtualMemory VirtualMemory::Commit(uword address, size_t size) {
+  ASSERT((address >= base()) && (address + size <= limit()));
+  void* result = VirtualAlloc(reinterpret_cast<void*>(address), size,
+                              MEM_COMMIT, PAGE_READWRITE);
+  if (result == nullptr) {
+    FATAL("Failed to commit %" Pd " bytes\n", size);
+  }
+  return VirtualMemory(result, size);
+}
+
+void VirtualMemory::Decommit(const VirtualMemory& part) {
+  ASSERT((part.base() >= base()) && (part.limit() <= limit()));
+  if (VirtualFree(part.address_, part.size_, MEM_DECOMMIT) == 0) {
+    FATAL("VirtualFree failed %d", GetLastError());
+  }
+}
+
+void VirtualMemory::Discard(uword address, size_t size) const {
+  ASSERT((address >= base()) && ((address + size) <= limit()));
+  VirtualAlloc(reinterpret_cast<void*>(address), size, MEM_RESET,
+               PAGE_READWRITE);
+}
+
+void VirtualMemory::AdviseHugePages() {
+  // Large pages need a privilege and cannot be decommitted piecewise.
+}
+
+void VirtualMemory::BindToCurrentNode() {
+  // The default policy already prefers the node of the first-touching thread.
+}
+
 void VirtualMemory::Free() {
   if (VirtualFree(address_, 0, MEM_RELEASE) == 0) {
     FATAL("VirtualFree failed %d", GetLastError());
@@ -82,6 +137,7 @@ bool VirtualMemory::Protect(Protection protection) {
     case kNoAccess: prot = PAGE_NOACCESS; break;
     case kReadOnly: prot = PAGE_READONLY; break;
     case kReadWrite: prot = PAGE_READWRITE; break;
+    case kReadExecute: prot = PAGE_EXECUTE_READ; break;
     default:
       UNREACHABLE();
       prot = 0;